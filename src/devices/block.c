@@ -3,8 +3,10 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/iosched.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 
 /* A block device. */
 struct block
@@ -17,6 +19,9 @@ struct block
 
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
+    struct block_queue *queue;          /* Waiting requests, or null if
+                                           OPS are stacked. */
+    bool shares_queue;                  /* QUEUE belongs to another device? */
 
     struct lock lock;                   /* Protects read_cnt and write_cnt. */
     unsigned long long read_cnt;        /* Number of sectors read. */
@@ -30,6 +35,14 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void transfer (struct block *, bool write, block_sector_t,
+                      const struct block_iovec *, size_t iov_cnt);
+static void driver_transfer (struct block *, bool write, block_sector_t,
+                             const struct block_iovec *, size_t iov_cnt);
+static void dispatch (void *q_);
+static void init_waiting_bio (struct bio *, bool write, block_sector_t,
+                              const struct block_iovec *, size_t iov_cnt,
+                              struct semaphore *done);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -122,11 +135,9 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  lock_acquire (&block->lock);
-  block->read_cnt++;
-  lock_release (&block->lock);
+  struct block_iovec iov = { buffer, 1 };
+
+  transfer (block, false, sector, &iov, 1);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -137,12 +148,273 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
+  struct block_iovec iov = { (void *) buffer, 1 };
+
+  transfer (block, true, sector, &iov, 1);
+}
+
+/* Returns the total number of sectors described by IOV. */
+static block_sector_t
+iov_sectors (const struct block_iovec *iov, size_t iov_cnt)
+{
+  block_sector_t cnt = 0;
+  size_t i;
+
+  for (i = 0; i < iov_cnt; i++)
+    cnt += iov[i].cnt;
+  return cnt;
+}
+
+/* Reads the sectors starting at SECTOR from BLOCK into the
+   buffers in IOV, which together describe IOV_CNT pieces.  The
+   driver transfers the whole run with as few commands as it can.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_readv (struct block *block, block_sector_t sector,
+             const struct block_iovec *iov, size_t iov_cnt)
+{
+  transfer (block, false, sector, iov, iov_cnt);
+}
+
+/* Writes the buffers in IOV to the sectors starting at SECTOR on
+   BLOCK, as block_readv() does for reads.  Returns after the
+   block device has acknowledged receiving all of the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_writev (struct block *block, block_sector_t sector,
+              const struct block_iovec *iov, size_t iov_cnt)
+{
+  transfer (block, true, sector, iov, iov_cnt);
+}
+
+/* Starts BIO on BLOCK and returns at once.  BIO's END is called
+   once the transfer is done, or before returning if BIO moves no
+   sectors.  BIO's submitter fills in its WRITE,
+   SECTOR, IOV, IOV_CNT, END, and AUX members; the rest belongs to
+   the block layer until then. */
+void
+block_submit (struct block *block, struct bio *bio)
+{
+  bio->cnt = iov_sectors (bio->iov, bio->iov_cnt);
+  if (bio->cnt == 0)
+    {
+      bio->end (bio);
+      return;
+    }
+  check_sector (block, bio->sector);
+  check_sector (block, bio->sector + bio->cnt - 1);
+  ASSERT (!bio->write || block->type != BLOCK_FOREIGN);
+
   lock_acquire (&block->lock);
-  block->write_cnt++;
+  if (bio->write)
+    block->write_cnt += bio->cnt;
+  else
+    block->read_cnt += bio->cnt;
   lock_release (&block->lock);
+
+  if (block->queue == NULL)
+    {
+      /* Stacked on another device, which queues it. */
+      ASSERT (block->ops->submit != NULL);
+      block->ops->submit (block->aux, bio);
+      return;
+    }
+
+  bio->block = block;
+  lock_acquire (&block->queue->lock);
+  iosched_add (block->queue, bio);
+  cond_signal (&block->queue->ready, &block->queue->lock);
+  lock_release (&block->queue->lock);
+}
+
+/* Called by a driver once it is done with BIO, which it got from
+   its submit operation.  May be called from an interrupt
+   handler. */
+void
+block_complete (struct bio *bio)
+{
+  bio->end (bio);
+}
+
+/* A bio END function that ups the semaphore BIO's AUX points to,
+   for submitters that wait for their bios to finish. */
+void
+block_bio_wake (struct bio *bio)
+{
+  sema_up (bio->aux);
+}
+
+/* Sets up BIO to move the sectors starting at SECTOR to or from
+   the buffers in IOV, according to WRITE, and to up DONE once it
+   is finished. */
+static void
+init_waiting_bio (struct bio *bio, bool write, block_sector_t sector,
+                  const struct block_iovec *iov, size_t iov_cnt,
+                  struct semaphore *done)
+{
+  sema_init (done, 0);
+  bio->write = write;
+  bio->sector = sector;
+  bio->iov = iov;
+  bio->iov_cnt = iov_cnt;
+  bio->end = block_bio_wake;
+  bio->aux = done;
+}
+
+/* Moves the sectors starting at SECTOR on BLOCK to or from the
+   buffers in IOV, according to WRITE, and waits for it to be
+   done. */
+static void
+transfer (struct block *block, bool write, block_sector_t sector,
+          const struct block_iovec *iov, size_t iov_cnt)
+{
+  struct semaphore done;
+  struct bio bio;
+
+  init_waiting_bio (&bio, write, sector, iov, iov_cnt, &done);
+  block_submit (block, &bio);
+  sema_down (&done);
+}
+
+/* Has BLOCK's driver move the sectors starting at SECTOR to or
+   from the buffers in IOV, at most IOSCHED_MAX_SECTORS in at most
+   IOSCHED_MAX_IOV pieces, and waits for it to be done.  Drivers
+   without a submit operation get one call per sector. */
+static void
+driver_transfer (struct block *block, bool write, block_sector_t sector,
+                 const struct block_iovec *iov, size_t iov_cnt)
+{
+  size_t i;
+
+  if (block->ops->submit != NULL)
+    {
+      struct semaphore done;
+      struct bio bio;
+
+      init_waiting_bio (&bio, write, sector, iov, iov_cnt, &done);
+      bio.cnt = iov_sectors (iov, iov_cnt);
+      block->ops->submit (block->aux, &bio);
+      sema_down (&done);
+      return;
+    }
+
+  for (i = 0; i < iov_cnt; i++)
+    {
+      block_sector_t j;
+      for (j = 0; j < iov[i].cnt; j++)
+        {
+          uint8_t *buffer = (uint8_t *) iov[i].buffer + j * BLOCK_SECTOR_SIZE;
+          if (write)
+            block->ops->write (block->aux, sector++, buffer);
+          else
+            block->ops->read (block->aux, sector++, buffer);
+        }
+    }
+}
+
+/* Copies into CHUNK the next pieces of IOV from position *IDX,
+   *OFS, up to IOSCHED_MAX_SECTORS sectors in IOSCHED_MAX_IOV
+   pieces, splitting a piece if need be, and advances the
+   position.  Returns the number of pieces in CHUNK. */
+static size_t
+next_chunk (const struct block_iovec *iov, size_t iov_cnt,
+            size_t *idx, block_sector_t *ofs,
+            struct block_iovec chunk[IOSCHED_MAX_IOV])
+{
+  block_sector_t cnt = 0;
+  size_t n = 0;
+
+  while (*idx < iov_cnt && n < IOSCHED_MAX_IOV && cnt < IOSCHED_MAX_SECTORS)
+    {
+      block_sector_t take = iov[*idx].cnt - *ofs;
+      if (take > IOSCHED_MAX_SECTORS - cnt)
+        take = IOSCHED_MAX_SECTORS - cnt;
+
+      chunk[n].buffer = (uint8_t *) iov[*idx].buffer + *ofs * BLOCK_SECTOR_SIZE;
+      chunk[n].cnt = take;
+      n++;
+      cnt += take;
+
+      *ofs += take;
+      if (*ofs == iov[*idx].cnt)
+        {
+          ++*idx;
+          *ofs = 0;
+        }
+    }
+  return n;
+}
+
+/* Dispatcher thread for queue Q.  Takes the bios its scheduler
+   picks off Q, each with the ones it merged, hands them to their
+   device's driver as one transfer, in chunks it can take, and
+   then ends them.  Devices that share Q are dispatched to one at
+   a time. */
+static void
+dispatch (void *q_)
+{
+  struct block_queue *q = q_;
+  struct block_iovec iov[IOSCHED_MAX_IOV];
+  struct block_iovec chunk[IOSCHED_MAX_IOV];
+
+  for (;;)
+    {
+      struct bio *first;
+      const struct block_iovec *all;
+      struct list batch;
+      struct list_elem *e;
+      size_t iov_cnt = 0, req_cnt, idx = 0;
+      block_sector_t ofs = 0, sector;
+
+      list_init (&batch);
+      lock_acquire (&q->lock);
+      while (list_empty (&q->sorted))
+        cond_wait (&q->ready, &q->lock);
+      req_cnt = iosched_next (q, &batch);
+      lock_release (&q->lock);
+
+      /* A bio on its own may be longer than merging allows. */
+      first = list_entry (list_front (&batch), struct bio, fifo_elem);
+      if (req_cnt == 1)
+        {
+          all = first->iov;
+          iov_cnt = first->iov_cnt;
+        }
+      else
+        {
+          for (e = list_begin (&batch); e != list_end (&batch);
+               e = list_next (e))
+            {
+              struct bio *r = list_entry (e, struct bio, fifo_elem);
+              memcpy (iov + iov_cnt, r->iov, r->iov_cnt * sizeof *iov);
+              iov_cnt += r->iov_cnt;
+            }
+          all = iov;
+        }
+
+      for (sector = first->sector; idx < iov_cnt; )
+        {
+          size_t n = next_chunk (all, iov_cnt, &idx, &ofs, chunk);
+          driver_transfer (first->block, first->write, sector, chunk, n);
+          sector += iov_sectors (chunk, n);
+        }
+
+      lock_acquire (&q->lock);
+      q->request_cnt += req_cnt;
+      q->dispatch_cnt++;
+      lock_release (&q->lock);
+
+      /* A bio may be freed by its END: done with it once that is
+         called. */
+      for (e = list_begin (&batch); e != list_end (&batch); )
+        {
+          struct bio *r = list_entry (e, struct bio, fifo_elem);
+          e = list_next (e);
+          r->end (r);
+        }
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -166,10 +438,13 @@ block_type (struct block *block)
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Prints statistics for each block device used for a Pintos role,
+   then for each queue, under the name of the device that has it
+   to itself or shares it with others. */
 void
 block_print_stats (void)
 {
+  struct list_elem *e;
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
@@ -184,6 +459,21 @@ block_print_stats (void)
           lock_release (&block->lock);
         }
     }
+
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
+    {
+      struct block *block = list_entry (e, struct block, list_elem);
+      struct block_queue *q = block->queue;
+      if (q != NULL && !block->shares_queue)
+        {
+          lock_acquire (&q->lock);
+          printf ("%s: %llu requests in %llu dispatches (%s)\n",
+                  block->name, q->request_cnt, q->dispatch_cnt,
+                  q->sched->name);
+          lock_release (&q->lock);
+        }
+    }
 }
 
 /* Registers a new block device with the given NAME.  If
@@ -195,6 +485,23 @@ struct block *
 block_register (const char *name, enum block_type type,
                 const char *extra_info, block_sector_t size,
                 const struct block_operations *ops, void *aux)
+{
+  return block_register_shared (name, type, extra_info, size, ops, aux,
+                                NULL);
+}
+
+/* Registers a new block device like block_register(), except
+   that if SHARE is non-null, the new device gets no queue or
+   dispatcher of its own but joins SHARE's, so that the two never
+   have transfers under way at once.  That suits devices that
+   cannot work at the same time anyhow, such as the master and
+   slave disks on an IDE channel, and lets the scheduler order
+   their requests together. */
+struct block *
+block_register_shared (const char *name, enum block_type type,
+                       const char *extra_info, block_sector_t size,
+                       const struct block_operations *ops, void *aux,
+                       struct block *share)
 {
   struct block *block = malloc (sizeof *block);
   if (block == NULL)
@@ -209,6 +516,22 @@ block_register (const char *name, enum block_type type,
   block->read_cnt = 0;
   block->write_cnt = 0;
   lock_init (&block->lock);
+  block->queue = NULL;
+  block->shares_queue = false;
+  if (share != NULL)
+    {
+      ASSERT (!ops->stacked && share->queue != NULL);
+      block->queue = share->queue;
+      block->shares_queue = true;
+    }
+  else if (!ops->stacked)
+    {
+      block->queue = malloc (sizeof *block->queue);
+      if (block->queue == NULL)
+        PANIC ("Failed to allocate memory for block device queue");
+      iosched_queue_init (block->queue);
+      thread_create (block->name, NICE_DEFAULT, dispatch, block->queue);
+    }
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -1,6 +1,8 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <list.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
 
@@ -22,6 +24,45 @@ typedef uint32_t block_sector_t;
 
 struct block;
 
+/* One piece of a vectored transfer: CNT consecutive sectors
+   stored at BUFFER.  A vectored transfer moves the pieces to or
+   from consecutive sectors on the device, in order. */
+struct block_iovec
+  {
+    void *buffer;               /* Kernel buffer. */
+    block_sector_t cnt;         /* Number of sectors at BUFFER. */
+  };
+
+/* An asynchronous transfer of the sectors from SECTOR to or from
+   the IOV_CNT buffers of IOV, a scatter-gather list.  Once it is
+   done, the block layer calls END, passing the bio, from the
+   device's dispatcher thread; if IOV holds no sectors at all,
+   block_submit() calls END itself, in the submitter's thread,
+   before returning.  END may take locks, but must not wait for I/O
+   to the same device.  The bio and IOV must stay put until END is
+   called. */
+struct bio;
+typedef void bio_end_func (struct bio *);
+
+struct bio
+  {
+    /* Set by the submitter. */
+    bool write;                         /* Write, or read? */
+    block_sector_t sector;              /* First sector. */
+    const struct block_iovec *iov;      /* Buffers. */
+    size_t iov_cnt;                     /* Number of pieces in IOV. */
+    bio_end_func *end;                  /* Called once done. */
+    void *aux;                          /* For END's use. */
+
+    /* Owned by the block layer until END is called. */
+    struct block *block;                /* Device it is queued for. */
+    block_sector_t cnt;                 /* Number of sectors. */
+    struct list_elem sort_elem;         /* Element in queue's sorted. */
+    struct list_elem fifo_elem;         /* Element in queue's fifo,
+                                           then in a dispatch batch. */
+    int64_t deadline;                   /* Tick to serve it by. */
+  };
+
 /* Type of a block device. */
 enum block_type
   {
@@ -53,6 +94,12 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_readv (struct block *, block_sector_t,
+                  const struct block_iovec *, size_t iov_cnt);
+void block_writev (struct block *, block_sector_t,
+                   const struct block_iovec *, size_t iov_cnt);
+void block_submit (struct block *, struct bio *);
+void block_bio_wake (struct bio *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
@@ -63,12 +110,31 @@ void block_print_stats (void);
 
 struct block_operations
   {
+    /* Single-sector transfers, which return once done.  Only
+       called if SUBMIT is null. */
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Starts a transfer and returns, then calls block_complete()
+       on it once it is done, perhaps from an interrupt handler.
+       The dispatcher hands it at most IOSCHED_MAX_SECTORS sectors
+       in at most IOSCHED_MAX_IOV pieces at a time. */
+    void (*submit) (void *aux, struct bio *);
+
+    /* True if these operations only pass transfers on to another
+       block device, which queues them.  Otherwise the device gets
+       a request queue and a dispatcher thread that calls them. */
+    bool stacked;
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+struct block *block_register_shared (const char *name, enum block_type,
+                                     const char *extra_info,
+                                     block_sector_t size,
+                                     const struct block_operations *,
+                                     void *aux, struct block *share);
+void block_complete (struct bio *);
 
 #endif /* devices/block.h */
@@ -5,10 +5,13 @@
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 #include "devices/ioapic.h"
 #include "devices/trap.h"
 #include <string.h>
@@ -37,6 +40,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -52,6 +56,50 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA with retries. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA with retries. */
+
+/* Most sectors a single command can move: 128 kB. */
+#define MAX_SECTORS 256
+
+/* Bus master IDE registers, at offsets from a channel's base in
+   the controller's BAR4.  The secondary channel's base is 8 bytes
+   past the primary's. */
+#define BM_COMMAND 0            /* Command. */
+#define BM_STATUS 2             /* Status. */
+#define BM_PRDT 4               /* Physical address of the PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start the transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus master Status Register bits.  ERROR and INTR are cleared by
+   writing 1s to them. */
+#define BM_STA_ERROR 0x02       /* Transfer failed. */
+#define BM_STA_INTR 0x04        /* Disk interrupted. */
+
+/* Bit in the PCI programming interface of an IDE controller that
+   says it can master the bus. */
+#define PCI_IFACE_BUS_MASTER 0x80
+
+/* A Physical Region Descriptor: one physically contiguous piece
+   of memory in a bus master DMA transfer.  A piece may not cross
+   a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Bytes, with 0 meaning 64 kB. */
+    uint16_t flags;             /* PRD_EOT on the last piece. */
+  };
+#define PRD_EOT 0x8000
+#define PRD_CNT (PGSIZE / sizeof (struct prd))
+
+/* Use bus master DMA where the controller and disk support it?
+   Turned off by the -nodma kernel option. */
+bool ide_dma = true;
 
 /* An ATA device. */
 struct ata_disk
@@ -60,6 +108,9 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    bool dma;                   /* Move data by bus master DMA? */
+    int multiple;               /* Sectors per interrupt in PIO, or 0 to
+                                   use READ/WRITE SECTOR(S). */
   };
 
 /* An ATA channel (aka controller).
@@ -70,12 +121,28 @@ struct channel
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
 
-    struct lock lock;           /* Must acquire to access the controller. */
+    struct semaphore free;      /* Down while the controller is in use. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
-    struct semaphore completion_wait;   /* Up'd by interrupt handler. */
+    struct semaphore completion_wait;   /* Up'd by interrupt handler when
+                                           no bio is in progress. */
+
+    /* The bio in progress, which the interrupt handler carries on
+       and completes. */
+    struct bio *bio;            /* Bio being moved, or null. */
+    struct ata_disk *disk;      /* Disk it is on. */
+    bool dma;                   /* Moving it by DMA? */
+    size_t idx;                 /* Next piece of its iov to move, */
+    block_sector_t ofs;         /* and sector within that piece. */
+    block_sector_t left;        /* Sectors left to move by PIO. */
+
+    struct pci_io *bm;          /* Bus master registers, or NULL. */
+    int bm_base;                /* Offset of this channel's in BM. */
+    struct prd *prdt;           /* PRD table for DMA transfers. */
 
     struct ata_disk devices[2];     /* The devices on this channel. */
+    struct block *block;        /* First of them registered, whose queue
+                                   and dispatcher the other shares. */
   };
 
 /* We support the two "legacy" ATA channels found in a standard PC. */
@@ -87,8 +154,11 @@ static struct block_operations ide_operations;
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
+static struct pci_io *find_bus_master (void);
+static void set_multiple_mode (struct ata_disk *, int multiple);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sector (struct ata_disk *, block_sector_t,
+                           block_sector_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -98,12 +168,17 @@ static bool wait_while_busy (const struct ata_disk *);
 static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
+static bool iov_dma_aligned (const struct block_iovec *, size_t iov_cnt);
+static void start_dma (struct channel *);
+static void start_pio (struct channel *);
+static void advance (struct channel *, uint8_t status);
 static void interrupt_handler (struct intr_frame *);
 
 /* Initialize the disk subsystem and detect disks. */
 void
 ide_init (void) 
 {
+  struct pci_io *bm = ide_dma ? find_bus_master () : NULL;
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -126,9 +201,16 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
-      lock_init (&c->lock);
+      sema_init (&c->free, 1);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->bio = NULL;
+      c->block = NULL;
+      c->bm = bm;
+      c->bm_base = chan_no * 8;
+      c->prdt = bm != NULL ? palloc_get_page (0) : NULL;
+      if (c->prdt == NULL)
+        c->bm = NULL;
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -139,10 +221,14 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->dma = false;
+          d->multiple = 0;
         }
 
-      /* Route ide interrupts to cpu 0*/
-      ioapic_enable (IRQ_IDE, IRQ_CPU);
+      /* Route this channel's interrupts to cpu 0.  Each channel
+         has its own line, so that a command finishing on one does
+         not wait for the other. */
+      ioapic_enable (c->irq - T_IRQ0, IRQ_CPU);
          
       /* Register interrupt handler. */
       intr_register_ext (c->irq, interrupt_handler, c->name);
@@ -165,6 +251,25 @@ ide_init (void)
 
 static char *descramble_ata_string (char *, int size);
 
+/* Finds the PCI IDE controller, lets it master the bus, and
+   returns its bus master registers, or a null pointer if it
+   cannot do DMA. */
+static struct pci_io *
+find_bus_master (void)
+{
+  struct pci_dev *pd;
+  struct pci_io *bm;
+
+  pd = pci_get_dev_by_class (PCI_MAJOR_MASS_STORAGE, PCI_MINOR_IDE, -1, 0);
+  if (pd == NULL || !(pci_get_interface (pd) & PCI_IFACE_BUS_MASTER))
+    return NULL;
+  bm = pci_io_get_bar (pd, 4);
+  if (bm == NULL || pci_io_size (bm) < 16)
+    return NULL;
+  pci_enable_master (pd);
+  return bm;
+}
+
 /* Resets an ATA channel and waits for any devices present on it
    to finish the reset. */
 static void
@@ -277,12 +382,14 @@ identify_ata_device (struct ata_disk *d)
   /* Send the IDENTIFY DEVICE command, wait for an interrupt
      indicating the device's response is ready, and read the data
      into our buffer. */
+  sema_down (&c->free);
   select_device_wait (d);
   issue_pio_command (c, CMD_IDENTIFY_DEVICE);
   sema_down (&c->completion_wait);
   if (!wait_while_busy (d))
     {
       d->is_ata = false;
+      sema_up (&c->free);
       return;
     }
   input_sector (c, id);
@@ -292,8 +399,18 @@ identify_ata_device (struct ata_disk *d)
   memcpy (&capacity, &id[60*2], sizeof (uint32_t));
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
+
+  /* Move data by DMA if the disk supports it (word 49, bit 8),
+     otherwise as many sectors per interrupt as it allows (word
+     47, bits 7:0). */
+  if (c->bm != NULL && (id[49 * 2 + 1] & 0x01))
+    d->dma = true;
+  else
+    set_multiple_mode (d, (uint8_t) id[47 * 2]);
+  sema_up (&c->free);
   snprintf (extra_info, sizeof extra_info,
-            "model \"%s\", serial \"%s\"", model, serial);
+            "model \"%s\", serial \"%s\", %s", model, serial,
+            d->dma ? "DMA" : d->multiple > 0 ? "PIO multiple" : "PIO");
 
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
@@ -309,12 +426,34 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
-  /* Register. */
-  block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
-                          &ide_operations, d);
+  /* Register.  A channel runs one command at a time, so the
+     disks on it share a queue, while the two channels each have
+     their own and work at once. */
+  block = block_register_shared (d->name, BLOCK_RAW, extra_info, capacity,
+                                 &ide_operations, d, c->block);
+  if (c->block == NULL)
+    c->block = block;
   partition_scan (block);
 }
 
+/* Tells disk D to move MULTIPLE sectors per interrupt in READ
+   and WRITE MULTIPLE, and records it in D if the disk agrees. */
+static void
+set_multiple_mode (struct ata_disk *d, int multiple)
+{
+  struct channel *c = d->channel;
+
+  if (multiple <= 1)
+    return;
+  select_device_wait (d);
+  outb (reg_nsect (c), multiple);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if (!(inb (reg_alt_status (c)) & STA_ERR))
+    d->multiple = multiple;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -343,63 +482,244 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
+/* Starts moving BIO, at most MAX_SECTORS sectors, between disk D
+   and memory with a single command, and returns.  The interrupt
+   handler carries the transfer on and completes BIO.  Waits first
+   if D's channel is busy with another command. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_submit (void *d_, struct bio *bio)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
-}
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
-static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
-{
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  ASSERT (bio->cnt > 0 && bio->cnt <= MAX_SECTORS);
+
+  sema_down (&c->free);
+  c->bio = bio;
+  c->disk = d;
+  c->dma = d->dma && iov_dma_aligned (bio->iov, bio->iov_cnt);
+  c->idx = 0;
+  c->ofs = 0;
+  c->left = bio->cnt;
+  if (c->dma)
+    start_dma (c);
+  else
+    start_pio (c);
 }
 
 static struct block_operations ide_operations =
   {
-    ide_read,
-    ide_write
+    NULL,
+    NULL,
+    ide_submit,
+    false
   };
-
+
+/* Returns the next sector-sized buffer of channel C's bio, and
+   advances C's position in it. */
+static uint8_t *
+next_sector (struct channel *c)
+{
+  const struct block_iovec *iov = &c->bio->iov[c->idx];
+  uint8_t *sector = (uint8_t *) iov->buffer + c->ofs * BLOCK_SECTOR_SIZE;
+  if (++c->ofs == iov->cnt)
+    {
+      c->idx++;
+      c->ofs = 0;
+    }
+  return sector;
+}
+
+/* Returns true if every buffer in IOV starts on an even address,
+   as the controller needs to DMA into it. */
+static bool
+iov_dma_aligned (const struct block_iovec *iov, size_t iov_cnt)
+{
+  size_t i;
+
+  for (i = 0; i < iov_cnt; i++)
+    if ((uintptr_t) iov[i].buffer & 1)
+      return false;
+  return true;
+}
+
+/* Fills in channel C's PRD table to cover all of its bio. */
+static void
+build_prdt (struct channel *c)
+{
+  const struct bio *bio = c->bio;
+  size_t i, n = 0;
+
+  for (i = 0; i < bio->iov_cnt; i++)
+    {
+      uintptr_t addr = vtop (bio->iov[i].buffer);
+      size_t size = bio->iov[i].cnt * BLOCK_SECTOR_SIZE;
+
+      /* Split the piece at 64 kB boundaries. */
+      while (size > 0)
+        {
+          size_t piece = 0x10000 - (addr & 0xffff);
+          if (piece > size)
+            piece = size;
+
+          ASSERT (n < PRD_CNT);
+          c->prdt[n].addr = addr;
+          c->prdt[n].size = piece & 0xffff;
+          c->prdt[n].flags = 0;
+          n++;
+
+          addr += piece;
+          size -= piece;
+        }
+    }
+  c->prdt[n - 1].flags = PRD_EOT;
+}
+
+/* Starts channel C's bio with a single READ or WRITE DMA command.
+   The disk interrupts once, when it is done. */
+static void
+start_dma (struct channel *c)
+{
+  struct bio *bio = c->bio;
+  uint8_t direction = bio->write ? 0 : BM_CMD_READ;
+
+  build_prdt (c);
+  pci_reg_write32 (c->bm, c->bm_base + BM_PRDT, vtop (c->prdt));
+  pci_reg_write8 (c->bm, c->bm_base + BM_STATUS, BM_STA_ERROR | BM_STA_INTR);
+  pci_reg_write8 (c->bm, c->bm_base + BM_COMMAND, direction);
+
+  select_sector (c->disk, bio->sector, bio->cnt);
+  issue_pio_command (c, bio->write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  pci_reg_write8 (c->bm, c->bm_base + BM_COMMAND, direction | BM_CMD_START);
+}
+
+/* Sectors channel C's disk moves per interrupt in PIO. */
+static block_sector_t
+pio_block (const struct channel *c)
+{
+  block_sector_t block = c->disk->multiple > 0 ? c->disk->multiple : 1;
+  return block < c->left ? block : c->left;
+}
+
+/* Writes the next block of channel C's bio to the disk.  The
+   disk interrupts once it has taken it. */
+static void
+output_block (struct channel *c)
+{
+  block_sector_t n = pio_block (c);
+
+  /* The interrupt may come as soon as the last word is out, so
+     account for the block first. */
+  c->left -= n;
+  while (n-- > 0)
+    {
+      uint8_t *sector = next_sector (c);
+      barrier ();
+      output_sector (c, sector);
+    }
+}
+
+/* Reads the next block of channel C's bio from the disk. */
+static void
+input_block (struct channel *c)
+{
+  block_sector_t n = pio_block (c);
+
+  c->left -= n;
+  while (n-- > 0)
+    input_sector (c, next_sector (c));
+}
+
+/* Starts channel C's bio with a single PIO command, READ/WRITE
+   MULTIPLE if its disk is in multiple mode.  A read interrupts as
+   each block becomes ready.  A write asks for the first block
+   without an interrupt, then interrupts after taking each one. */
+static void
+start_pio (struct channel *c)
+{
+  struct ata_disk *d = c->disk;
+  struct bio *bio = c->bio;
+  uint8_t command;
+
+  if (d->multiple > 0)
+    command = bio->write ? CMD_WRITE_MULTIPLE : CMD_READ_MULTIPLE;
+  else
+    command = bio->write ? CMD_WRITE_SECTOR_RETRY : CMD_READ_SECTOR_RETRY;
+
+  select_sector (d, bio->sector, bio->cnt);
+  issue_pio_command (c, command);
+  if (bio->write)
+    {
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name,
+               bio->sector);
+      output_block (c);
+    }
+}
+
+/* Carries channel C's bio on after the disk interrupted with
+   STATUS, and completes it once the disk is done with it.  Called
+   from the interrupt handler. */
+static void
+advance (struct channel *c, uint8_t status)
+{
+  struct ata_disk *d = c->disk;
+  struct bio *bio = c->bio;
+  bool failed;
+
+  if (c->dma)
+    {
+      uint8_t bm_status;
+
+      pci_reg_write8 (c->bm, c->bm_base + BM_COMMAND,
+                      bio->write ? 0 : BM_CMD_READ);
+      bm_status = pci_reg_read8 (c->bm, c->bm_base + BM_STATUS);
+      pci_reg_write8 (c->bm, c->bm_base + BM_STATUS,
+                      BM_STA_ERROR | BM_STA_INTR);
+      failed = (bm_status & BM_STA_ERROR) || (status & STA_ERR);
+      c->left = 0;
+    }
+  else
+    failed = (status & STA_ERR) || (c->left > 0 && !(status & STA_DRQ));
+  if (failed)
+    PANIC ("%s: disk %s failed, sector=%"PRDSNu, d->name,
+           bio->write ? "write" : "read", bio->sector + bio->cnt - c->left);
+
+  if (!c->dma)
+    {
+      if (bio->write && c->left > 0)
+        {
+          output_block (c);
+          return;
+        }
+      if (!bio->write)
+        {
+          input_block (c);
+          if (c->left > 0)
+            return;
+        }
+    }
+
+  c->bio = NULL;
+  c->expecting_interrupt = false;
+  sema_up (&c->free);
+  block_complete (bio);
+}
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO to the disk's sector selection registers and CNT
+   to its sector count register.  (We use LBA mode.)  A CNT of
+   256 goes out as 0, which the disk reads as 256. */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, block_sector_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -416,7 +736,10 @@ issue_pio_command (struct channel *c, uint8_t command)
      up'd by the completion handler. */
   ASSERT (intr_get_level () == INTR_ON);
 
+  /* The completion interrupt may land on another CPU: make the
+     channel's state visible before the disk can send it. */
   c->expecting_interrupt = true;
+  barrier ();
   outb (reg_command (c), command);
 }
 
@@ -519,8 +842,14 @@ interrupt_handler (struct intr_frame *f)
       {
         if (c->expecting_interrupt) 
           {
-            inb (reg_status (c));               /* Acknowledge interrupt. */
-            sema_up (&c->completion_wait);      /* Wake up waiter. */
+            uint8_t status = inb (reg_status (c)); /* Acknowledge interrupt. */
+            if (c->bio != NULL)
+              advance (c, status);              /* Carry the bio on. */
+            else
+              {
+                c->expecting_interrupt = false;
+                sema_up (&c->completion_wait);  /* Wake up waiter. */
+              }
           }
         else
           printf ("%s: unexpected interrupt\n", c->name);
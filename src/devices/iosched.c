@@ -0,0 +1,262 @@
+#include "devices/iosched.h"
+#include <debug.h>
+#include <string.h>
+#include "devices/timer.h"
+
+/* Deadlines, in timer ticks.  Someone is usually waiting on a
+   read; writes mostly come from the buffer cache writing back. */
+#define READ_EXPIRE (TIMER_FREQ / 20)   /* 50 ms. */
+#define WRITE_EXPIRE (TIMER_FREQ / 2)   /* 500 ms. */
+
+/* Dispatches in one sweep before the deadline scheduler picks a
+   direction again. */
+#define SWEEP_BATCH 16
+
+/* Sweeps of reads that may go by while writes wait. */
+#define WRITES_STARVED 2
+
+static struct bio *pick_deadline (struct block_queue *);
+static struct bio *pick_clook (struct block_queue *);
+static struct bio *next_in_sweep (struct block_queue *, bool write);
+static bool sector_less (const struct list_elem *, const struct list_elem *,
+                         void *aux);
+static bool before (const struct bio *, const struct block *,
+                    block_sector_t);
+static bool mergeable (const struct bio *first, const struct bio *r,
+                       block_sector_t sector, block_sector_t cnt,
+                       size_t iov_cnt);
+
+/* The schedulers, by name. */
+static const struct iosched schedulers[] =
+  {
+    {"deadline", pick_deadline},
+    {"clook", pick_clook},
+  };
+
+/* Scheduler that new queues get. */
+static const struct iosched *default_sched = &schedulers[0];
+
+/* Makes the scheduler called NAME the one block devices
+   registered from now on use.  Returns false if there is no such
+   scheduler. */
+bool
+iosched_select (const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof schedulers / sizeof *schedulers; i++)
+    if (!strcmp (name, schedulers[i].name))
+      {
+        default_sched = &schedulers[i];
+        return true;
+      }
+  return false;
+}
+
+/* Initializes Q as an empty queue. */
+void
+iosched_queue_init (struct block_queue *q)
+{
+  lock_init (&q->lock);
+  cond_init (&q->ready);
+  list_init (&q->sorted);
+  list_init (&q->fifo[0]);
+  list_init (&q->fifo[1]);
+  q->head_block = NULL;
+  q->head = 0;
+  q->last_write = false;
+  q->batch = 0;
+  q->writes_starved = 0;
+  q->sched = default_sched;
+  q->request_cnt = 0;
+  q->dispatch_cnt = 0;
+}
+
+/* Adds R to Q.  Q's lock must be held. */
+void
+iosched_add (struct block_queue *q, struct bio *r)
+{
+  ASSERT (lock_held_by_current_thread (&q->lock));
+
+  r->deadline = timer_ticks () + (r->write ? WRITE_EXPIRE : READ_EXPIRE);
+  list_insert_ordered (&q->sorted, &r->sort_elem, sector_less, NULL);
+  list_push_back (&q->fifo[r->write], &r->fifo_elem);
+}
+
+/* Takes the request Q's scheduler picks off Q, together with
+   those in the same direction that continue it on disk on either
+   side, and puts them on BATCH in ascending sector order, ready
+   to be dispatched as one transfer.  Returns how many requests
+   went onto BATCH.  Q's lock must be held and Q must not be
+   empty. */
+size_t
+iosched_next (struct block_queue *q, struct list *batch)
+{
+  struct bio *first, *lo, *hi, *r;
+  struct list_elem *e;
+  block_sector_t cnt;
+  size_t iov_cnt, req_cnt = 0;
+
+  ASSERT (lock_held_by_current_thread (&q->lock));
+  ASSERT (!list_empty (&q->sorted));
+
+  first = lo = hi = q->sched->pick (q);
+  cnt = first->cnt;
+  iov_cnt = first->iov_cnt;
+
+  /* Merge the requests that follow, then those that precede. */
+  for (e = list_next (&hi->sort_elem); e != list_end (&q->sorted);
+       e = list_next (e))
+    {
+      r = list_entry (e, struct bio, sort_elem);
+      if (!mergeable (first, r, hi->sector + hi->cnt, cnt, iov_cnt))
+        break;
+      hi = r;
+      cnt += r->cnt;
+      iov_cnt += r->iov_cnt;
+    }
+  for (e = list_prev (&lo->sort_elem); e != list_rend (&q->sorted);
+       e = list_prev (e))
+    {
+      r = list_entry (e, struct bio, sort_elem);
+      if (!mergeable (first, r, lo->sector - r->cnt, cnt, iov_cnt))
+        break;
+      lo = r;
+      cnt += r->cnt;
+      iov_cnt += r->iov_cnt;
+    }
+
+  e = &lo->sort_elem;
+  do
+    {
+      r = list_entry (e, struct bio, sort_elem);
+      e = list_remove (e);
+      list_remove (&r->fifo_elem);
+      list_push_back (batch, &r->fifo_elem);
+      req_cnt++;
+    }
+  while (r != hi);
+
+  q->head_block = hi->block;
+  q->head = hi->sector + hi->cnt;
+  q->last_write = first->write;
+  q->batch++;
+  return req_cnt;
+}
+
+/* Returns true if R, the neighbour on disk of a dispatch of CNT
+   sectors in IOV_CNT pieces that starts with FIRST, may join it:
+   it goes the same way to the same device, starts at SECTOR, and
+   the dispatch stays within the limits. */
+static bool
+mergeable (const struct bio *first, const struct bio *r,
+           block_sector_t sector, block_sector_t cnt, size_t iov_cnt)
+{
+  return (r->write == first->write
+          && r->block == first->block
+          && r->sector == sector
+          && cnt + r->cnt <= IOSCHED_MAX_SECTORS
+          && iov_cnt + r->iov_cnt <= IOSCHED_MAX_IOV);
+}
+
+/* C-LOOK: serves requests in ascending order from the head,
+   then goes back to the lowest one. */
+static struct bio *
+pick_clook (struct block_queue *q)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&q->sorted); e != list_end (&q->sorted);
+       e = list_next (e))
+    {
+      struct bio *r = list_entry (e, struct bio, sort_elem);
+      if (!before (r, q->head_block, q->head))
+        return r;
+    }
+  return list_entry (list_front (&q->sorted), struct bio, sort_elem);
+}
+
+/* Deadline: sweeps C-LOOK fashion over requests of one direction
+   at a time, reads by preference, but serves any request that has
+   waited past its deadline first, reads before writes, and does
+   not let reads keep writes waiting for more than WRITES_STARVED
+   sweeps. */
+static struct bio *
+pick_deadline (struct block_queue *q)
+{
+  struct bio *r;
+  int64_t now = timer_ticks ();
+  bool write;
+  int dir;
+
+  for (dir = 0; dir < 2; dir++)
+    if (!list_empty (&q->fifo[dir]))
+      {
+        r = list_entry (list_front (&q->fifo[dir]), struct bio, fifo_elem);
+        if (r->deadline <= now)
+          {
+            q->batch = 0;
+            return r;
+          }
+      }
+
+  if (q->batch < SWEEP_BATCH
+      && (r = next_in_sweep (q, q->last_write)) != NULL)
+    return r;
+
+  /* Start a sweep in the direction it is the turn of. */
+  write = (list_empty (&q->fifo[false])
+           || (!list_empty (&q->fifo[true])
+               && q->writes_starved >= WRITES_STARVED));
+  if (write)
+    q->writes_starved = 0;
+  else if (!list_empty (&q->fifo[true]))
+    q->writes_starved++;
+  q->batch = 0;
+  return next_in_sweep (q, write);
+}
+
+/* Returns the request in the direction WRITE that Q's head
+   reaches next going up, wrapping around to the lowest, or a
+   null pointer if there is none. */
+static struct bio *
+next_in_sweep (struct block_queue *q, bool write)
+{
+  struct bio *lowest = NULL;
+  struct list_elem *e;
+
+  for (e = list_begin (&q->sorted); e != list_end (&q->sorted);
+       e = list_next (e))
+    {
+      struct bio *r = list_entry (e, struct bio, sort_elem);
+      if (r->write != write)
+        continue;
+      if (!before (r, q->head_block, q->head))
+        return r;
+      if (lowest == NULL)
+        lowest = r;
+    }
+  return lowest;
+}
+
+/* Orders requests by device, then by first sector. */
+static bool
+sector_less (const struct list_elem *a_, const struct list_elem *b_,
+             void *aux UNUSED)
+{
+  const struct bio *a = list_entry (a_, struct bio, sort_elem);
+  const struct bio *b = list_entry (b_, struct bio, sort_elem);
+  return before (a, b->block, b->sector);
+}
+
+/* Returns true if R comes before SECTOR on BLOCK in a queue's
+   order.  The devices sharing a queue take turns in an arbitrary
+   but fixed order, that of their addresses. */
+static bool
+before (const struct bio *r, const struct block *block,
+        block_sector_t sector)
+{
+  if (r->block != block)
+    return (uintptr_t) r->block < (uintptr_t) block;
+  return r->sector < sector;
+}
@@ -0,0 +1,49 @@
+#ifndef DEVICES_IOSCHED_H
+#define DEVICES_IOSCHED_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "devices/block.h"
+#include "threads/synch.h"
+
+/* Most sectors that merging puts into a single dispatch. */
+#define IOSCHED_MAX_SECTORS 256
+
+/* Most iovec pieces that merging puts into a single dispatch. */
+#define IOSCHED_MAX_IOV 64
+
+/* The bios waiting for a block device, or for the devices that
+   share it, which it keeps ordered device by device. */
+struct block_queue
+  {
+    struct lock lock;                   /* Guards the members below. */
+    struct condition ready;             /* Signaled on a new request. */
+    struct list sorted;                 /* All, by device and sector. */
+    struct list fifo[2];                /* Reads, writes, oldest first. */
+    struct block *head_block;           /* Device of the last dispatch, */
+    block_sector_t head;                /* and the sector just past it. */
+    bool last_write;                    /* Direction of the last one. */
+    int batch;                          /* Dispatches in this sweep. */
+    int writes_starved;                 /* Read sweeps since a write one. */
+    const struct iosched *sched;        /* Picks what goes next. */
+
+    /* Statistics. */
+    unsigned long long request_cnt;     /* Requests completed. */
+    unsigned long long dispatch_cnt;    /* Driver calls they took. */
+  };
+
+/* An I/O scheduler: chooses which waiting request to serve next.
+   Merging the ones next to it is up to the queue. */
+struct iosched
+  {
+    const char *name;
+    struct bio *(*pick) (struct block_queue *);
+  };
+
+bool iosched_select (const char *name);
+void iosched_queue_init (struct block_queue *);
+void iosched_add (struct block_queue *, struct bio *);
+size_t iosched_next (struct block_queue *, struct list *batch);
+
+#endif /* devices/iosched.h */
@@ -131,6 +131,7 @@ struct pci_io
 {
   struct pci_dev *dev;
   enum pci_io_type type;
+  int bar;	/* base address register it came from */
   size_t size;	/* bytes in range */
   union
   {
@@ -216,7 +217,7 @@ pci_get_dev_by_class (int major, int minor, int iface, int n)
 
       pd = list_entry (e, struct pci_dev, peer);
       if (pd->pch.pci_major == major && pd->pch.pci_minor == minor &&
-	  pd->pch.pci_interface == iface)
+	  (iface < 0 || pd->pch.pci_interface == iface))
 	{
 	  if (count == n)
 	    return pd;
@@ -246,6 +247,35 @@ pci_io_enum (struct pci_dev *pio, struct pci_io *last)
   return list_entry (e, struct pci_io, peer);
 }
 
+/** returns PD's io range from base address register BAR, or NULL */
+struct pci_io *
+pci_io_get_bar (struct pci_dev *pd, int bar)
+{
+  struct pci_io *pio;
+
+  for (pio = pci_io_enum (pd, NULL); pio != NULL; pio = pci_io_enum (pd, pio))
+    if (pio->bar == bar)
+      return pio;
+  return NULL;
+}
+
+/** lets PD master the bus, as it must to do DMA */
+void
+pci_enable_master (struct pci_dev *pd)
+{
+  pd->pch.pci_command |= PCI_CMD_MASTER;
+  pci_write_config (pd->bus, pd->dev, pd->func,
+		    offsetof (struct pci_config_header, pci_command),
+		    2, pd->pch.pci_command);
+}
+
+/** returns PD's programming interface byte */
+int
+pci_get_interface (struct pci_dev *pd)
+{
+  return pd->pch.pci_interface;
+}
+
 void
 pci_register_irq (struct pci_dev *pd, pci_handler_func * f, void *aux)
 {
@@ -596,6 +626,7 @@ pci_setup_io (struct pci_dev *pd)
 
       pio = malloc (sizeof (struct pci_io));
       pio->dev = pd;
+      pio->bar = i;
 
       if (tmp & PCI_BASEADDR_IO)
 	{
@@ -83,8 +83,12 @@ struct pci_dev;
 
 void pci_init (void);
 struct pci_dev *pci_get_device (int vendor, int device, int func, int n);
+/* IFACE < 0 matches any programming interface. */
 struct pci_dev *pci_get_dev_by_class (int major, int minor, int iface, int n);
 struct pci_io *pci_io_enum (struct pci_dev *, struct pci_io *last);
+struct pci_io *pci_io_get_bar (struct pci_dev *, int bar);
+void pci_enable_master (struct pci_dev *);
+int pci_get_interface (struct pci_dev *);
 void pci_register_irq (struct pci_dev *, pci_handler_func *, void *AUX);
 void pci_unregister_irq (struct pci_dev *);
 size_t pci_io_size (struct pci_io *);
@@ -255,30 +255,34 @@ msc_detached (class_info ci UNUSED)
   PANIC ("msc_detached: STUB");
 }
 
+/* Moves BIO's sectors one at a time.  Bulk transfers are
+   synchronous here, so BIO is complete on return. */
 static void
-msc_read (void *mbi_, block_sector_t sector, void *buffer) 
+msc_submit (void *mbi_, struct bio *bio)
 {
   struct msc_blk_info *mbi = mbi_;
+  block_sector_t sector = bio->sector;
+  size_t i;
 
   mci_lock (mbi->mci);
-  msc_io (mbi->mci, sector, buffer, false);
-  mci_unlock (mbi->mci);
-}
-
-static void
-msc_write (void *mbi_, block_sector_t sector, const void *buffer)
-{
-  struct msc_blk_info *mbi = mbi_;
-
-  mci_lock (mbi->mci);
-  msc_io (mbi->mci, sector, (void *) buffer, true);
+  for (i = 0; i < bio->iov_cnt; i++)
+    {
+      block_sector_t j;
+      for (j = 0; j < bio->iov[i].cnt; j++)
+        msc_io (mbi->mci, sector++,
+                (uint8_t *) bio->iov[i].buffer + j * BLOCK_SECTOR_SIZE,
+                bio->write);
+    }
   mci_unlock (mbi->mci);
+  block_complete (bio);
 }
 
 static struct block_operations msc_operations = 
   {
-    msc_read,
-    msc_write,
+    NULL,
+    NULL,
+    msc_submit,
+    false
   };
 
 static void
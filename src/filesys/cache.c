@@ -3,48 +3,235 @@
 #include "devices/timer.h"
 #include "threads/thread.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/frame.h"
+#endif
+#include <atomic-ops.h>
+#include <hash.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
-#define MAX_CACHE_SIZE 64
+#define BLOCKS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+#define MIN_CACHE_SIZE 64     /* Smallest cache, in blocks */
+#define CACHE_POOL_FRACTION 8 /* By default the cache takes 1/8 of the kernel pool */
+#define CACHE_GROW_FACTOR 4   /* Grows to 4 times its boot size with frames lent by VM */
+#define NO_SECTOR ((block_sector_t) -1) /* Sector of a free block */
 
-static struct cache_block cache[MAX_CACHE_SIZE];
+/* A page worth of cache blocks, the unit the cache grows and shrinks by. */
+struct cache_chunk {
+    struct cache_block blocks[BLOCKS_PER_PAGE];
+    void *page;            /* Holds the blocks' data */
+#ifdef VM
+    struct frame *frame;   /* Frame PAGE was lent from, or NULL if it is the kernel's */
+#endif
+};
+
+/* -cache: Number of blocks to start with, 0 for the default. */
+size_t cache_size;
+
+/* The chunks, those taken at boot first. Changed only under all_cache_lock. */
+static struct cache_chunk **chunks;
+static int num_chunks;
+static int base_chunks;
+static int max_chunks;
+
+/* Held to load a block: serializes misses, allocation and eviction,
+ * and guards the queues below */
 struct lock all_cache_lock;
-/* Number of currently allocated caches */
-static int num_cache_blocks = 0;
 
+/* Replacement is 2Q. A block loaded on a miss joins the FIFO a1in; if
+ * it is used again while there it moves on to am, else it is evicted
+ * and its sector remembered in the ghost list a1out. A miss on a sector
+ * in a1out loads straight into am, a clock over the blocks used more
+ * than once. A scan runs through a1in, a quarter of the cache, and
+ * leaves am, where hot inodes and directories end up, alone. */
+#define A1IN_FRACTION 4       /* a1in holds up to 1/4 of the blocks */
+#define A1OUT_FRACTION 2      /* a1out remembers 1/2 as many sectors as fit */
+static struct list free_blocks;
+static struct list a1in;
+static struct list am;
+static int a1in_cnt;
+
+/* A sector evicted from a1in, in the ring of ghosts. */
+struct ghost {
+    block_sector_t sector;       /* NO_SECTOR if the slot is empty */
+    struct hash_elem elem;       /* Element in ghost_index */
+};
+static struct ghost *ghosts;
+static size_t ghost_cnt;
+static size_t ghost_next;        /* Slot the next ghost goes into */
+static struct hash ghost_index;
+
+/* Dirty blocks, by ascending sector, so that writing back is one sweep
+ * that writes each run of neighbours with one request. dirty_lock
+ * guards the list and each block's dirty, writing and dirty_since, and
+ * is taken after any other cache lock. A block being written back is
+ * busy: it stays in the index under its sector until done. */
+#define DIRTY_EXPIRE 1000         /* Blocks dirty for 1 s get written back */
+#define WRITEBACK_INTERVAL 100    /* write_behind looks every 100 ms */
+#define DIRTY_BACKGROUND_FRACTION 8 /* Past 1/8 dirty, write_behind writes down to half that */
+#define DIRTY_LIMIT_FRACTION 4    /* Past 1/4 dirty, whoever dirties a block does */
+#define WRITEBACK_BATCH 64        /* Most blocks taken off the list at once */
+#define WRITEBACK_INFLIGHT 4      /* Most runs of a batch on their way at once */
+static struct lock dirty_lock;
+static struct list dirty_blocks;
+static int dirty_cnt;
+static int writing_cnt;             /* Blocks being written back */
+static struct condition writing_done; /* Signaled when that drops to 0 */
+
+/* Write back statistics, under dirty_lock. */
+static int dirty_peak;
+static int dirty_marks;          /* Calls to cache_mark_block_dirty() */
+static int wb_sectors;
+static int wb_requests;
+static int flush_cnt;
+static int64_t flush_ticks;
+static int64_t flush_max_ticks;
+
+/* Miss count at which the cache next tries to grow */
+static int next_grow = 0;
 
+/* Statistics, changed atomically. */
+static int hits;
+static int misses;
+static int class_hits[CACHE_CLASS_CNT];
+static int class_misses[CACHE_CLASS_CNT];
+static int class_evictions[CACHE_CLASS_CNT];
+static int ahead_loads;
+static int ahead_hits;
 
-static struct cache_block *find_cache_block (block_sector_t sector);
-static struct cache_block *is_in_cache (block_sector_t sector);
+/* Index of the cached blocks by sector. A bucket's lock guards its
+ * list and the sector of each block in it; it is taken before the lock
+ * of any of its blocks. */
+struct cache_bucket {
+    struct lock lock;
+    struct list blocks;
+};
+static struct cache_bucket *buckets;
+static block_sector_t bucket_mask;
+
+static bool add_chunk (void);
+static void ghost_add (block_sector_t sector);
+static bool ghost_take (block_sector_t sector);
+static unsigned ghost_hash (const struct hash_elem *e, void *aux);
+static bool ghost_less (const struct hash_elem *a, const struct hash_elem *b, void *aux);
+static struct cache_block *evict_from (struct list *queue, bool promote);
+static struct cache_bucket *bucket_of (block_sector_t sector);
+static struct cache_block *bucket_find (struct cache_bucket *bucket, block_sector_t sector);
+static struct cache_block *claim_block (struct cache_bucket *bucket, block_sector_t sector,
+                                        enum cache_class class);
+static void acquire_block (struct cache_block *b, bool exclusive, bool hit);
+static void start_load (struct cache_block *b, struct cache_bucket *bucket,
+                        block_sector_t sector, enum cache_class class);
+static void finish_load (struct cache_block *b);
+static struct cache_block *find_cache_block (void);
 static struct cache_block *cache_eviction (void);
+static bool detach_block (struct cache_block *b);
+static void clean_block (struct cache_block *b);
+static void insert_dirty (struct cache_block *b);
+static bool take_dirty (struct cache_block *b);
+static void write_back (int64_t older, int keep);
+static size_t take_runs (block_sector_t *cursor, int64_t older, int keep,
+                         struct cache_block **batch, bool *more);
+static void write_runs (struct cache_block **batch, size_t cnt);
+static void done_writing (struct cache_block **batch, size_t cnt);
 static void write_behind (void *aux);
 static void read_ahead (void *aux);
+static size_t sort_sectors (block_sector_t *sectors, size_t cnt);
+static int compare_sectors (const void *a, const void *b);
+static void read_ahead_sectors (const block_sector_t *sectors, size_t cnt);
+static void read_ahead_run (block_sector_t first, size_t cnt);
+static void read_ahead_done (struct bio *bio);
 
-struct read_ahead_sector {
-    block_sector_t sector;
+/* A batch of sectors for the read ahead daemon, in ascending order. */
+struct read_ahead_request {
+    size_t cnt;
+    block_sector_t sectors[READ_AHEAD_MAX];
     struct list_elem elem;
 };
 
-/* Read ahead daemon support */
+/* A run of blocks read ahead, on its way in from the disk. */
+struct read_ahead_io {
+    struct bio bio;
+    size_t cnt;
+    struct cache_block *run[READ_AHEAD_MAX];
+    struct block_iovec iov[READ_AHEAD_MAX];
+};
+
+/* Read ahead daemon support. Read ahead is only a hint: past
+ * READ_AHEAD_QUEUE waiting requests new ones are dropped. */
+#define READ_AHEAD_QUEUE 16
 struct condition read_ahead_cond;
 struct lock read_ahead_lock;
 struct list read_ahead_list;
+static int read_ahead_cnt;
 /* 
- * Initializes the cache. 
+ * Initializes the cache with cache_size blocks, by default a fraction
+ * of the kernel pool. With VM it can grow to CACHE_GROW_FACTOR times
+ * that on frames lent by the frame allocator, which takes them back
+ * through cache_shrink() when it runs out.
  */
 void cache_init (void) {
     lock_init(&all_cache_lock);
-    for (int i = 0; i < MAX_CACHE_SIZE; i++) {
-        cache[i].sector = -1;
-        cache[i].dirty = false;
-        cache[i].valid = false;
-        cache[i].num_readers = 0;
-        cache[i].num_writers = 0;
-        cache[i].num_pending_requests = 0;
-        lock_init(&cache[i].cache_lock);
-        cond_init(&cache[i].is_available);
+    if (cache_size == 0) {
+        cache_size = palloc_pool_size(0) / CACHE_POOL_FRACTION * BLOCKS_PER_PAGE;
+    }
+    if (cache_size < MIN_CACHE_SIZE) {
+        cache_size = MIN_CACHE_SIZE;
+    }
+    base_chunks = DIV_ROUND_UP(cache_size, BLOCKS_PER_PAGE);
+    if ((size_t) base_chunks > palloc_pool_size(0) / 2) {
+        base_chunks = palloc_pool_size(0) / 2;
+    }
+#ifdef VM
+    max_chunks = base_chunks * CACHE_GROW_FACTOR;
+#else
+    max_chunks = base_chunks;
+#endif
+
+    /* About two blocks to a bucket when full. */
+    size_t bucket_cnt = 1;
+    while (bucket_cnt * 2 < (size_t) max_chunks * BLOCKS_PER_PAGE) {
+        bucket_cnt *= 2;
+    }
+    buckets = malloc(bucket_cnt * sizeof *buckets);
+    chunks = malloc(max_chunks * sizeof *chunks);
+    if (buckets == NULL || chunks == NULL) {
+        PANIC("cannot allocate buffer cache");
     }
+    bucket_mask = bucket_cnt - 1;
+    for (size_t i = 0; i < bucket_cnt; i++) {
+        lock_init(&buckets[i].lock);
+        list_init(&buckets[i].blocks);
+    }
+    list_init(&free_blocks);
+    list_init(&a1in);
+    list_init(&am);
+    lock_init(&dirty_lock);
+    list_init(&dirty_blocks);
+    cond_init(&writing_done);
+
+    ghost_cnt = (size_t) max_chunks * BLOCKS_PER_PAGE / A1OUT_FRACTION;
+    ghosts = malloc(ghost_cnt * sizeof *ghosts);
+    if (ghosts == NULL || !hash_init(&ghost_index, ghost_hash, ghost_less, NULL)) {
+        PANIC("cannot allocate buffer cache");
+    }
+    for (size_t i = 0; i < ghost_cnt; i++) {
+        ghosts[i].sector = NO_SECTOR;
+    }
+    while (num_chunks < base_chunks && add_chunk()) {
+        continue;
+    }
+    if (num_chunks == 0) {
+        PANIC("cannot allocate buffer cache");
+    }
+    base_chunks = num_chunks;
+    cache_size = num_chunks * BLOCKS_PER_PAGE;
+
     list_init(&read_ahead_list);
     lock_init(&read_ahead_lock);
     cond_init(&read_ahead_cond);
@@ -60,87 +247,449 @@ void cache_shutdown(void) {
 }
 
 /*
- * Acquires a cache block for the given sector.
+ * Acquires a cache block for the given sector, which holds data of
+ * CLASS. A hit takes only the sector's bucket lock and the block's
+ * lock. A miss picks a block under all_cache_lock and enters it in the
+ * index as loading, then reads the sector with the lock dropped; others
+ * wanting the sector wait on the block, and everyone else goes on.
  */
-struct cache_block * cache_get_block (block_sector_t sector, bool exclusive) {
-    lock_acquire(&all_cache_lock);
-    struct cache_block *b = find_cache_block(sector);
+struct cache_block * cache_get_block (block_sector_t sector, bool exclusive,
+                                      enum cache_class class) {
+    struct cache_bucket *bucket = bucket_of(sector);
+    struct cache_block *b = claim_block(bucket, sector, class);
+    bool hit = b != NULL;
+
+    if (b == NULL) { /* Cache Miss */
+        lock_acquire(&all_cache_lock);
+        /* Blocks only enter the index under all_cache_lock, so while it
+         * is held the sector cannot show up behind our back. Finding a
+         * block may drop it, though, so look again after each try. */
+        struct cache_block *fresh = NULL;
+        while ((b = claim_block(bucket, sector, class)) == NULL
+               && (fresh = find_cache_block()) == NULL) {
+            continue;
+        }
+        if (b == NULL) {
+            atomic_inci(&misses);
+            atomic_inci(&class_misses[class]);
+            b = fresh;
+            start_load(b, bucket, sector, class);
+            lock_release(&all_cache_lock);
+
+            block_read(fs_device, sector, b->data);
+            finish_load(b);
+        } else {
+            lock_release(&all_cache_lock);
+            hit = true;
+        }
+    }
+    acquire_block(b, exclusive, hit);
+    ASSERT(b != NULL);
+    return b;
+
+}
+
+/*
+ * Enters B, fresh from find_cache_block(), in the index as SECTOR of
+ * CLASS, loading, with a pending request so it stays put until
+ * finish_load(). Must be called with all_cache_lock held.
+ */
+static void start_load (struct cache_block *b, struct cache_bucket *bucket,
+                        block_sector_t sector, enum cache_class class) {
+    b->loading = true;
+    b->valid = false;
+    b->dirty = false;
+    b->use_bit = false;
+    b->ahead = false;
+    b->class = class;
+    b->num_pending_requests = 1;
+    if (ghost_take(sector)) {
+        b->queue = &am;
+    } else {
+        b->queue = &a1in;
+        a1in_cnt++;
+    }
+    list_push_back(b->queue, &b->queue_elem);
+
+    lock_acquire(&bucket->lock);
+    b->sector = sector;
+    list_push_back(&bucket->blocks, &b->hash_elem);
+    lock_release(&bucket->lock);
+}
+
+/*
+ * Marks B, whose sector has been read in, loaded and wakes up those
+ * waiting for it.
+ */
+static void finish_load (struct cache_block *b) {
     lock_acquire(&b->cache_lock);
-    if (b->sector != sector) {
-        // if the block is dirty, write it back to disk
-        if (b->dirty) {
-            block_write(fs_device, b->sector, b->data);
-            b->dirty = false;
-            b->valid = false;
+    b->valid = true;
+    b->loading = false;
+    cond_broadcast(&b->is_available, &b->cache_lock);
+    lock_release(&b->cache_lock);
+}
+
+static struct cache_bucket *bucket_of (block_sector_t sector) {
+    return &buckets[sector & bucket_mask];
+}
+
+/*
+ * Adds a chunk of free blocks to the cache, on a kernel page at boot
+ * and on a frame lent by VM after that. Returns false if there is no
+ * memory to spare. Must be called with all_cache_lock held, once the
+ * cache is running.
+ */
+static bool add_chunk (void) {
+    if (num_chunks == max_chunks) {
+        return false;
+    }
+    struct cache_chunk *c = malloc(sizeof *c);
+    if (c == NULL) {
+        return false;
+    }
+#ifdef VM
+    c->frame = NULL;
+    if (num_chunks >= base_chunks) {
+        c->frame = frame_lend();
+        c->page = c->frame != NULL ? c->frame->paddr : NULL;
+    } else {
+        c->page = palloc_get_page(0);
+    }
+#else
+    c->page = palloc_get_page(0);
+#endif
+    if (c->page == NULL) {
+        free(c);
+        return false;
+    }
+    for (int i = 0; i < BLOCKS_PER_PAGE; i++) {
+        struct cache_block *b = &c->blocks[i];
+        b->sector = NO_SECTOR;
+        b->dirty = false;
+        b->writing = false;
+        b->valid = false;
+        b->loading = false;
+        b->use_bit = false;
+        b->num_readers = 0;
+        b->num_writers = 0;
+        b->num_pending_requests = 0;
+        b->data = (uint8_t *) c->page + i * BLOCK_SECTOR_SIZE;
+        b->class = CACHE_DATA;
+        b->queue = &free_blocks;
+        list_push_back(&free_blocks, &b->queue_elem);
+        lock_init(&b->cache_lock);
+        cond_init(&b->is_available);
+    }
+    chunks[num_chunks++] = c;
+    return true;
+}
+
+/*
+ * Gives the VM frame allocator back the last frame it lent, if the
+ * blocks on it are idle. Their contents are written back or dropped.
+ * Returns true if a frame went back. Called by VM when no frame is
+ * free, so it never grows the cache.
+ */
+bool cache_shrink (void) {
+    bool shrunk = false;
+    lock_acquire(&all_cache_lock);
+    if (num_chunks > base_chunks) {
+        struct cache_chunk *c = chunks[num_chunks - 1];
+        shrunk = true;
+        for (int i = 0; i < BLOCKS_PER_PAGE && shrunk; i++) {
+            shrunk = detach_block(&c->blocks[i]);
         }
-        // read the block from disk
-        block_read(fs_device, sector, b->data);
-        b->sector = sector;
+        for (int i = 0; i < BLOCKS_PER_PAGE; i++) {
+            struct cache_block *b = &c->blocks[i];
+            if (b->queue == NULL) {
+                b->queue = &free_blocks;
+                list_push_back(&free_blocks, &b->queue_elem);
+            }
+            if (shrunk) {
+                list_remove(&b->queue_elem);
+            }
+        }
+        if (shrunk) {
+            num_chunks--;
+#ifdef VM
+            frame_return(c->frame);
+#endif
+            free(c);
+        }
+    }
+    lock_release(&all_cache_lock);
+    return shrunk;
+}
+
+/*
+ * Remembers SECTOR, just evicted from a1in, in place of the oldest
+ * ghost. Must be called with all_cache_lock held.
+ */
+static void ghost_add (block_sector_t sector) {
+    struct ghost *g = &ghosts[ghost_next];
+    ghost_next = (ghost_next + 1) % ghost_cnt;
+    if (g->sector != NO_SECTOR) {
+        hash_delete(&ghost_index, &g->elem);
+    }
+    g->sector = sector;
+    if (hash_insert(&ghost_index, &g->elem) != NULL) {
+        g->sector = NO_SECTOR;
+    }
+}
+
+/*
+ * Forgets SECTOR if it is a ghost. Returns true if it was. Must be
+ * called with all_cache_lock held.
+ */
+static bool ghost_take (block_sector_t sector) {
+    struct ghost key;
+    key.sector = sector;
+    struct hash_elem *e = hash_delete(&ghost_index, &key.elem);
+    if (e == NULL) {
+        return false;
+    }
+    hash_entry(e, struct ghost, elem)->sector = NO_SECTOR;
+    return true;
+}
+
+static unsigned ghost_hash (const struct hash_elem *e, void *aux UNUSED) {
+    return hash_int(hash_entry(e, struct ghost, elem)->sector);
+}
+
+static bool ghost_less (const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED) {
+    return hash_entry(a, struct ghost, elem)->sector < hash_entry(b, struct ghost, elem)->sector;
+}
+
+/*
+ * Returns the block holding SECTOR in BUCKET, or NULL. Must be called
+ * with the bucket's lock held.
+ */
+static struct cache_block *bucket_find (struct cache_bucket *bucket, block_sector_t sector) {
+    struct list_elem *e;
+    for (e = list_begin(&bucket->blocks); e != list_end(&bucket->blocks); e = list_next(e)) {
+        struct cache_block *b = list_entry(e, struct cache_block, hash_elem);
+        if (b->sector == sector) {
+            return b;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Looks SECTOR up in BUCKET and, if it is there, counts a pending
+ * request on its block so it is not evicted before acquire_block(),
+ * and a hit on CLASS.
+ */
+static struct cache_block *claim_block (struct cache_bucket *bucket, block_sector_t sector,
+                                        enum cache_class class) {
+    lock_acquire(&bucket->lock);
+    struct cache_block *b = bucket_find(bucket, sector);
+    if (b != NULL) {
+        lock_acquire(&b->cache_lock);
+        b->num_pending_requests++;
+        lock_release(&b->cache_lock);
+        atomic_inci(&hits);
+        atomic_inci(&class_hits[class]);
+    }
+    lock_release(&bucket->lock);
+    return b;
+}
+
+/*
+ * Turns a pending request on B into shared or exclusive access, once
+ * B is loaded. A HIT marks B used again, for replacement, unless it is
+ * the first use of a block read ahead.
+ */
+static void acquire_block (struct cache_block *b, bool exclusive, bool hit) {
+    lock_acquire(&b->cache_lock);
+    while (b->loading) {
+        cond_wait(&b->is_available, &b->cache_lock);
     }
     if (exclusive) {
-        if (b->num_readers > 0 || b->num_writers > 0) {
+        while (b->num_readers > 0 || b->num_writers > 0) {
             cond_wait(&b->is_available, &b->cache_lock);
         }
         b->num_writers++;
     } else {
         b->num_readers++;
     }
+    b->num_pending_requests--;
+    if (hit && b->ahead) {
+        /* The first use of a block read ahead: what a miss would have
+         * been, so it does not count towards promotion. */
+        b->ahead = false;
+        atomic_inci(&ahead_hits);
+    } else if (hit) {
+        b->use_bit = true;
+    }
     lock_release(&b->cache_lock);
-    lock_release(&all_cache_lock);
-    ASSERT(b != NULL);
-    return b;
-
 }
 
 /*
- * If the block is already in the cache, return. If not, look for free space.
- * If there aren't any free spaces, evict.
+ * Returns a block to load a new sector into: a free one if there is
+ * one, else one evicted. The block is out of the index and idle. Must
+ * be called with all_cache_lock held. Returns NULL if it had to write
+ * a dirty block back first, which drops the lock meanwhile.
  */
-static struct cache_block *find_cache_block (block_sector_t sector) {
-    struct cache_block *b = is_in_cache(sector);
-    if (b == NULL) { /* Cache Miss */
-        if (num_cache_blocks < MAX_CACHE_SIZE) {
-            b = &cache[num_cache_blocks];
-            num_cache_blocks++;
-        } else {
-            b = cache_eviction();
+static struct cache_block *find_cache_block (void) {
+    /* Growing costs a walk of the frame table, so after VM refuses it
+     * waits until the cache has turned over once. */
+    if (list_empty(&free_blocks) && misses >= next_grow) {
+        if (!add_chunk()) {
+            next_grow = misses + num_chunks * BLOCKS_PER_PAGE;
         }
     }
-    b->use_bit = true;
-    // lock_release(&all_cache_lock);
-    return b;
+    if (!list_empty(&free_blocks)) {
+        struct cache_block *b = list_entry(list_pop_front(&free_blocks),
+                                           struct cache_block, queue_elem);
+        b->queue = NULL;
+        return b;
+    }
+    return cache_eviction();
 }
 
-static struct cache_block *is_in_cache (block_sector_t sector) {
-    for (int i = 0; i < MAX_CACHE_SIZE; i++) {
-        if (cache[i].sector == sector) {
-            return &cache[i];
+/*
+ * Returns true if the sector is in the cache right now. Does no I/O and
+ * takes no block, so the answer may be stale by the time it is used.
+ */
+bool cache_contains (block_sector_t sector) {
+    struct cache_bucket *bucket = bucket_of(sector);
+    lock_acquire(&bucket->lock);
+    bool found = bucket_find(bucket, sector) != NULL;
+    lock_release(&bucket->lock);
+    return found;
+}
+
+/*
+ * Evicts a clean cache block, from a1in while it holds more than its
+ * share and from am otherwise. Must be called with all_cache_lock
+ * held. Returns NULL if it came to a dirty block, which it writes back
+ * instead, dropping the lock meanwhile.
+ */
+static struct cache_block *cache_eviction (void) {
+    int total = num_chunks * BLOCKS_PER_PAGE;
+    bool from_a1in = a1in_cnt > total / A1IN_FRACTION || list_empty(&am);
+    struct cache_block *b = evict_from(from_a1in ? &a1in : &am, from_a1in);
+    if (b == NULL) {
+        b = evict_from(from_a1in ? &am : &a1in, !from_a1in);
+    }
+    if (b == NULL) {
+        /* Everything is in use: let some of it be put back. */
+        lock_release(&all_cache_lock);
+        thread_yield();
+        lock_acquire(&all_cache_lock);
+        return NULL;
+    }
+    return b->queue == NULL ? b : NULL;
+}
+
+/*
+ * Looks once through QUEUE, front first, for a block to evict. A block
+ * used since it was last looked at gets another round at the back of
+ * am: it moves there from a1in if PROMOTE. Returns the block, taken out
+ * of the index and its queue, or a dirty block left in its queue after
+ * writing it back with all_cache_lock dropped, or NULL if every block
+ * is in use.
+ */
+static struct cache_block *evict_from (struct list *queue, bool promote) {
+    size_t n = list_size(queue);
+    while (n-- > 0) {
+        struct cache_block *b = list_entry(list_pop_front(queue), struct cache_block, queue_elem);
+        if (b->use_bit) {
+            b->use_bit = false;
+            if (promote) {
+                a1in_cnt--;
+                b->queue = &am;
+            }
+            list_push_back(b->queue, &b->queue_elem);
+            continue;
+        }
+        list_push_back(queue, &b->queue_elem);
+        if (b->dirty) {
+            clean_block(b);
+            return b;
+        }
+        block_sector_t sector = b->sector;
+        enum cache_class class = b->class;
+        if (detach_block(b)) {
+            atomic_inci(&class_evictions[class]);
+            if (promote) {
+                ghost_add(sector);
+            }
+            return b;
         }
     }
     return NULL;
 }
 
 /*
- * Evicts a cache block (eventually via clock algorithm :D)
+ * Writes B back if it is dirty and not being written already, with
+ * all_cache_lock dropped. Being written keeps B busy, in the index
+ * under its sector, so others can still use it and no one reads a
+ * stale copy from the disk; a write made meanwhile dirties it again.
+ * Must be called with all_cache_lock held, and returns with it held.
  */
-static struct cache_block *cache_eviction (void) {
-    struct cache_block *candidate = NULL;
-    while (candidate == NULL) {
-        for (int i = 0; i < MAX_CACHE_SIZE; i++) {
-            if (!cache[i].use_bit) {
-                candidate = &cache[i];
-                break;
-            } else {
-                cache[i].use_bit = false;
-            }
+static void clean_block (struct cache_block *b) {
+    if (take_dirty(b)) {
+        lock_release(&all_cache_lock);
+        write_runs(&b, 1);
+        done_writing(&b, 1);
+        lock_acquire(&all_cache_lock);
+    }
+}
+
+/*
+ * Takes block B out of the index and its queue, writing it back first
+ * if it is dirty, which leaves it free. Returns false, leaving B alone,
+ * if it is in use or wanted. Must be called with all_cache_lock held;
+ * the write, which only cache_shrink() should need, is made with it
+ * held.
+ */
+static bool detach_block (struct cache_block *b) {
+    if (b->sector == NO_SECTOR) {
+        if (b->queue != NULL) {
+            list_remove(&b->queue_elem);
+            b->queue = NULL;
         }
+        return true;
+    }
+    struct cache_bucket *bucket = bucket_of(b->sector);
+    lock_acquire(&bucket->lock);
+    lock_acquire(&b->cache_lock);
+    lock_acquire(&dirty_lock);
+    bool busy = b->num_readers > 0 || b->num_writers > 0
+                || b->num_pending_requests > 0 || b->writing;
+    bool dirty = b->dirty;
+    if (!busy && dirty) {
+        list_remove(&b->dirty_elem);
+        dirty_cnt--;
+        b->dirty = false;
+        b->writing = true;
+        writing_cnt++;
+    }
+    lock_release(&dirty_lock);
+    if (!busy) {
+        list_remove(&b->hash_elem);
+        list_remove(&b->queue_elem);
+        if (b->queue == &a1in) {
+            a1in_cnt--;
+        }
+        b->queue = NULL;
+        b->valid = false;
+    }
+    lock_release(&b->cache_lock);
+    lock_release(&bucket->lock);
+    if (busy) {
+        return false;
     }
-    if (candidate->dirty) {
-        block_write(fs_device, candidate->sector, candidate->data);
-        candidate->dirty = false;
+
+    /* Out of the index, so no one else can reach it now. */
+    if (dirty) {
+        write_runs(&b, 1);
+        done_writing(&b, 1);
     }
-    ASSERT(candidate != NULL);
-    return candidate;
+    b->sector = NO_SECTOR;
+    return true;
 }
 
 
@@ -154,7 +703,6 @@ void cache_put_block (struct cache_block *b) {
     } else if (b->num_readers > 0) {
         b->num_readers--;
     }
-    b->use_bit = true;
     cond_broadcast(&b->is_available, &b->cache_lock);
     lock_release(&b->cache_lock);
     
@@ -165,7 +713,6 @@ void cache_put_block (struct cache_block *b) {
  */
 void * cache_read_block (struct cache_block *b) {
     lock_acquire(&b->cache_lock);
-    b->use_bit = true;
     if (!b->valid) {
         block_read(fs_device, b->sector, b->data);
         b->valid = true;
@@ -186,62 +733,476 @@ void * cache_zero_block (struct cache_block *b) {
 }
 
 /* 
- * Marks a block as dirty. 
+ * Marks a block as dirty, putting it on the dirty list if it was clean.
+ * If that makes too much of the cache dirty, writes some back before
+ * returning, so that a fast writer waits on the disk instead of filling
+ * the cache with blocks that would have to be written on eviction.
  */
 void cache_mark_block_dirty(struct cache_block *b) {
-    lock_acquire(&b->cache_lock);
-    b->dirty = true;
-    lock_release(&b->cache_lock);
+    int total = num_chunks * BLOCKS_PER_PAGE;
+
+    lock_acquire(&dirty_lock);
+    dirty_marks++;
+    if (!b->dirty) {
+        b->dirty = true;
+        b->dirty_since = timer_ticks();
+        insert_dirty(b);
+        if (++dirty_cnt > dirty_peak) {
+            dirty_peak = dirty_cnt;
+        }
+    }
+    bool throttle = dirty_cnt > total / DIRTY_LIMIT_FRACTION;
+    lock_release(&dirty_lock);
+
+    if (throttle) {
+        write_back(INT64_MIN, total / DIRTY_BACKGROUND_FRACTION);
+    }
 }
 
-void flush_cache(void) {
-    for (int i = 0; i < MAX_CACHE_SIZE; i++) {
-        struct cache_block *b = &cache[i];
-        lock_acquire(&b->cache_lock);
-        if (b->dirty) {
-            block_write(fs_device, b->sector, b->data);
+/*
+ * Puts B on the dirty list in sector order. New dirty blocks tend to
+ * come after the others, so looks from the end.
+ */
+static void insert_dirty (struct cache_block *b) {
+    struct list_elem *e;
+    for (e = list_rbegin(&dirty_blocks); e != list_rend(&dirty_blocks); e = list_prev(e)) {
+        if (list_entry(e, struct cache_block, dirty_elem)->sector < b->sector) {
+            break;
+        }
+    }
+    list_insert(list_next(e), &b->dirty_elem);
+}
+
+/*
+ * Takes B off the dirty list to be written back, unless it is clean or
+ * being written already. Returns true if it did.
+ */
+static bool take_dirty (struct cache_block *b) {
+    lock_acquire(&dirty_lock);
+    bool taken = b->dirty && !b->writing;
+    if (taken) {
+        list_remove(&b->dirty_elem);
+        dirty_cnt--;
+        b->dirty = false;
+        b->writing = true;
+        writing_cnt++;
+    }
+    lock_release(&dirty_lock);
+    return taken;
+}
+
+/*
+ * Writes back, in one sweep up the disk, each run of dirty neighbours
+ * that holds a block dirty since tick OLDER or before, and every run
+ * while more than KEEP blocks are dirty. Holds no lock during the
+ * writes.
+ */
+static void write_back (int64_t older, int keep) {
+    struct cache_block *batch[WRITEBACK_BATCH];
+    block_sector_t cursor = 0;
+    int64_t start = timer_ticks();
+    bool more = true, wrote = false;
+
+    while (more) {
+        lock_acquire(&dirty_lock);
+        size_t n = take_runs(&cursor, older, keep, batch, &more);
+        lock_release(&dirty_lock);
+        if (n > 0) {
+            write_runs(batch, n);
+            done_writing(batch, n);
+            wrote = true;
+        }
+    }
+
+    if (wrote) {
+        int64_t ticks = timer_elapsed(start);
+        lock_acquire(&dirty_lock);
+        flush_cnt++;
+        flush_ticks += ticks;
+        if (ticks > flush_max_ticks) {
+            flush_max_ticks = ticks;
+        }
+        lock_release(&dirty_lock);
+    }
+}
+
+/*
+ * Takes the runs write_back() wants from sector *CURSOR on off the
+ * dirty list into BATCH, in ascending order, up to WRITEBACK_BATCH
+ * blocks, and returns how many. A block already being written ends a
+ * run. Moves *CURSOR past the last block looked at and sets *MORE to
+ * whether any are left beyond it. Must be called with dirty_lock held.
+ */
+static size_t take_runs (block_sector_t *cursor, int64_t older, int keep,
+                         struct cache_block **batch, bool *more) {
+    struct list_elem *e = list_begin(&dirty_blocks);
+    size_t n = 0;
+
+    while (e != list_end(&dirty_blocks)
+           && list_entry(e, struct cache_block, dirty_elem)->sector < *cursor) {
+        e = list_next(e);
+    }
+    while (e != list_end(&dirty_blocks) && n < WRITEBACK_BATCH) {
+        struct cache_block *b = list_entry(e, struct cache_block, dirty_elem);
+        if (b->writing) {
+            *cursor = b->sector + 1;
+            e = list_next(e);
+            continue;
+        }
+
+        /* Find the end of the run from E. */
+        struct list_elem *end = e;
+        block_sector_t next = b->sector;
+        size_t len = 0;
+        bool old = false;
+        while (end != list_end(&dirty_blocks) && n + len < WRITEBACK_BATCH) {
+            struct cache_block *r = list_entry(end, struct cache_block, dirty_elem);
+            if (r->sector != next || r->writing) {
+                break;
+            }
+            old = old || r->dirty_since <= older;
+            next++;
+            len++;
+            end = list_next(end);
+        }
+        *cursor = next;
+
+        if (!old && dirty_cnt <= keep) {
+            e = end;
+            continue;
+        }
+        while (e != end) {
+            b = list_entry(e, struct cache_block, dirty_elem);
+            e = list_remove(e);
+            dirty_cnt--;
             b->dirty = false;
+            b->writing = true;
+            writing_cnt++;
+            batch[n++] = b;
         }
-        lock_release(&b->cache_lock);
+    }
+    *more = e != list_end(&dirty_blocks);
+    return n;
+}
+
+/*
+ * Writes the CNT blocks of BATCH, in ascending sector order, to the
+ * disk, each run of neighbours with one request. Keeps up to
+ * WRITEBACK_INFLIGHT runs on their way at once, so the disk queue can
+ * order them with everything else, and returns once all are written.
+ */
+static void write_runs (struct cache_block **batch, size_t cnt) {
+    struct block_iovec iov[WRITEBACK_BATCH];
+    struct bio bios[WRITEBACK_INFLIGHT];
+    struct semaphore done;
+    size_t i = 0, inflight = 0;
+
+    ASSERT(cnt <= WRITEBACK_BATCH);
+    sema_init(&done, 0);
+    while (i < cnt) {
+        size_t n = 0;
+        do {
+            iov[i + n].buffer = batch[i + n]->data;
+            iov[i + n].cnt = 1;
+            n++;
+        } while (i + n < cnt && batch[i + n]->sector == batch[i]->sector + n);
+
+        struct bio *bio = &bios[inflight++];
+        bio->write = true;
+        bio->sector = batch[i]->sector;
+        bio->iov = iov + i;
+        bio->iov_cnt = n;
+        bio->end = block_bio_wake;
+        bio->aux = &done;
+        block_submit(fs_device, bio);
+        atomic_addi(&wb_sectors, n);
+        atomic_inci(&wb_requests);
+        i += n;
+
+        if (inflight == WRITEBACK_INFLIGHT || i == cnt) {
+            while (inflight > 0) {
+                sema_down(&done);
+                inflight--;
+            }
+        }
+    }
+}
+
+/*
+ * Lets the CNT blocks of BATCH, written back, be evicted again.
+ */
+static void done_writing (struct cache_block **batch, size_t cnt) {
+    lock_acquire(&dirty_lock);
+    for (size_t i = 0; i < cnt; i++) {
+        batch[i]->writing = false;
+    }
+    writing_cnt -= cnt;
+    if (writing_cnt == 0) {
+        cond_broadcast(&writing_done, &dirty_lock);
+    }
+    lock_release(&dirty_lock);
+}
+
+/*
+ * Replaces the cached copy of SECTOR, if there is one, with DATA, which
+ * was just written to the disk without going through the cache. A copy
+ * that was dirty stays dirty; writing it again does no harm.
+ */
+void cache_refresh(block_sector_t sector, const void *data) {
+    if (!cache_contains(sector)) {
+        return;
+    }
+    struct cache_block *b = cache_get_block(sector, true, CACHE_DATA);
+    memcpy(b->data, data, BLOCK_SECTOR_SIZE);
+    cache_put_block(b);
+}
+
+/*
+ * Writes all dirty blocks back, in sector order, neighbours together,
+ * and returns once no write back is in flight and nothing is dirty.
+ */
+void flush_cache(void) {
+    bool clean = false;
+    while (!clean) {
+        write_back(INT64_MAX, 0);
+        lock_acquire(&dirty_lock);
+        while (writing_cnt > 0) {
+            cond_wait(&writing_done, &dirty_lock);
+        }
+        clean = dirty_cnt == 0;
+        lock_release(&dirty_lock);
+    }
+}
 
+/*
+ * Fills in ST with the cache's size and hit counts.
+ */
+void cache_stat(struct cachestat *st) {
+    st->blocks = num_chunks * BLOCKS_PER_PAGE;
+    st->max_blocks = max_chunks * BLOCKS_PER_PAGE;
+    st->hits = hits;
+    st->misses = misses;
+    for (int i = 0; i < CACHE_CLASS_CNT; i++) {
+        st->class_hits[i] = class_hits[i];
+        st->class_misses[i] = class_misses[i];
+        st->class_evictions[i] = class_evictions[i];
     }
+    st->ahead_loads = ahead_loads;
+    st->ahead_hits = ahead_hits;
+    lock_acquire(&dirty_lock);
+    st->dirty_blocks = dirty_cnt;
+    st->dirty_marks = dirty_marks;
+    st->wb_sectors = wb_sectors;
+    st->wb_requests = wb_requests;
+    st->flushes = flush_cnt;
+    st->flush_ticks = flush_ticks;
+    lock_release(&dirty_lock);
+}
+
+/*
+ * Prints the cache's size and hit rate, overall and by class, how much
+ * of what was read ahead got used, and how writes got to the disk: the
+ * sectors written over the blocks dirtied is the write amplification.
+ */
+void cache_print_stats(void) {
+    static const char *names[CACHE_CLASS_CNT] = { "inode", "indirect", "directory", "data" };
+
+    printf("Cache: %d of %d blocks, %d hits, %d misses\n",
+           num_chunks * BLOCKS_PER_PAGE, max_chunks * BLOCKS_PER_PAGE, hits, misses);
+    for (int i = 0; i < CACHE_CLASS_CNT; i++) {
+        printf("Cache %s: %d hits, %d misses, %d evictions\n",
+               names[i], class_hits[i], class_misses[i], class_evictions[i]);
+    }
+    printf("Cache read-ahead: %d blocks read, %d used\n", ahead_loads, ahead_hits);
+    printf("Cache write-back: %d blocks dirtied, %d sectors written in %d requests\n",
+           dirty_marks, wb_sectors, wb_requests);
+    printf("Cache dirty: %d bytes, at most %d; %d flushes in %lld ticks, longest %lld\n",
+           dirty_cnt * BLOCK_SECTOR_SIZE, dirty_peak * BLOCK_SECTOR_SIZE,
+           flush_cnt, flush_ticks, flush_max_ticks);
 }
 
 /* 
- * Writes dirty blocks to disk on a regular interval asynchronously.
+ * Writes dirty blocks to disk asynchronously: those dirty for longer
+ * than DIRTY_EXPIRE, and more when too much of the cache is dirty.
  */
 static void write_behind (void *aux UNUSED) {
     for (;;) {
-        timer_sleep(1000);
-        flush_cache();
+        timer_sleep(WRITEBACK_INTERVAL);
+        int background = num_chunks * BLOCKS_PER_PAGE / DIRTY_BACKGROUND_FRACTION;
+        write_back(timer_ticks() - DIRTY_EXPIRE,
+                   dirty_cnt > background ? background / 2 : INT_MAX);
     }
 }
 
 
-void send_read_ahead_request(block_sector_t ahead_sector) {
-    struct read_ahead_sector *ras = malloc(sizeof(struct read_ahead_sector));
-    if (ras == NULL) {
+/*
+ * Returns the most sectors worth reading ahead at once: more would push
+ * blocks read ahead out of a1in before they are used.
+ */
+size_t cache_read_ahead_max(void) {
+    size_t max = (size_t) num_chunks * BLOCKS_PER_PAGE / A1IN_FRACTION / 2;
+    return max < READ_AHEAD_MAX ? max : READ_AHEAD_MAX;
+}
+
+/*
+ * Reads the CNT SECTORS, up to READ_AHEAD_MAX of them, into the cache,
+ * as runs of neighbouring sectors in ascending order so that each run
+ * takes one disk request. If WAIT, claims the blocks and sends the
+ * requests before returning, else hands the sectors to the read ahead
+ * daemon. Either way the blocks stay loading until their data is in,
+ * and whoever wants one meanwhile waits for it as on a miss.
+ */
+void cache_read_ahead(const block_sector_t *sectors, size_t cnt, bool wait) {
+    if (cnt > READ_AHEAD_MAX) {
+        cnt = READ_AHEAD_MAX;
+    }
+    if (wait) {
+        block_sector_t sorted[READ_AHEAD_MAX];
+        memcpy(sorted, sectors, cnt * sizeof *sectors);
+        read_ahead_sectors(sorted, sort_sectors(sorted, cnt));
+        return;
+    }
+
+    struct read_ahead_request *req = malloc(sizeof *req);
+    if (req == NULL) {
         return;
     }
-    ras->sector = ahead_sector;
+    memcpy(req->sectors, sectors, cnt * sizeof *sectors);
+    req->cnt = sort_sectors(req->sectors, cnt);
 
     lock_acquire(&read_ahead_lock);
-    list_push_back(&read_ahead_list, &ras->elem);
-    cond_signal(&read_ahead_cond, &read_ahead_lock);
+    if (read_ahead_cnt < READ_AHEAD_QUEUE) {
+        list_push_back(&read_ahead_list, &req->elem);
+        read_ahead_cnt++;
+        cond_signal(&read_ahead_cond, &read_ahead_lock);
+        req = NULL;
+    }
     lock_release(&read_ahead_lock);
+    free(req);
+}
+
+/*
+ * Sorts the CNT SECTORS and drops repeats. Returns how many are left.
+ */
+static size_t sort_sectors (block_sector_t *sectors, size_t cnt) {
+    size_t i, n = 0;
+
+    qsort(sectors, cnt, sizeof *sectors, compare_sectors);
+    for (i = 0; i < cnt; i++) {
+        if (n == 0 || sectors[n - 1] != sectors[i]) {
+            sectors[n++] = sectors[i];
+        }
+    }
+    return n;
+}
+
+static int compare_sectors (const void *a_, const void *b_) {
+    block_sector_t a = *(const block_sector_t *) a_;
+    block_sector_t b = *(const block_sector_t *) b_;
+    return a < b ? -1 : a > b;
+}
+
+/*
+ * Reads the CNT SECTORS, in ascending order, into the cache a run of
+ * neighbours at a time.
+ */
+static void read_ahead_sectors (const block_sector_t *sectors, size_t cnt) {
+    size_t i = 0;
+
+    while (i < cnt) {
+        size_t n = 1;
+        while (i + n < cnt && sectors[i + n] == sectors[i] + n) {
+            n++;
+        }
+        read_ahead_run(sectors[i], n);
+        i += n;
+    }
 }
 
+/*
+ * Reads the CNT sectors from FIRST on that are not in the cache yet
+ * into it, each stretch of missing ones with a single request, which
+ * is left on its way. The blocks stay loading meanwhile, as on a miss,
+ * and join a1in marked as read ahead, so that their first use counts
+ * as their first reference. Read ahead is only a hint, so if there is
+ * no memory to track a request, the rest is not read.
+ */
+static void read_ahead_run (block_sector_t first, size_t cnt) {
+    size_t i = 0;
 
+    ASSERT(cnt <= READ_AHEAD_MAX);
+    while (i < cnt) {
+        struct read_ahead_io *io = malloc(sizeof *io);
+        if (io == NULL) {
+            return;
+        }
+        block_sector_t start = first + i;
+        size_t n = 0;
+
+        lock_acquire(&all_cache_lock);
+        while (i < cnt && !cache_contains(first + i)) {
+            struct cache_block *b = find_cache_block();
+            if (b == NULL) {
+                continue; /* Cleaned a block with the lock dropped: look again */
+            }
+            start_load(b, bucket_of(first + i), first + i, CACHE_DATA);
+            b->ahead = true;
+            io->run[n] = b;
+            io->iov[n].buffer = b->data;
+            io->iov[n].cnt = 1;
+            n++;
+            i++;
+        }
+        lock_release(&all_cache_lock);
+
+        if (n == 0) {
+            free(io);
+            i++; /* FIRST + I is cached already */
+            continue;
+        }
+        io->cnt = n;
+        io->bio.write = false;
+        io->bio.sector = start;
+        io->bio.iov = io->iov;
+        io->bio.iov_cnt = n;
+        io->bio.end = read_ahead_done;
+        io->bio.aux = io;
+        block_submit(fs_device, &io->bio);
+    }
+}
+
+/*
+ * Marks the blocks of a read ahead run loaded once BIO has read them.
+ * Runs in the disk's dispatcher thread.
+ */
+static void read_ahead_done (struct bio *bio) {
+    struct read_ahead_io *io = bio->aux;
+
+    atomic_addi(&ahead_loads, io->cnt);
+    for (size_t j = 0; j < io->cnt; j++) {
+        finish_load(io->run[j]);
+        lock_acquire(&io->run[j]->cache_lock);
+        io->run[j]->num_pending_requests--;
+        lock_release(&io->run[j]->cache_lock);
+    }
+    free(io);
+}
+
+/*
+ * Reads the batches handed over by cache_read_ahead() in the order
+ * they came.
+ */
 static void read_ahead (void *aux UNUSED) {
     for (;;) {
         lock_acquire(&read_ahead_lock);
         while (list_empty(&read_ahead_list)) {
             cond_wait(&read_ahead_cond, &read_ahead_lock);
         }
-        struct read_ahead_sector *ras = list_entry(list_pop_front(&read_ahead_list), struct read_ahead_sector, elem);
+        struct read_ahead_request *req = list_entry(list_pop_front(&read_ahead_list),
+                                                    struct read_ahead_request, elem);
+        read_ahead_cnt--;
         lock_release(&read_ahead_lock);
-        struct cache_block *b = cache_get_block(ras->sector, false);
-        cache_put_block(b);
-        free(ras);
+        read_ahead_sectors(req->sectors, req->cnt);
+        free(req);
     }
-}
\ No newline at end of file
+}
@@ -1,6 +1,7 @@
 #ifndef FILESYS_CACHE_H
 #define FILESYS_CACHE_H
 
+#include <syscall-types.h>
 #include "devices/block.h"
 #include "threads/synch.h"
 #include "filesys/inode.h"
@@ -8,24 +9,40 @@
 struct cache_block {
     block_sector_t sector;
     bool dirty; /* True if block has been modified, false otherwise */
+    bool writing; /* True while it is being written back */
     bool valid; /* True if block is valid, false otherwise */
+    bool loading; /* True while its sector is being read in */
     bool use_bit; 
+    bool ahead; /* Read ahead and not used yet */
     int num_readers; /* Number of readers currently accessing the block */
     int num_writers; /* Number of writers currently accessing the block */
     int num_pending_requests; /* Number of pending requests for the block */
     struct lock cache_lock; /* Lock for the cache block */
     struct condition is_available;
-    uint8_t data[BLOCK_SECTOR_SIZE];
-    struct list_elem read_ahead_elem;
+    uint8_t *data; /* BLOCK_SECTOR_SIZE bytes in its chunk's page */
+    struct list_elem hash_elem; /* Element in its sector's hash bucket */
+    enum cache_class class; /* What it holds, for statistics */
+    struct list *queue; /* Replacement queue it is in, or NULL */
+    struct list_elem queue_elem; /* Element in QUEUE */
+    struct list_elem dirty_elem; /* Element in the dirty list, if dirty */
+    int64_t dirty_since; /* Timer tick it was last made dirty at */
 };
 
 
-void send_read_ahead_request(block_sector_t sector);
+/* -cache: Number of blocks the cache starts with */
+extern size_t cache_size;
+
+/* Most sectors one read ahead request can hold */
+#define READ_AHEAD_MAX 64
+
 
 /* Intializes the cache */
 void cache_init(void);
 /* Either grant exclusive or shared access */
-struct cache_block * cache_get_block (block_sector_t sector, bool exclusive);
+struct cache_block * cache_get_block (block_sector_t sector, bool exclusive,
+                                      enum cache_class class);
+/* True if SECTOR is currently held in the cache */
+bool cache_contains (block_sector_t sector);
 /* Release access to cache block */
 void cache_put_block(struct cache_block *b);
 /* Read cache block from disk, returns pointer to data */
@@ -34,10 +51,21 @@ void *cache_read_block(struct cache_block *b);
 void *cache_zero_block(struct cache_block *b);
 /* Mark cache block dirty (must be written back) */
 void cache_mark_block_dirty(struct cache_block *b);
+/* Brings a cached copy of a sector written around the cache up to date */
+void cache_refresh(block_sector_t sector, const void *data);
+/* Reads sectors into the cache, in batches of neighbours, now or in the background */
+void cache_read_ahead(const block_sector_t *sectors, size_t cnt, bool wait);
+/* Most sectors worth reading ahead at once */
+size_t cache_read_ahead_max(void);
 /* Closes down the cache, writing back all dirty blocks, etc. */
 void cache_shutdown(void);
 /* Writes all dirty blocks back to disk */
 void flush_cache(void);
+/* Gives a frame lent by VM back, if the blocks on it are idle */
+bool cache_shrink(void);
+/* Reports the cache's size and hit counts */
+void cache_stat(struct cachestat *st);
+void cache_print_stats(void);
 
 
 #endif /* filesys/cache.h */
\ No newline at end of file
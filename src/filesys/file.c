@@ -1,17 +1,30 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
+#include "filesys/cache.h"
 #include "threads/malloc.h"
+#include <round.h>
 #include <stdio.h>
 
+/* Smallest window read ahead when a stream starts. */
+#define READ_AHEAD_MIN (4 * BLOCK_SECTOR_SIZE)
+
 /* An open file. */
 struct file 
   {
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+
+    /* Read ahead, as file_read() finds the file read in sequence. */
+    off_t ra_prev;              /* Offset just past the last read. */
+    off_t ra_start;             /* Window read ahead last. */
+    off_t ra_size;              /* Its size, 0 if not streaming. */
+    off_t ra_async;             /* Reading past this reads the next. */
   };
 
+static void read_ahead (struct file *, off_t size);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -24,6 +37,8 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_prev = 0;
+      file->ra_size = 0;
       return file;
     }
   else
@@ -69,11 +84,52 @@ file_get_inode (struct file *file)
 off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
+  read_ahead (file, size);
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
   file->pos += bytes_read;
+  file->ra_prev = file->pos;
   return bytes_read;
 }
 
+/* Reads ahead of a read of SIZE bytes from FILE's position, in the
+   manner of Linux's on-demand read ahead.  A read that starts where
+   the last one ended continues a stream.  The first read of a stream
+   reads what it asks for and as much again, and waits for it; the
+   window beyond that is read in the background, and each time the
+   reader reaches the last window read ahead the next one is started,
+   twice as big, up to what the buffer cache can hold on to.  A read
+   anywhere else ends the stream and reads nothing ahead. */
+static void
+read_ahead (struct file *file, off_t size)
+{
+  off_t pos = file->pos;
+  off_t max = cache_read_ahead_max () * BLOCK_SECTOR_SIZE;
+
+  if (pos != file->ra_prev || size <= 0)
+    {
+      file->ra_size = 0;
+      return;
+    }
+
+  if (file->ra_size == 0 || pos >= file->ra_start + file->ra_size)
+    {
+      /* A new stream, or one that got ahead of its window. */
+      off_t want = ROUND_UP (2 * size, BLOCK_SECTOR_SIZE);
+      file->ra_start = pos;
+      file->ra_size = want < READ_AHEAD_MIN ? READ_AHEAD_MIN
+                      : want > max ? max : want;
+      file->ra_async = pos + size;
+      inode_read_ahead (file->inode, file->ra_start, file->ra_size, true);
+    }
+  else if (pos + size > file->ra_async)
+    {
+      file->ra_start += file->ra_size;
+      file->ra_size = 2 * file->ra_size > max ? max : 2 * file->ra_size;
+      file->ra_async = file->ra_start;
+      inode_read_ahead (file->inode, file->ra_start, file->ra_size, false);
+    }
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually read,
@@ -114,6 +170,15 @@ file_write_at (struct file *file, const void *buffer, off_t size,
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Returns true if the data of the SIZE bytes of FILE at offset
+   FILE_OFS is all in the buffer cache, as inode_is_cached()
+   describes.  The file's current position is unaffected. */
+bool
+file_is_cached (struct file *file, off_t size, off_t file_ofs) 
+{
+  return inode_is_cached (file->inode, size, file_ofs);
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
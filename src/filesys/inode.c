@@ -57,6 +57,14 @@ struct inode
     struct lock inode_lock;                   /* Lock for inode. */
   };
 
+/* Returns the buffer cache class of the contents of a file, or of a
+   directory if IS_DIRECTORY. */
+static enum cache_class
+data_class (bool is_directory)
+{
+  return is_directory ? CACHE_DIR : CACHE_DATA;
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    If no sector: allcoate it
@@ -80,7 +88,7 @@ byte_to_sector (struct inode *inode, off_t pos, bool is_directory)
     sector_idx = INODE_DIRECT_CNT;
   
   /* Use the idx on the inode sector array */
-  cache_block = cache_get_block(inode->sector, true);
+  cache_block = cache_get_block(inode->sector, true, CACHE_INODE);
   inode->data = (struct inode_disk *) cache_block->data;
   block_sector_t next_sector = inode->data->sectors[sector_idx]; /* next_sector is the sector we are heading to - may be datablock or doubl indirect */
   cache_put_block(cache_block);
@@ -98,7 +106,7 @@ byte_to_sector (struct inode *inode, off_t pos, bool is_directory)
     }
 
     /* record in the inode the new block we just allocated */
-    cache_block = cache_get_block (inode->sector, true);
+    cache_block = cache_get_block (inode->sector, true, CACHE_INODE);
     inode->data = (struct inode_disk *) cache_block->data;       
     inode->data->sectors[sector_idx] = next_sector; /* record the info to newly allocated block */
     cache_mark_block_dirty(cache_block);
@@ -106,7 +114,9 @@ byte_to_sector (struct inode *inode, off_t pos, bool is_directory)
 
     /* zero out the newly allocated block */
     bool exclusive = sector_idx >= INODE_DIRECT_CNT;
-    cache_block = cache_get_block (next_sector, exclusive);
+    cache_block = cache_get_block (next_sector, exclusive,
+                                   exclusive ? CACHE_INDIRECT
+                                             : data_class (is_directory));
     cache_zero_block(cache_block);
     cache_mark_block_dirty(cache_block);
 
@@ -129,7 +139,7 @@ byte_to_sector (struct inode *inode, off_t pos, bool is_directory)
     block_sector_t *dub_indir_data;
     size_t dub_indir_sector_idx = (pos - INODE_DIRECT_BYTES) / INODE_DOUB_INDIRECT_BYTES; /* change it to indirect bytes */
     if(!allocated){
-      cache_block = cache_get_block(dub_indir_sector, true);
+      cache_block = cache_get_block(dub_indir_sector, true, CACHE_INDIRECT);
     }
 
     dub_indir_data = (block_sector_t *) cache_block->data;
@@ -148,21 +158,21 @@ byte_to_sector (struct inode *inode, off_t pos, bool is_directory)
       }
 
       /* Assign the newly fetched block to the doubly indir list */
-      cache_block = cache_get_block(dub_indir_sector, true);
+      cache_block = cache_get_block(dub_indir_sector, true, CACHE_INDIRECT);
       dub_indir_data = (block_sector_t *) cache_block->data;
       dub_indir_data[dub_indir_sector_idx] = next_sector;
       cache_mark_block_dirty(cache_block);
       cache_put_block(cache_block);
 
       /* zero out the newly installed indir sector */
-      cache_block = cache_get_block(next_sector, true);
+      cache_block = cache_get_block(next_sector, true, CACHE_INDIRECT);
       cache_zero_block(cache_block);
       cache_mark_block_dirty(cache_block);
 
     }
     /* needed indir block is present */
     else{
-      cache_block = cache_get_block(next_sector, true);
+      cache_block = cache_get_block(next_sector, true, CACHE_INDIRECT);
     }
 
     block_sector_t indir_sector = next_sector; /* indirect sector */
@@ -184,14 +194,14 @@ byte_to_sector (struct inode *inode, off_t pos, bool is_directory)
       }
 
       /* Assign the newly fetched block to indir block */
-      cache_block = cache_get_block(indir_sector, true);
+      cache_block = cache_get_block(indir_sector, true, CACHE_INDIRECT);
       indir_data = (block_sector_t *) cache_block->data;
       indir_data[indir_sector_idx] = next_sector;
       cache_mark_block_dirty(cache_block);
       cache_put_block(cache_block);
 
       /* zero out the newly installed block */
-      cache_block = cache_get_block(next_sector, true);
+      cache_block = cache_get_block(next_sector, true, data_class (is_directory));
       cache_zero_block(cache_block);
       cache_mark_block_dirty(cache_block);
       cache_put_block(cache_block);
@@ -247,7 +257,7 @@ inode_create (block_sector_t sector, off_t length, bool is_directory)
       disk_inode->magic = INODE_MAGIC;
       disk_inode->is_directory = is_directory;
 
-      struct cache_block *cache_block = cache_get_block(sector, true);
+      struct cache_block *cache_block = cache_get_block(sector, true, CACHE_INODE);
       memcpy(cache_block->data, disk_inode, sizeof *disk_inode); /* write contents of disk inode into cache */
       cache_mark_block_dirty(cache_block);
       cache_put_block(cache_block);
@@ -337,7 +347,7 @@ inode_close (struct inode *inode)
     /* remove & dealloc the blocks if removed */
     if (inode->removed){
 
-      struct cache_block *cache_block = cache_get_block(inode->sector, true);
+      struct cache_block *cache_block = cache_get_block(inode->sector, true, CACHE_INODE);
       inode->data = (struct inode_disk *) cache_block->data;
       for(size_t i = 0; i < INODE_DIRECT_CNT; i++){
         block_sector_t direct_sector = inode->data->sectors[i];
@@ -352,7 +362,7 @@ inode_close (struct inode *inode)
 
       if(dub_indir_sector != 0){
         for(size_t dub_indir_idx = 0; dub_indir_idx < INODE_INDIRECT_SECTOR_CNT; dub_indir_idx++){
-          cache_block = cache_get_block(dub_indir_sector, true);
+          cache_block = cache_get_block(dub_indir_sector, true, CACHE_INDIRECT);
           block_sector_t *dub_indir_data = (block_sector_t *) cache_block->data;
           block_sector_t indir_sector = dub_indir_data[dub_indir_idx];
           cache_put_block(cache_block);
@@ -360,7 +370,7 @@ inode_close (struct inode *inode)
           if(indir_sector != 0){
             /* traverse through indirect sector's indexes and free allocated blocks */
             for(size_t indir_idx = 0; indir_idx < INODE_INDIRECT_SECTOR_CNT; indir_idx++){
-              cache_block = cache_get_block(indir_sector, true);
+              cache_block = cache_get_block(indir_sector, true, CACHE_INDIRECT);
               block_sector_t *indir_data = (block_sector_t *) cache_block->data;
               block_sector_t direct = indir_data[indir_idx];
               cache_put_block(cache_block);
@@ -437,7 +447,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      cache_block = cache_get_block(sector, false);
+      cache_block = cache_get_block(sector, false, data_class (is_directory));
       memcpy(buffer + bytes_read, cache_block->data + sector_ofs, chunk_size);
       cache_put_block(cache_block);
       
@@ -450,13 +460,77 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   return bytes_read;
 }
 
+/* Returns the sector that holds byte offset POS within INODE, or 0
+   if none has been allocated for it yet.  Unlike byte_to_sector(),
+   never allocates. */
+static block_sector_t
+lookup_sector (struct inode *inode, off_t pos)
+{
+  struct cache_block *cache_block;
+  block_sector_t sector;
+  size_t sector_idx = pos / BLOCK_SECTOR_SIZE;
+
+  if (sector_idx >= INODE_DIRECT_CNT)
+    sector_idx = INODE_DIRECT_CNT;
+  cache_block = cache_get_block (inode->sector, false, CACHE_INODE);
+  sector = ((struct inode_disk *) cache_block->data)->sectors[sector_idx];
+  cache_put_block (cache_block);
+  if (sector == 0 || sector_idx < INODE_DIRECT_CNT)
+    return sector;
+
+  /* Through the doubly indirect block to the indirect one. */
+  cache_block = cache_get_block (sector, false, CACHE_INDIRECT);
+  sector = ((block_sector_t *) cache_block->data)
+             [(pos - INODE_DIRECT_BYTES) / INODE_DOUB_INDIRECT_BYTES];
+  cache_put_block (cache_block);
+  if (sector == 0)
+    return 0;
+
+  cache_block = cache_get_block (sector, false, CACHE_INDIRECT);
+  sector = ((block_sector_t *) cache_block->data)
+             [((pos - INODE_DIRECT_BYTES) % INODE_DOUB_INDIRECT_BYTES)
+              / BLOCK_SECTOR_SIZE];
+  cache_put_block (cache_block);
+  return sector;
+}
+
+/* Reads the sectors of INODE that hold the SIZE bytes from OFFSET
+   into the buffer cache, at most READ_AHEAD_MAX of them, waiting for
+   them if WAIT and otherwise leaving it to the read ahead daemon.
+   Stops at end of file and skips sectors already cached or never
+   written. */
+void
+inode_read_ahead (struct inode *inode, off_t offset, off_t size, bool wait)
+{
+  block_sector_t sectors[READ_AHEAD_MAX];
+  size_t cnt = 0;
+  off_t length = inode_length (inode);
+  off_t pos;
+
+  if (inode_is_directory (inode) || offset >= length)
+    return;
+  if (size > length - offset)
+    size = length - offset;
+
+  for (pos = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE);
+       pos < offset + size && cnt < READ_AHEAD_MAX;
+       pos += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = lookup_sector (inode, pos);
+      if (sector != 0 && !cache_contains (sector))
+        sectors[cnt++] = sector;
+    }
+  if (cnt > 0)
+    cache_read_ahead (sectors, cnt, wait);
+}
+
 static off_t
 update_length (struct inode *inode, off_t offset)
 {
   struct cache_block *cache_block;
   off_t length;
   
-  cache_block = cache_get_block (inode->sector, true);
+  cache_block = cache_get_block (inode->sector, true, CACHE_INODE);
   inode->data = (struct inode_disk *) cache_block->data;
   length = inode->data->length;
   if (offset > length)
@@ -483,7 +557,7 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
   struct cache_block *cache_block;
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  cache_block = cache_get_block(inode->sector, true);
+  cache_block = cache_get_block(inode->sector, true, CACHE_INODE);
   struct inode_disk * idisk = (struct inode_disk *) cache_block->data;
   bool is_directory = idisk->is_directory;
   cache_put_block(cache_block);
@@ -500,12 +574,6 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 
   is_directory = inode_is_directory(inode);
 
-  /* Try to read ahead */
-  off_t next_sector = offset + BLOCK_SECTOR_SIZE - 1;
-  if (size == 0 && next_sector > offset && next_sector < length && (byte_to_sector(inode, next_sector, is_directory) != 0)) {
-    send_read_ahead_request(next_sector);
-  }
-
   ASSERT(is_directory == inode_is_directory(inode));
 
   while (size > 0) 
@@ -527,7 +595,7 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      cache_block = cache_get_block(sector, true);
+      cache_block = cache_get_block(sector, true, data_class (is_directory));
       memcpy(cache_block->data + sector_ofs, buffer + bytes_written, chunk_size);
       cache_mark_block_dirty(cache_block);
       cache_put_block(cache_block);
@@ -547,6 +615,84 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 
 
 
+/* Writes RUN_CNT buffers from RUN to the consecutive sectors starting
+   at FIRST, then updates the buffer cache's copies of them. */
+static void
+write_direct_run (block_sector_t first, const struct block_iovec *run,
+                  size_t run_cnt)
+{
+  size_t i;
+  block_sector_t j;
+
+  block_writev (fs_device, first, run, run_cnt);
+  for (i = 0; i < run_cnt; i++)
+    for (j = 0; j < run[i].cnt; j++)
+      cache_refresh (first++, (uint8_t *) run[i].buffer + j * BLOCK_SECTOR_SIZE);
+}
+
+/* Writes the whole sectors in the IOV_CNT buffers of IOV into INODE,
+   starting at OFFSET, a multiple of BLOCK_SECTOR_SIZE, within the
+   file's length.  The data goes straight to the disk, not through the
+   buffer cache: each stretch of sectors that lie next to each other on
+   disk takes one block_writev().  Meant for large writes of whole
+   pages, which would only push everything else out of the cache.
+   Returns the number of bytes written, less than asked if a sector
+   could not be allocated. */
+off_t
+inode_write_direct (struct inode *inode, const struct block_iovec *iov,
+                    size_t iov_cnt, off_t offset)
+{
+  struct block_iovec *run;
+  size_t run_cnt = 0, i;
+  block_sector_t first = 0, next = 0, j;
+  off_t bytes_written = 0;
+
+  ASSERT (offset % BLOCK_SECTOR_SIZE == 0);
+
+  if (inode->deny_write_cnt || iov_cnt == 0)
+    return 0;
+
+  /* A stretch takes at most one piece of each buffer. */
+  run = malloc (iov_cnt * sizeof *run);
+  if (run == NULL)
+    return 0;
+
+  for (i = 0; i < iov_cnt; i++)
+    for (j = 0; j < iov[i].cnt; j++)
+      {
+        uint8_t *data = (uint8_t *) iov[i].buffer + j * BLOCK_SECTOR_SIZE;
+        block_sector_t sector = byte_to_sector (inode, offset + bytes_written,
+                                                false);
+        if (sector == 0)
+          goto done;
+
+        if (run_cnt > 0 && sector == next)
+          {
+            struct block_iovec *last = &run[run_cnt - 1];
+            if ((uint8_t *) last->buffer + last->cnt * BLOCK_SECTOR_SIZE == data)
+              last->cnt++;
+            else
+              run[run_cnt++] = (struct block_iovec) { data, 1 };
+          }
+        else
+          {
+            if (run_cnt > 0)
+              write_direct_run (first, run, run_cnt);
+            first = sector;
+            run[0] = (struct block_iovec) { data, 1 };
+            run_cnt = 1;
+          }
+        next = sector + 1;
+        bytes_written += BLOCK_SECTOR_SIZE;
+      }
+
+done:
+  if (run_cnt > 0)
+    write_direct_run (first, run, run_cnt);
+  free (run);
+  return bytes_written;
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
@@ -567,11 +713,34 @@ inode_allow_write (struct inode *inode) //done
   inode->deny_write_cnt--;
 }
 
+/* Returns true if every data sector holding the SIZE bytes of
+   INODE starting at OFFSET is in the buffer cache.  Bytes past the
+   end of the file count as cached.  Only the data sectors are
+   checked: finding them reads the inode and its indirect and
+   doubly indirect blocks through the cache, and those reads, here
+   or in a later read of the range, may still go to disk. */
+bool
+inode_is_cached (struct inode *inode, off_t size, off_t offset)
+{
+  off_t length = inode_length (inode);
+  bool is_directory = inode_is_directory (inode);
+  off_t end = offset + size < length ? offset + size : length;
+
+  offset = offset / BLOCK_SECTOR_SIZE * BLOCK_SECTOR_SIZE;
+  for (; offset < end; offset += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, offset, is_directory);
+      if (sector == 0 || !cache_contains (sector))
+        return false;
+    }
+  return true;
+}
+
 /* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (struct inode *inode)
 {
-  struct cache_block *cache_block = cache_get_block(inode->sector, true);
+  struct cache_block *cache_block = cache_get_block(inode->sector, true, CACHE_INODE);
   inode->data = (struct inode_disk *) cache_block->data;
   off_t length = inode->data->length;
   cache_put_block(cache_block);
@@ -584,7 +753,7 @@ inode_is_directory (struct inode *inode){
   struct cache_block *cache_block;
   bool is_directory;
   
-  cache_block = cache_get_block (inode->sector, true);
+  cache_block = cache_get_block (inode->sector, true, CACHE_INODE);
   inode->data = (struct inode_disk *) cache_block->data;
   is_directory = inode->data->is_directory;
   cache_put_block (cache_block);
@@ -16,10 +16,14 @@ block_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+void inode_read_ahead (struct inode *, off_t offset, off_t size, bool wait);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+off_t inode_write_direct (struct inode *, const struct block_iovec *,
+                          size_t iov_cnt, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (struct inode *);
+bool inode_is_cached (struct inode *, off_t size, off_t offset);
 bool inode_is_directory (struct inode *);
 // static off_t update_length (struct inode *inode, off_t offset);
 int inode_get_open_cnt (struct inode *);
@@ -120,6 +120,42 @@ lcr3 (uint32_t val)
   asm volatile("movl %0,%%cr3" : : "r" (val) : "memory");
 }
 
+/* CR4 bit that enables 4 MB pages.  See [IA32-v3a] 2.5 "Control
+   Registers". */
+#define CR4_PSE 0x10
+
+static inline uint32_t
+rcr4 (void)
+{
+  uint32_t val;
+  asm volatile("movl %%cr4,%0" : "=r" (val));
+  return val;
+}
+
+static inline void
+lcr4 (uint32_t val)
+{
+  asm volatile("movl %0,%%cr4" : : "r" (val) : "memory");
+}
+
+/* Returns the time stamp counter, which counts CPU cycles.  See
+   [IA32-v2b] "RDTSC--Read Time-Stamp Counter". */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t val;
+  asm volatile("rdtsc" : "=A" (val));
+  return val;
+}
+
+/* Drops the TLB entry for the page holding VA.  See [IA32-v2a]
+   "INVLPG--Invalidate TLB Entry". */
+static inline void
+invlpg (const void *va)
+{
+  asm volatile("invlpg (%0)" : : "r" (va) : "memory");
+}
+
 static inline void
 flushtlb (void)
 {
@@ -28,7 +28,16 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_MADVISE,                /* Advise on use of a memory range. */
+    SYS_FORK,                   /* Copy this process, copy-on-write. */
+    SYS_MEMSTAT,                /* Report this process's memory use. */
+    SYS_RSSLIMIT,               /* Limit this process's resident set. */
+    SYS_MSYNC,                  /* Write back dirty mapped pages. */
+    SYS_CACHESTAT,              /* Report buffer cache statistics. */
+    SYS_UPTIME                  /* Report timer ticks since boot. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -0,0 +1,60 @@
+#ifndef __LIB_SYSCALL_TYPES_H
+#define __LIB_SYSCALL_TYPES_H
+
+/* Constants and structures passed through the extension system
+   calls, shared by the kernel and user programs. */
+
+/* Advice values for SYS_MADVISE. */
+enum
+  {
+    MADV_NORMAL,                /* Default fault-around. */
+    MADV_RANDOM,                /* Map only the faulting page. */
+    MADV_SEQUENTIAL,            /* Expect forward access, map ahead. */
+    MADV_WILLNEED               /* Fault the whole range in now. */
+  };
+
+/* Memory use of a process, filled in by SYS_MEMSTAT.  Sizes are
+   in pages; a limit of 0 means none. */
+struct memstat
+  {
+    int resident;               /* Pages in frames. */
+    int working_set;            /* Pages touched in the last second or so. */
+    int swapped;                /* Pages in swap. */
+    int soft_limit;             /* Evicted from first when above this. */
+    int hard_limit;             /* Never holds more frames than this. */
+    int faults;                 /* Page faults. */
+    int major_faults;           /* Of those, ones that read a file or swap. */
+  };
+
+/* Kinds of buffer cache blocks, counted apart by SYS_CACHESTAT. */
+enum cache_class
+  {
+    CACHE_INODE,                /* On-disk inodes. */
+    CACHE_INDIRECT,             /* Indirect and doubly indirect blocks. */
+    CACHE_DIR,                  /* Directory contents. */
+    CACHE_DATA,                 /* File contents. */
+    CACHE_CLASS_CNT
+  };
+
+/* Buffer cache statistics, filled in by SYS_CACHESTAT.  Sizes are
+   in sectors. */
+struct cachestat
+  {
+    int blocks;                 /* Blocks in the cache now. */
+    int max_blocks;             /* Blocks it may grow to. */
+    int hits;                   /* Lookups found in the cache. */
+    int misses;                 /* Lookups that read the disk. */
+    int class_hits[CACHE_CLASS_CNT];      /* Hits by class. */
+    int class_misses[CACHE_CLASS_CNT];    /* Misses by class. */
+    int class_evictions[CACHE_CLASS_CNT]; /* Blocks of each class evicted. */
+    int ahead_loads;            /* Blocks read ahead. */
+    int ahead_hits;             /* Blocks read ahead and then used. */
+    int dirty_blocks;           /* Blocks dirty now. */
+    int dirty_marks;            /* Times blocks were dirtied. */
+    int wb_sectors;             /* Sectors written back. */
+    int wb_requests;            /* Disk requests they took. */
+    int flushes;                /* Write-back sweeps that wrote any. */
+    long long flush_ticks;      /* Timer ticks those took. */
+  };
+
+#endif /* lib/syscall-types.h */
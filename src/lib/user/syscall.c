@@ -182,3 +182,45 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int
+madvise (void *addr, unsigned length, int advice)
+{
+  return syscall3 (SYS_MADVISE, addr, length, advice);
+}
+
+pid_t
+fork (void)
+{
+  return (pid_t) syscall0 (SYS_FORK);
+}
+
+bool
+memstat (struct memstat *ms)
+{
+  return syscall1 (SYS_MEMSTAT, ms);
+}
+
+bool
+rsslimit (int soft_pages, int hard_pages)
+{
+  return syscall2 (SYS_RSSLIMIT, soft_pages, hard_pages);
+}
+
+int
+msync (void *addr, unsigned length)
+{
+  return syscall2 (SYS_MSYNC, addr, length);
+}
+
+bool
+cachestat (struct cachestat *st)
+{
+  return syscall1 (SYS_CACHESTAT, st);
+}
+
+int
+uptime (void)
+{
+  return syscall0 (SYS_UPTIME);
+}
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <syscall-types.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -45,4 +46,13 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+int madvise (void *addr, unsigned length, int advice);
+pid_t fork (void);
+bool memstat (struct memstat *);
+bool rsslimit (int soft_pages, int hard_pages);
+int msync (void *addr, unsigned length);
+bool cachestat (struct cachestat *);
+int uptime (void);
+
 #endif /* lib/user/syscall.h */
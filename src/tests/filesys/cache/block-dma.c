@@ -0,0 +1,57 @@
+/* Writes a file much bigger than the buffer cache in large
+   chunks, then reads it back and checks every sector.  With a
+   small cache, the data has to make the round trip to disk in
+   long runs, which the IDE driver moves up to 128 kB per command
+   by DMA or READ/WRITE MULTIPLE. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (512 * 1024)
+#define CHUNK (64 * 1024)
+
+static char buf[CHUNK];
+
+/* Fills BUF with the pattern for the chunk at OFS: each sector
+   holds its own number in the file, so misplaced sectors show. */
+static void
+fill (size_t ofs)
+{
+  size_t i;
+
+  for (i = 0; i < CHUNK; i++)
+    buf[i] = (ofs + i) / 512 * 7 + i % 512;
+}
+
+void
+test_main (void)
+{
+  static char expect[CHUNK];
+  size_t ofs;
+  int fd;
+
+  CHECK (create ("dma", 0), "create \"dma\"");
+  CHECK ((fd = open ("dma")) > 1, "open \"dma\"");
+  for (ofs = 0; ofs < SIZE; ofs += CHUNK)
+    {
+      fill (ofs);
+      if (write (fd, buf, CHUNK) != CHUNK)
+        fail ("write \"dma\" at %zu", ofs);
+    }
+  close (fd);
+  msg ("write \"dma\"");
+
+  CHECK ((fd = open ("dma")) > 1, "open \"dma\"");
+  for (ofs = 0; ofs < SIZE; ofs += CHUNK)
+    {
+      fill (ofs);
+      memcpy (expect, buf, CHUNK);
+      if (read (fd, buf, CHUNK) != CHUNK)
+        fail ("read \"dma\" at %zu", ofs);
+      compare_bytes (buf, expect, CHUNK, ofs, "dma");
+    }
+  close (fd);
+  msg ("read \"dma\"");
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+fail "no IDE disk moving more than a sector per interrupt\n"
+  if !grep (/^hd\w: .*, (DMA|PIO multiple)$/, @output);
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(block-dma) begin
+(block-dma) create "dma"
+(block-dma) open "dma"
+(block-dma) write "dma"
+(block-dma) open "dma"
+(block-dma) read "dma"
+(block-dma) end
+EOF
+pass;
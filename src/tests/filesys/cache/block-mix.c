@@ -0,0 +1,118 @@
+/* Runs reads and writes to the disk at once so that the block
+   device's queue has to order and merge them.  One child reads a
+   file front to back, another reads a second file back to front,
+   and a third writes a new file; with a small buffer cache nearly
+   all of it reaches the disk.  Each reader checks every byte, and
+   the parent checks what the writer wrote. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (128 * 1024)
+#define CHUNK 4096
+#define CHILD_CNT 3
+
+static const char *names[CHILD_CNT] = { "mix-a", "mix-b", "mix-c" };
+static char buf[CHUNK];
+
+/* Byte I of file F. */
+static char
+pattern (int f, size_t i)
+{
+  return (i / CHUNK) * (f + 5) + i % 7 + f;
+}
+
+/* Fills BUF with chunk OFS of file F. */
+static void
+fill (int f, size_t ofs)
+{
+  size_t i;
+
+  for (i = 0; i < CHUNK; i++)
+    buf[i] = pattern (f, ofs + i);
+}
+
+/* Returns true if BUF holds chunk OFS of file F. */
+static bool
+matches (int f, size_t ofs)
+{
+  size_t i;
+
+  for (i = 0; i < CHUNK; i++)
+    if (buf[i] != pattern (f, ofs + i))
+      return false;
+  return true;
+}
+
+/* Writes file F in full. */
+static bool
+write_file (int f)
+{
+  int handle = open (names[f]);
+  size_t ofs;
+
+  if (handle < 2)
+    return false;
+  for (ofs = 0; ofs < SIZE; ofs += CHUNK)
+    {
+      fill (f, ofs);
+      if (write (handle, buf, CHUNK) != CHUNK)
+        return false;
+    }
+  close (handle);
+  return true;
+}
+
+/* Reads file F in full, backward if BACKWARD, checking it. */
+static bool
+read_file (int f, bool backward)
+{
+  int handle = open (names[f]);
+  size_t i;
+
+  if (handle < 2)
+    return false;
+  for (i = 0; i < SIZE / CHUNK; i++)
+    {
+      size_t ofs = (backward ? SIZE / CHUNK - 1 - i : i) * CHUNK;
+      seek (handle, ofs);
+      if (read (handle, buf, CHUNK) != CHUNK || !matches (f, ofs))
+        return false;
+    }
+  close (handle);
+  return true;
+}
+
+/* Runs in child number ID: returns 0x42 if it did its part. */
+static int
+child (int id)
+{
+  bool ok = id == 2 ? write_file (id) : read_file (id, id == 1);
+  return ok ? 0x42 : 1;
+}
+
+void
+test_main (void)
+{
+  pid_t children[CHILD_CNT];
+  int id;
+
+  for (id = 0; id < CHILD_CNT; id++)
+    CHECK (create (names[id], 0), "create \"%s\"", names[id]);
+  for (id = 0; id < 2; id++)
+    CHECK (write_file (id), "write \"%s\"", names[id]);
+
+  for (id = 0; id < CHILD_CNT; id++)
+    {
+      children[id] = fork ();
+      if (children[id] == 0)
+        exit (child (id));
+      CHECK (children[id] != -1, "fork child %d", id);
+    }
+  for (id = 0; id < CHILD_CNT; id++)
+    CHECK (wait (children[id]) == 0x42, "wait for child %d", id);
+
+  CHECK (read_file (2, false), "read \"%s\"", names[2]);
+}
@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+fail "no queue statistics for the C-LOOK scheduler\n"
+  if !grep (/^\w+: [1-9]\d* requests in [1-9]\d* dispatches \(clook\)$/,
+            @output);
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(block-mix) begin
+(block-mix) create "mix-a"
+(block-mix) create "mix-b"
+(block-mix) create "mix-c"
+(block-mix) write "mix-a"
+(block-mix) write "mix-b"
+(block-mix) fork child 0
+(block-mix) fork child 1
+(block-mix) fork child 2
+(block-mix) wait for child 0
+(block-mix) wait for child 1
+(block-mix) wait for child 2
+(block-mix) read "mix-c"
+(block-mix) end
+EOF
+pass;
@@ -0,0 +1,56 @@
+/* Checks that dirty blocks get written back on their own, in runs.
+   Writes a file in sequence, then waits for the buffer cache to
+   have nothing dirty left, which the write-behind daemon should
+   bring about within a few seconds.  The file's sectors lie next
+   to each other on disk, so writing them back should have taken
+   far fewer requests than sectors. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (64 * 1024)
+#define CHUNK 4096
+#define SECTOR_CNT (SIZE / 512)
+#define TIMEOUT_TICKS 10000
+
+static char buf[CHUNK];
+
+void
+test_main (void)
+{
+  struct cachestat before, now;
+  size_t ofs;
+  int fd, start;
+
+  CHECK (create ("flush", 0), "create \"flush\"");
+  CHECK ((fd = open ("flush")) > 1, "open \"flush\"");
+  CHECK (cachestat (&before), "cachestat");
+  start = uptime ();
+  for (ofs = 0; ofs < SIZE; ofs += CHUNK)
+    {
+      memset (buf, ofs / CHUNK + 1, CHUNK);
+      if (write (fd, buf, CHUNK) != CHUNK)
+        fail ("write \"flush\"");
+    }
+  close (fd);
+  msg ("write \"flush\"");
+
+  do
+    if (!cachestat (&now))
+      fail ("cachestat");
+  while (now.dirty_blocks > 0 && uptime () - start < TIMEOUT_TICKS);
+  if (now.dirty_blocks > 0)
+    fail ("%d blocks still dirty after %d ticks", now.dirty_blocks,
+          uptime () - start);
+  msg ("dirty blocks written back");
+
+  int sectors = now.wb_sectors - before.wb_sectors;
+  int requests = now.wb_requests - before.wb_requests;
+  if (sectors < SECTOR_CNT)
+    fail ("only %d sectors written back", sectors);
+  if (requests * 4 > sectors)
+    fail ("%d sectors written back in %d requests", sectors, requests);
+  msg ("neighbouring sectors written back together");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-flush) begin
+(cache-flush) create "flush"
+(cache-flush) open "flush"
+(cache-flush) cachestat
+(cache-flush) write "flush"
+(cache-flush) dirty blocks written back
+(cache-flush) neighbouring sectors written back together
+(cache-flush) end
+EOF
+pass;
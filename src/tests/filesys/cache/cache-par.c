@@ -0,0 +1,78 @@
+/* Forks children that read two files at once, two children to a file,
+   so that misses on the same sector and on different sectors overlap
+   in the buffer cache.  Each child checks every byte it reads. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHILD_CNT 4
+#define FILE_CNT 2
+#define SIZE (128 * 1024)
+#define CHUNK 512
+
+static const char *names[FILE_CNT] = { "par-a", "par-b" };
+static char buf[CHUNK];
+
+/* Byte I of file F. */
+static char
+pattern (int f, size_t i)
+{
+  return (i / CHUNK) * (f + 3) + f;
+}
+
+/* Runs in child number ID: returns 0x42 if it read its file back. */
+static int
+child (int id)
+{
+  int f = id % FILE_CNT;
+  int handle = open (names[f]);
+  size_t ofs, i;
+
+  if (handle < 2)
+    return 1;
+  for (ofs = 0; ofs < SIZE; ofs += CHUNK)
+    {
+      if (read (handle, buf, CHUNK) != CHUNK)
+        return 2;
+      for (i = 0; i < CHUNK; i++)
+        if (buf[i] != pattern (f, ofs + i))
+          return 3;
+    }
+  close (handle);
+  return 0x42;
+}
+
+void
+test_main (void)
+{
+  pid_t children[CHILD_CNT];
+  size_t ofs;
+  int f, id;
+
+  for (f = 0; f < FILE_CNT; f++)
+    {
+      int handle;
+      CHECK (create (names[f], 0), "create \"%s\"", names[f]);
+      CHECK ((handle = open (names[f])) > 1, "open \"%s\"", names[f]);
+      for (ofs = 0; ofs < SIZE; ofs += CHUNK)
+        {
+          memset (buf, pattern (f, ofs), CHUNK);
+          if (write (handle, buf, CHUNK) != CHUNK)
+            fail ("write \"%s\"", names[f]);
+        }
+      close (handle);
+    }
+
+  for (id = 0; id < CHILD_CNT; id++)
+    {
+      children[id] = fork ();
+      if (children[id] == 0)
+        exit (child (id));
+      CHECK (children[id] != -1, "fork child %d", id);
+    }
+
+  for (id = 0; id < CHILD_CNT; id++)
+    CHECK (wait (children[id]) == 0x42, "wait for child %d", id);
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-par) begin
+(cache-par) create "par-a"
+(cache-par) open "par-a"
+(cache-par) create "par-b"
+(cache-par) open "par-b"
+(cache-par) fork child 0
+(cache-par) fork child 1
+(cache-par) fork child 2
+(cache-par) fork child 3
+(cache-par) wait for child 0
+(cache-par) wait for child 1
+(cache-par) wait for child 2
+(cache-par) wait for child 3
+(cache-par) end
+EOF
+pass;
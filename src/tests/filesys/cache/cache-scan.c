@@ -0,0 +1,95 @@
+/* Checks that a bulk scan does not flush hot metadata out of the
+   buffer cache.  Writes a file larger than the cache, then opens a
+   directory of small files over and over so that their inodes and
+   directory blocks are used repeatedly, then reads the large file
+   through once.  Opening the small files again afterward should
+   still find their inode and directory blocks in the cache. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BIG_SIZE (1024 * 1024)
+#define CHUNK 4096
+#define FILE_CNT 32
+#define ROUNDS 4
+
+static char buf[CHUNK];
+
+/* Opens and closes each small file once. */
+static void
+open_all (void)
+{
+  char name[32];
+  int i, fd;
+
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "meta/f%d", i);
+      if ((fd = open (name)) < 2)
+        fail ("open \"%s\"", name);
+      close (fd);
+    }
+}
+
+/* Hits and lookups of inode and directory blocks in ST. */
+static int
+meta_hits (const struct cachestat *st)
+{
+  return st->class_hits[CACHE_INODE] + st->class_hits[CACHE_DIR];
+}
+
+static int
+meta_lookups (const struct cachestat *st)
+{
+  return meta_hits (st) + st->class_misses[CACHE_INODE]
+         + st->class_misses[CACHE_DIR];
+}
+
+void
+test_main (void)
+{
+  struct cachestat before, after;
+  char name[32];
+  int i, fd;
+  size_t ofs;
+
+  CHECK (create ("big", 0), "create \"big\"");
+  CHECK ((fd = open ("big")) > 1, "open \"big\"");
+  for (ofs = 0; ofs < BIG_SIZE; ofs += CHUNK)
+    {
+      memset (buf, ofs / CHUNK, CHUNK);
+      if (write (fd, buf, CHUNK) != CHUNK)
+        fail ("write \"big\"");
+    }
+  msg ("write \"big\"");
+
+  CHECK (mkdir ("meta"), "mkdir \"meta\"");
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "meta/f%d", i);
+      if (!create (name, 16))
+        fail ("create \"%s\"", name);
+    }
+  msg ("create %d files in \"meta\"", FILE_CNT);
+  for (i = 0; i < ROUNDS; i++)
+    open_all ();
+  msg ("open them %d times", ROUNDS);
+
+  seek (fd, 0);
+  for (ofs = 0; ofs < BIG_SIZE; ofs += CHUNK)
+    if (read (fd, buf, CHUNK) != CHUNK || buf[0] != (char) (ofs / CHUNK))
+      fail ("read \"big\" at %zu", ofs);
+  close (fd);
+  msg ("read \"big\"");
+
+  CHECK (cachestat (&before), "cachestat");
+  open_all ();
+  CHECK (cachestat (&after), "cachestat");
+  int lookups = meta_lookups (&after) - meta_lookups (&before);
+  int hits = meta_hits (&after) - meta_hits (&before);
+  msg ("metadata hit rate after scan: %d%%",
+       lookups > 0 ? hits * 100 / lookups : 0);
+}
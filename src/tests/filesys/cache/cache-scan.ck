@@ -0,0 +1,30 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# The hit rate varies from run to run: check it, then drop it before
+# comparing the rest.
+my ($rate) = map (/^\(cache-scan\) metadata hit rate after scan: (\d+)%$/, @output);
+fail "metadata hit rate not reported\n" if !defined $rate;
+fail "metadata hit only $rate% of the time after the scan\n" if $rate < 90;
+@output = grep (!/^\(cache-scan\) metadata hit rate/, @output);
+
+compare_output ("run", (IGNORE_EXIT_CODES => 1), \@output, [<<'EOF']);
+(cache-scan) begin
+(cache-scan) create "big"
+(cache-scan) open "big"
+(cache-scan) write "big"
+(cache-scan) mkdir "meta"
+(cache-scan) create 32 files in "meta"
+(cache-scan) open them 4 times
+(cache-scan) read "big"
+(cache-scan) cachestat
+(cache-scan) cachestat
+(cache-scan) end
+EOF
+pass;
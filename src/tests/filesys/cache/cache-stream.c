@@ -0,0 +1,82 @@
+/* Checks that reading a file in sequence is served by read ahead and
+   that reading it at random is not.  Writes a file much larger than
+   the buffer cache, reads it through in order, and expects nearly all
+   of its sectors to have been read ahead before they were asked for.
+   Then reads single sectors at random and expects next to nothing to
+   be read ahead. */
+
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE (512 * 1024)
+#define CHUNK 4096
+#define SECTOR 512
+#define SECTOR_CNT (FILE_SIZE / SECTOR)
+#define RANDOM_CNT 64
+
+static char buf[CHUNK];
+
+void
+test_main (void)
+{
+  struct cachestat before, after;
+  size_t ofs, prev_end;
+  int fd, i;
+
+  CHECK (create ("stream", 0), "create \"stream\"");
+  CHECK ((fd = open ("stream")) > 1, "open \"stream\"");
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK)
+    {
+      memset (buf, ofs / CHUNK, CHUNK);
+      if (write (fd, buf, CHUNK) != CHUNK)
+        fail ("write \"stream\"");
+    }
+  msg ("write \"stream\"");
+
+  CHECK (cachestat (&before), "cachestat");
+  seek (fd, 0);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK)
+    if (read (fd, buf, CHUNK) != CHUNK || buf[0] != (char) (ofs / CHUNK)
+        || buf[CHUNK - 1] != (char) (ofs / CHUNK))
+      fail ("read \"stream\" at %zu", ofs);
+  CHECK (cachestat (&after), "cachestat");
+  msg ("read \"stream\" in sequence");
+
+  int misses = after.class_misses[CACHE_DATA] - before.class_misses[CACHE_DATA];
+  int used = after.ahead_hits - before.ahead_hits;
+  if (misses > SECTOR_CNT / 8)
+    fail ("%d of %d sectors missed in a sequential read", misses, SECTOR_CNT);
+  if (used < SECTOR_CNT * 3 / 4)
+    fail ("only %d of %d sectors read ahead in a sequential read",
+          used, SECTOR_CNT);
+  msg ("most sectors were read ahead");
+
+  /* Never start a read where the last one ended. */
+  random_init (0);
+  prev_end = FILE_SIZE;
+  CHECK (cachestat (&before), "cachestat");
+  for (i = 0; i < RANDOM_CNT; i++)
+    {
+      ofs = random_ulong () % SECTOR_CNT * SECTOR;
+      if (ofs == prev_end)
+        ofs = (ofs + 2 * SECTOR) % FILE_SIZE;
+      seek (fd, ofs);
+      if (read (fd, buf, SECTOR) != SECTOR
+          || buf[0] != (char) (ofs / CHUNK))
+        fail ("read \"stream\" at %zu", ofs);
+      prev_end = ofs + SECTOR;
+    }
+  CHECK (cachestat (&after), "cachestat");
+  msg ("read \"stream\" at random");
+
+  /* Allow for a window still being read when the scan ended. */
+  int loads = after.ahead_loads - before.ahead_loads;
+  if (loads > 16)
+    fail ("%d sectors read ahead for %d random reads", loads, RANDOM_CNT);
+  msg ("random reads were not read ahead");
+  close (fd);
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-stream) begin
+(cache-stream) create "stream"
+(cache-stream) open "stream"
+(cache-stream) write "stream"
+(cache-stream) cachestat
+(cache-stream) cachestat
+(cache-stream) read "stream" in sequence
+(cache-stream) most sectors were read ahead
+(cache-stream) cachestat
+(cache-stream) cachestat
+(cache-stream) read "stream" at random
+(cache-stream) random reads were not read ahead
+(cache-stream) end
+EOF
+pass;
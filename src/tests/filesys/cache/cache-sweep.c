@@ -0,0 +1,72 @@
+/* Sweeps the working set of file reads from well inside the buffer
+   cache to well past it.  For each size it writes a file, reads it
+   back PASSES times, and reports the cache's hit rate and the read
+   throughput over the passes, as kilobytes per timer tick.  Only the
+   smallest working set is required to stay in the cache; the rest is
+   for comparing cache sizes (see the -cache kernel option). */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHUNK 4096
+#define PASSES 3
+
+static const int sizes_kb[] = { 16, 64, 256, 1024 };
+static char buf[CHUNK];
+
+static void
+sweep (int size_kb)
+{
+  struct cachestat before, after;
+  char name[16];
+  int handle, chunks = size_kb * 1024 / CHUNK;
+  int pass, i, start, ticks;
+
+  snprintf (name, sizeof name, "ws-%d", size_kb);
+  if (!create (name, 0))
+    fail ("create \"%s\"", name);
+  if ((handle = open (name)) < 2)
+    fail ("open \"%s\"", name);
+  for (i = 0; i < chunks; i++)
+    {
+      memset (buf, i, CHUNK);
+      if (write (handle, buf, CHUNK) != CHUNK)
+        fail ("write \"%s\"", name);
+    }
+
+  if (!cachestat (&before))
+    fail ("cachestat");
+  start = uptime ();
+  for (pass = 0; pass < PASSES; pass++)
+    {
+      seek (handle, 0);
+      for (i = 0; i < chunks; i++)
+        if (read (handle, buf, CHUNK) != CHUNK || buf[CHUNK - 1] != (char) i)
+          fail ("read \"%s\" chunk %d", name, i);
+    }
+  ticks = uptime () - start;
+  if (!cachestat (&after))
+    fail ("cachestat");
+  close (handle);
+  remove (name);
+
+  int hits = after.hits - before.hits;
+  int lookups = hits + after.misses - before.misses;
+  msg ("%d KB: %d%% hits, %d KB/tick, cache %d of %d blocks",
+       size_kb, lookups > 0 ? hits * 100 / lookups : 0,
+       size_kb * PASSES / (ticks > 0 ? ticks : 1),
+       after.blocks, after.max_blocks);
+}
+
+void
+test_main (void)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof sizes_kb / sizeof *sizes_kb; i++)
+    sweep (sizes_kb[i]);
+  msg ("sweep done");
+}
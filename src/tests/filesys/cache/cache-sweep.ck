@@ -0,0 +1,29 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# Results vary from run to run: check them, then drop them before
+# comparing the rest.
+my (@rates) = ();
+foreach (@output) {
+    my ($kb, $rate) = /^\(cache-sweep\) (\d+) KB: (\d+)% hits, \d+ KB\/tick, cache \d+ of \d+ blocks$/
+      or next;
+    push (@rates, $rate);
+}
+fail "expected 4 working set sizes, got " . scalar (@rates) . "\n"
+  if @rates != 4;
+fail "smallest working set hit only $rates[0]% of the time\n"
+  if $rates[0] < 90;
+@output = grep (!/^\(cache-sweep\) \d+ KB: /, @output);
+
+compare_output ("run", (IGNORE_EXIT_CODES => 1), \@output, [<<'EOF']);
+(cache-sweep) begin
+(cache-sweep) sweep done
+(cache-sweep) end
+EOF
+pass;
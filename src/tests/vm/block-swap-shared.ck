@@ -0,0 +1,28 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+fail "swap is not on the file system's disk\n"
+  if !grep (/^swap: using hda\d*$/, @output);
+
+# The timing varies from run to run: check it is there, then drop
+# it before comparing the rest.
+fail "no timing\n"
+  if !grep (/^\(block-swap-shared\) ticks: \d+$/, @output);
+@output = grep (!/^\(block-swap-shared\) ticks: /, @output);
+
+compare_output ("run", (IGNORE_EXIT_CODES => 1), \@output, [<<'EOF']);
+(block-swap-shared) begin
+(block-swap-shared) create "swap-mix"
+(block-swap-shared) fork swapper
+(block-swap-shared) fork file writer
+(block-swap-shared) wait for swapper
+(block-swap-shared) wait for file writer
+(block-swap-shared) end
+EOF
+pass;
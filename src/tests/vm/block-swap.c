@@ -0,0 +1,115 @@
+/* Benchmark for swap and file system I/O at once.  One child caps
+   its resident set and sweeps over four times as many pages, so
+   that it keeps paging to and from swap, while another writes a
+   file and reads it back.  Reports the timer ticks from the first
+   fork until both children are done.
+
+   Built twice: block-swap runs it with swap on its own disk on the
+   secondary IDE channel (--swap-secondary), where the two streams
+   overlap, and block-swap-shared with swap on the same disk as the
+   file system, where they take turns.  Each check stands alone and
+   reports its own run's timing. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define HARD 64
+#define PAGE_CNT (HARD * 4)
+#define SWEEPS 3
+
+#define FILE_SIZE (256 * 1024)
+#define CHUNK 4096
+#define PASSES 2
+
+static const char file_name[] = "swap-mix";
+static char pages[PAGE_CNT * PAGE_SIZE];
+static char buf[CHUNK];
+
+/* Byte I of the file in pass PASS. */
+static char
+pattern (int pass, size_t i)
+{
+  return (i / CHUNK) * 3 + i % 11 + pass;
+}
+
+/* Sweeps over all of PAGES, checking what the previous sweep
+   left and leaving a new value.  Returns 0x42 if all was well. */
+static int
+swapper (void)
+{
+  size_t page;
+  int sweep;
+
+  if (!rsslimit (HARD / 2, HARD))
+    return 1;
+  for (sweep = 0; sweep < SWEEPS; sweep++)
+    for (page = 0; page < PAGE_CNT; page++)
+      {
+        char *p = &pages[page * PAGE_SIZE];
+        if (sweep > 0 && *p != (char) (page + sweep - 1))
+          return 2;
+        *p = page + sweep;
+      }
+  return 0x42;
+}
+
+/* Writes the file and reads it back, PASSES times.  Returns 0x42
+   if all was well. */
+static int
+filer (void)
+{
+  int pass;
+
+  for (pass = 0; pass < PASSES; pass++)
+    {
+      int handle = open (file_name);
+      size_t ofs, i;
+
+      if (handle < 2)
+        return 1;
+      for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK)
+        {
+          for (i = 0; i < CHUNK; i++)
+            buf[i] = pattern (pass, ofs + i);
+          if (write (handle, buf, CHUNK) != CHUNK)
+            return 2;
+        }
+      seek (handle, 0);
+      for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK)
+        {
+          if (read (handle, buf, CHUNK) != CHUNK)
+            return 3;
+          for (i = 0; i < CHUNK; i++)
+            if (buf[i] != pattern (pass, ofs + i))
+              return 4;
+        }
+      close (handle);
+    }
+  return 0x42;
+}
+
+void
+test_main (void)
+{
+  pid_t swap_child, file_child;
+  int start;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  start = uptime ();
+
+  swap_child = fork ();
+  if (swap_child == 0)
+    exit (swapper ());
+  CHECK (swap_child != -1, "fork swapper");
+
+  file_child = fork ();
+  if (file_child == 0)
+    exit (filer ());
+  CHECK (file_child != -1, "fork file writer");
+
+  CHECK (wait (swap_child) == 0x42, "wait for swapper");
+  CHECK (wait (file_child) == 0x42, "wait for file writer");
+  msg ("ticks: %d", uptime () - start);
+}
@@ -0,0 +1,34 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+fail "swap is not on the secondary channel\n"
+  if !grep (/^swap: using hdc\d*$/, @output);
+foreach my $disk ('hda', 'hdc') {
+    fail "no queue statistics for $disk\n"
+      if !grep (/^$disk: [1-9]\d* requests in [1-9]\d* dispatches /,
+		@output);
+}
+
+# The timing varies from run to run: find it, then drop it before
+# comparing the rest.
+my ($ticks) = map (/^\(block-swap\) ticks: (\d+)$/, @output);
+fail "no timing\n" if !defined $ticks;
+@output = grep (!/^\(block-swap\) ticks: /, @output);
+
+compare_output ("run", (IGNORE_EXIT_CODES => 1), \@output, [<<'EOF']);
+(block-swap) begin
+(block-swap) create "swap-mix"
+(block-swap) fork swapper
+(block-swap) fork file writer
+(block-swap) wait for swapper
+(block-swap) wait for file writer
+(block-swap) end
+EOF
+
+pass "$ticks ticks with swap on hdc\n";
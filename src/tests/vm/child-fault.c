@@ -0,0 +1,49 @@
+/* Child process of page-fault-par.
+   Faults in every page of a file that the parent wrote, mapped
+   read-only, so that each of those faults reads the disk.  Then,
+   with its resident set capped at HARD pages, writes a distinct
+   value into every page of an array four times that size and
+   checks them all, so that most of those faults wait on swap. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/vm/fault-data.h"
+
+#define HARD 32
+#define SIZE (HARD * 4 * PAGE_SIZE)
+static char buf[SIZE];
+
+int
+main (int argc UNUSED, char *argv[] UNUSED)
+{
+  char *map = (char *) 0x10000000;
+  size_t i;
+  int handle;
+
+  test_name = "child-fault";
+
+  /* Fault in every page of the file. */
+  handle = open (FAULT_DATA);
+  if (handle < 2)
+    fail ("open \"%s\"", FAULT_DATA);
+  if (mmap (handle, map) == MAP_FAILED)
+    fail ("mmap \"%s\"", FAULT_DATA);
+  for (i = 0; i < FAULT_DATA_SIZE; i += PAGE_SIZE)
+    if (map[i] != fault_data_byte (i / PAGE_SIZE))
+      fail ("file page %zu is %d", i / PAGE_SIZE, map[i]);
+
+  /* Fault in every page of BUF by writing to it, pushing most of
+     them out to swap. */
+  if (!rsslimit (HARD / 2, HARD))
+    fail ("rsslimit");
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    buf[i] = i / PAGE_SIZE;
+
+  /* Check that every page kept its own value. */
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    if (buf[i] != (char) (i / PAGE_SIZE))
+      fail ("page %zu corrupted", i / PAGE_SIZE);
+
+  return 0x42;
+}
@@ -0,0 +1,16 @@
+#ifndef TESTS_VM_FAULT_DATA
+#define TESTS_VM_FAULT_DATA 1
+
+/* The file that page-fault-par writes and each child-fault maps. */
+#define FAULT_DATA "fault-data"
+#define FAULT_DATA_SIZE (128 * 1024)
+#define PAGE_SIZE 4096
+
+/* Byte at the start of page PAGE of the file. */
+static inline char
+fault_data_byte (size_t page)
+{
+  return page * 3 + 1;
+}
+
+#endif /* tests/vm/fault-data.h */
@@ -0,0 +1,98 @@
+/* Gives madvise() advice on a memory mapping, prefaults it with
+   MADV_WILLNEED and checks that the data read back is intact.
+   Also checks that bad ranges are refused, and that the advice
+   cuts the page faults taken reading a larger mapping. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define DATA_PAGES 16
+#define DATA_SIZE (DATA_PAGES * 4096)
+
+static char buf[DATA_SIZE];
+
+/* Maps "madvise-data", gives it ADVICE and reads a byte from
+   each page in order.  Returns the page faults that took. */
+static int
+read_with_advice (int advice)
+{
+  char *data = (char *) 0x20000000;
+  struct memstat before, after;
+  int handle;
+  mapid_t map;
+  size_t i;
+
+  quiet = true;
+  CHECK ((handle = open ("madvise-data")) > 1, "open \"madvise-data\"");
+  CHECK ((map = mmap (handle, data)) != MAP_FAILED, "mmap \"madvise-data\"");
+  CHECK (madvise (data, DATA_SIZE, advice) == 0, "madvise");
+
+  CHECK (memstat (&before), "memstat");
+  for (i = 0; i < DATA_SIZE; i += 4096)
+    if (data[i] != buf[i])
+      fail ("byte %zu of \"madvise-data\" has value %02hhx (should be %02hhx)",
+            i, data[i], buf[i]);
+  CHECK (memstat (&after), "memstat");
+  quiet = false;
+
+  munmap (map);
+  close (handle);
+  return after.faults - before.faults;
+}
+
+void
+test_main (void)
+{
+  char *actual = (char *) 0x10000000;
+  int handle;
+  mapid_t map;
+  size_t i;
+  int random, sequential, willneed;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, actual)) != MAP_FAILED, "mmap \"sample.txt\"");
+  CHECK (madvise (actual, 4096, MADV_SEQUENTIAL) == 0, "madvise sequential");
+  CHECK (madvise (actual, 4096, MADV_WILLNEED) == 0, "madvise willneed");
+  CHECK (madvise (actual + 1, 4096, MADV_WILLNEED) == -1,
+         "madvise misaligned address");
+  CHECK (madvise (actual + 4096, 4096, MADV_WILLNEED) == -1,
+         "madvise unmapped range");
+
+  /* Check that data is correct. */
+  if (memcmp (actual, sample, strlen (sample)))
+    fail ("read of mmap'd file reported bad data");
+
+  /* Verify that data is followed by zeros. */
+  for (i = strlen (sample); i < 4096; i++)
+    if (actual[i] != 0)
+      fail ("byte %zu of mmap'd region has value %02hhx (should be 0)",
+            i, actual[i]);
+
+  munmap (map);
+  close (handle);
+
+  /* Now a mapping big enough for the advice to show. */
+  for (i = 0; i < DATA_SIZE; i++)
+    buf[i] = i / 4096 + 1;
+  CHECK (create ("madvise-data", DATA_SIZE), "create \"madvise-data\"");
+  CHECK ((handle = open ("madvise-data")) > 1, "open \"madvise-data\"");
+  CHECK (write (handle, buf, DATA_SIZE) == DATA_SIZE, "write \"madvise-data\"");
+  close (handle);
+
+  random = read_with_advice (MADV_RANDOM);
+  sequential = read_with_advice (MADV_SEQUENTIAL);
+  willneed = read_with_advice (MADV_WILLNEED);
+
+  if (random < DATA_PAGES)
+    fail ("%d faults reading %d pages with MADV_RANDOM", random, DATA_PAGES);
+  if (sequential >= random)
+    fail ("%d faults with MADV_SEQUENTIAL, no fewer than %d with MADV_RANDOM",
+          sequential, random);
+  if (willneed >= sequential)
+    fail ("%d faults with MADV_WILLNEED, no fewer than %d with "
+          "MADV_SEQUENTIAL", willneed, sequential);
+  msg ("fewer faults with MADV_SEQUENTIAL, fewer still with MADV_WILLNEED");
+}
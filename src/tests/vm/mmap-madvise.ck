@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-madvise) begin
+(mmap-madvise) open "sample.txt"
+(mmap-madvise) mmap "sample.txt"
+(mmap-madvise) madvise sequential
+(mmap-madvise) madvise willneed
+(mmap-madvise) madvise misaligned address
+(mmap-madvise) madvise unmapped range
+(mmap-madvise) create "madvise-data"
+(mmap-madvise) open "madvise-data"
+(mmap-madvise) write "madvise-data"
+(mmap-madvise) fewer faults with MADV_SEQUENTIAL, fewer still with MADV_WILLNEED
+(mmap-madvise) end
+EOF
+pass;
@@ -0,0 +1,80 @@
+/* Writes a pattern to a 64-page file through a mapping and syncs it
+   with msync(), then checks the file with read() while the mapping is
+   still in place.  Changes a single page and syncs only that page,
+   checks that msync() refuses ranges that are misaligned or not
+   mapped from a file, and finally unmaps and checks the file again. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *) 0x10000000)
+#define PAGE_SIZE 4096
+#define PAGE_CNT 64
+#define SIZE (PAGE_CNT * PAGE_SIZE)
+#define CHANGED 5
+
+static char buf[PAGE_SIZE];
+
+/* Byte I of the file as first written. */
+static char
+pattern (size_t i)
+{
+  return (i / PAGE_SIZE) * 7 + i % 251;
+}
+
+/* Reads the file in HANDLE back with read() and compares it, with
+   page CHANGED overwritten if CHANGED_YET. */
+static void
+verify_file (int handle, bool changed_yet, const char *what)
+{
+  size_t page, i;
+
+  seek (handle, 0);
+  for (page = 0; page < PAGE_CNT; page++)
+    {
+      if (read (handle, buf, PAGE_SIZE) != PAGE_SIZE)
+        fail ("short read of page %zu", page);
+      for (i = 0; i < PAGE_SIZE; i++)
+        {
+          char expected = (page == CHANGED && changed_yet
+                           ? 'x' : pattern (page * PAGE_SIZE + i));
+          if (buf[i] != expected)
+            fail ("%s: byte %zu of page %zu is %d, expected %d",
+                  what, i, page, buf[i], expected);
+        }
+    }
+  msg ("file matches after %s", what);
+}
+
+void
+test_main (void)
+{
+  int handle;
+  mapid_t map;
+  size_t i;
+
+  CHECK (create ("msync.dat", SIZE), "create \"msync.dat\"");
+  CHECK ((handle = open ("msync.dat")) > 1, "open \"msync.dat\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"msync.dat\"");
+
+  msg ("write %d pages", PAGE_CNT);
+  for (i = 0; i < SIZE; i++)
+    ACTUAL[i] = pattern (i);
+  CHECK (msync (ACTUAL, SIZE) == 0, "msync whole mapping");
+  verify_file (handle, false, "sync");
+
+  memset (ACTUAL + CHANGED * PAGE_SIZE, 'x', PAGE_SIZE);
+  CHECK (msync (ACTUAL + CHANGED * PAGE_SIZE, PAGE_SIZE) == 0,
+         "msync page %d", CHANGED);
+  verify_file (handle, true, "change");
+
+  CHECK (msync (ACTUAL + 1, PAGE_SIZE) == -1, "msync misaligned address");
+  CHECK (msync (ACTUAL, SIZE + PAGE_SIZE) == -1, "msync past the mapping");
+  CHECK (msync (buf, PAGE_SIZE) == -1, "msync data segment");
+
+  munmap (map);
+  verify_file (handle, true, "munmap");
+  close (handle);
+}
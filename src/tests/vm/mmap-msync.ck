@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+fail "whole-page runs were not written directly\n"
+  if !grep (/^Writeback: \d+ pages in \d+ writes, [1-9]\d* direct$/, @output);
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-msync) begin
+(mmap-msync) create "msync.dat"
+(mmap-msync) open "msync.dat"
+(mmap-msync) mmap "msync.dat"
+(mmap-msync) write 64 pages
+(mmap-msync) msync whole mapping
+(mmap-msync) file matches after sync
+(mmap-msync) msync page 5
+(mmap-msync) file matches after change
+(mmap-msync) msync misaligned address
+(mmap-msync) msync past the mapping
+(mmap-msync) msync data segment
+(mmap-msync) file matches after munmap
+(mmap-msync) end
+EOF
+pass;
@@ -0,0 +1,58 @@
+/* Maps a large file, writes a few scattered bytes through the
+   mapping, and checks after munmap that exactly those bytes reached
+   the file.  A mapping that large must also refuse overlapping maps
+   anywhere in its range. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (512 * 1024)
+#define ACTUAL ((char *) 0x10000000)
+
+static const size_t offsets[] = { 0, 4096 * 37 + 11, SIZE / 2, SIZE - 1 };
+#define OFFSET_CNT (sizeof offsets / sizeof *offsets)
+
+void
+test_main (void)
+{
+  static char buf[4096];
+  int handle, other;
+  mapid_t map;
+  size_t i, ofs;
+
+  CHECK (create ("big", SIZE), "create \"big\"");
+  CHECK ((handle = open ("big")) > 1, "open \"big\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"big\"");
+
+  CHECK ((other = open ("big")) > 1, "open \"big\" again");
+  CHECK (mmap (other, ACTUAL + SIZE - 4096) == MAP_FAILED,
+         "try to mmap over the last page");
+  CHECK (mmap (other, ACTUAL + SIZE / 2 + 4096) == MAP_FAILED,
+         "try to mmap over the middle");
+
+  msg ("write scattered bytes");
+  for (i = 0; i < OFFSET_CNT; i++)
+    ACTUAL[offsets[i]] = 'a' + i;
+  munmap (map);
+
+  msg ("verify file contents");
+  for (ofs = 0; ofs < SIZE; ofs += sizeof buf)
+    {
+      if (read (other, buf, sizeof buf) != (int) sizeof buf)
+        fail ("read \"big\" at %zu failed", ofs);
+      for (i = 0; i < OFFSET_CNT; i++)
+        if (offsets[i] >= ofs && offsets[i] < ofs + sizeof buf)
+          {
+            if (buf[offsets[i] - ofs] != (char) ('a' + i))
+              fail ("byte %zu not written back", offsets[i]);
+            buf[offsets[i] - ofs] = 0;
+          }
+      for (i = 0; i < sizeof buf; i++)
+        if (buf[i] != 0)
+          fail ("byte %zu changed", ofs + i);
+    }
+  close (other);
+  close (handle);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-sparse) begin
+(mmap-sparse) create "big"
+(mmap-sparse) open "big"
+(mmap-sparse) mmap "big"
+(mmap-sparse) open "big" again
+(mmap-sparse) try to mmap over the last page
+(mmap-sparse) try to mmap over the middle
+(mmap-sparse) write scattered bytes
+(mmap-sparse) verify file contents
+(mmap-sparse) end
+EOF
+pass;
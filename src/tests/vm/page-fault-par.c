@@ -0,0 +1,72 @@
+/* Benchmark for parallel page faults.  Runs CHILD_CNT child-fault
+   processes one at a time, then all at once.  Each child's faults
+   read a file mapped into memory and then go to and from swap, so
+   they wait on disk I/O.  Reports the timer ticks each run took:
+   if faults were serialized behind one another's I/O, running the
+   children at once would take about as long as running them one
+   after another. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/vm/fault-data.h"
+
+#define CHILD_CNT 8
+
+static char page[PAGE_SIZE];
+
+/* Writes the file that the children map. */
+static void
+write_data (void)
+{
+  size_t i;
+  int handle;
+
+  CHECK (create (FAULT_DATA, 0), "create \"%s\"", FAULT_DATA);
+  CHECK ((handle = open (FAULT_DATA)) > 1, "open \"%s\"", FAULT_DATA);
+  for (i = 0; i < FAULT_DATA_SIZE / PAGE_SIZE; i++)
+    {
+      memset (page, fault_data_byte (i), sizeof page);
+      if (write (handle, page, sizeof page) != sizeof page)
+        fail ("write \"%s\"", FAULT_DATA);
+    }
+  msg ("write \"%s\"", FAULT_DATA);
+  close (handle);
+}
+
+/* Runs the children, all at once if PARALLEL, otherwise each
+   waiting for the one before, and returns the ticks it took. */
+static int
+run (bool parallel)
+{
+  pid_t children[CHILD_CNT];
+  int start = uptime ();
+  int i;
+
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      if ((children[i] = exec ("child-fault")) == -1)
+        fail ("exec \"child-fault\"");
+      if (!parallel && wait (children[i]) != 0x42)
+        fail ("wait for child %d", i);
+    }
+  if (parallel)
+    for (i = 0; i < CHILD_CNT; i++)
+      if (wait (children[i]) != 0x42)
+        fail ("wait for child %d", i);
+  return uptime () - start;
+}
+
+void
+test_main (void)
+{
+  int serial, parallel;
+
+  write_data ();
+  serial = run (false);
+  msg ("ran %d children one at a time", CHILD_CNT);
+  parallel = run (true);
+  msg ("ran %d children at once", CHILD_CNT);
+  msg ("ticks: %d one at a time, %d at once", serial, parallel);
+}
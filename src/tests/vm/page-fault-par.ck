@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# Timings vary from run to run: check they are there, then drop
+# them before comparing the rest.
+fail "no timings\n"
+  if !grep (/^\(page-fault-par\) ticks: \d+ one at a time, \d+ at once$/,
+	    @output);
+@output = grep (!/^\(page-fault-par\) ticks: /, @output);
+
+compare_output ("run", (IGNORE_EXIT_CODES => 1), \@output, [<<'EOF']);
+(page-fault-par) begin
+(page-fault-par) create "fault-data"
+(page-fault-par) open "fault-data"
+(page-fault-par) write "fault-data"
+(page-fault-par) ran 8 children one at a time
+(page-fault-par) ran 8 children at once
+(page-fault-par) end
+EOF
+pass;
@@ -0,0 +1,57 @@
+/* Forks 8 children that share the parent's 256 kB array
+   copy-on-write.  Each child checks that it sees the parent's
+   data, then overwrites every page with its own value and checks
+   that again.  Afterward the parent checks that none of the
+   children's writes reached its own copy. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHILD_CNT 8
+#define SIZE (256 * 1024)
+#define PAGE_SIZE 4096
+static char buf[SIZE];
+
+/* Runs in child number ID: returns 0x42 if all went well. */
+static int
+child (int id)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    if (buf[i] != (char) (i / PAGE_SIZE))
+      return 1;
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    buf[i] = (char) (i / PAGE_SIZE + id + 1);
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    if (buf[i] != (char) (i / PAGE_SIZE + id + 1))
+      return 2;
+  return 0x42;
+}
+
+void
+test_main (void)
+{
+  pid_t children[CHILD_CNT];
+  size_t i;
+  int id;
+
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    buf[i] = (char) (i / PAGE_SIZE);
+
+  for (id = 0; id < CHILD_CNT; id++)
+    {
+      children[id] = fork ();
+      if (children[id] == 0)
+        exit (child (id));
+      CHECK (children[id] != -1, "fork child %d", id);
+    }
+
+  for (id = 0; id < CHILD_CNT; id++)
+    CHECK (wait (children[id]) == 0x42, "wait for child %d", id);
+
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    if (buf[i] != (char) (i / PAGE_SIZE))
+      fail ("parent's page %zu changed by a child", i / PAGE_SIZE);
+}
@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-fork-cow) begin
+(page-fork-cow) fork child 0
+(page-fork-cow) fork child 1
+(page-fork-cow) fork child 2
+(page-fork-cow) fork child 3
+(page-fork-cow) fork child 4
+(page-fork-cow) fork child 5
+(page-fork-cow) fork child 6
+(page-fork-cow) fork child 7
+(page-fork-cow) wait for child 0
+(page-fork-cow) wait for child 1
+(page-fork-cow) wait for child 2
+(page-fork-cow) wait for child 3
+(page-fork-cow) wait for child 4
+(page-fork-cow) wait for child 5
+(page-fork-cow) wait for child 6
+(page-fork-cow) wait for child 7
+(page-fork-cow) end
+EOF
+pass;
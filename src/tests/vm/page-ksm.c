@@ -0,0 +1,77 @@
+/* Forks 4 children that each rewrite their copy of a 128 kB array
+   with the same bytes, giving every child private frames with
+   identical contents for the KSM scanner to merge.  The children
+   keep checking their data across several scans.  Then child 0
+   writes values of its own, which must split its pages from the
+   merged ones, while the others check theirs are unchanged before
+   writing their own values too. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHILD_CNT 4
+#define SIZE (128 * 1024)
+#define PAGE_SIZE 4096
+
+/* Timer ticks, since the parent started forking, that the children
+   hold identical data for: three KSM scan periods at 100 Hz.  The
+   others write SPLIT_TICKS after child 0. */
+#define MERGE_TICKS 300
+#define SPLIT_TICKS 100
+
+static char buf[SIZE];
+static int start;
+
+/* Returns true if every page of buf holds its number plus DELTA. */
+static bool
+check (int delta)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    if (buf[i] != (char) (i / PAGE_SIZE + delta))
+      return false;
+  return true;
+}
+
+/* Runs in child number ID: returns 0x42 if all went well. */
+static int
+child (int id)
+{
+  int split = start + MERGE_TICKS + (id > 0 ? SPLIT_TICKS : 0);
+  size_t i;
+
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    buf[i] = (char) (i / PAGE_SIZE);
+  while (uptime () < split)
+    if (!check (0))
+      return 1;
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    buf[i] = (char) (i / PAGE_SIZE + id + 1);
+  if (!check (id + 1))
+    return 2;
+  while (uptime () < start + MERGE_TICKS + SPLIT_TICKS)
+    if (!check (id + 1))
+      return 3;
+  return 0x42;
+}
+
+void
+test_main (void)
+{
+  pid_t children[CHILD_CNT];
+  int id;
+
+  start = uptime ();
+  for (id = 0; id < CHILD_CNT; id++)
+    {
+      children[id] = fork ();
+      if (children[id] == 0)
+        exit (child (id));
+      CHECK (children[id] != -1, "fork child %d", id);
+    }
+
+  for (id = 0; id < CHILD_CNT; id++)
+    CHECK (wait (children[id]) == 0x42, "wait for child %d", id);
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+fail "the KSM scanner merged no pages\n"
+  if !grep (/^KSM: [1-9]\d* pages merged, /, @output);
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-ksm) begin
+(page-ksm) fork child 0
+(page-ksm) fork child 1
+(page-ksm) fork child 2
+(page-ksm) fork child 3
+(page-ksm) wait for child 0
+(page-ksm) wait for child 1
+(page-ksm) wait for child 2
+(page-ksm) wait for child 3
+(page-ksm) end
+EOF
+pass;
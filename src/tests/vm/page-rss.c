@@ -0,0 +1,52 @@
+/* Caps the resident set at HARD pages, then writes to four times as
+   many pages and reads them all back.  The process must never hold
+   more than HARD frames, so it keeps evicting its own pages to swap
+   even though memory has room to spare, and memstat() must show the
+   pages in swap and the faults that brought them back. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define SOFT 64
+#define HARD 128
+#define PAGE_CNT (HARD * 4)
+
+static char buf[PAGE_CNT * PAGE_SIZE];
+
+void
+test_main (void)
+{
+  struct memstat ms;
+  size_t page;
+
+  CHECK (!rsslimit (-1, 0), "reject negative limit");
+  CHECK (!rsslimit (HARD, SOFT), "reject soft limit above hard limit");
+  CHECK (rsslimit (SOFT, HARD), "limit resident set to %d pages", HARD);
+
+  msg ("write %d pages", PAGE_CNT);
+  for (page = 0; page < PAGE_CNT; page++)
+    buf[page * PAGE_SIZE] = page;
+
+  msg ("read them back");
+  for (page = 0; page < PAGE_CNT; page++)
+    if (buf[page * PAGE_SIZE] != (char) page)
+      fail ("page %zu is %d, expected %d", page, buf[page * PAGE_SIZE],
+            (char) page);
+
+  CHECK (memstat (&ms), "memstat");
+  if (ms.soft_limit != SOFT || ms.hard_limit != HARD)
+    fail ("limits are %d and %d, expected %d and %d",
+          ms.soft_limit, ms.hard_limit, SOFT, HARD);
+  if (ms.resident > HARD)
+    fail ("%d pages resident, limit is %d", ms.resident, HARD);
+  if (ms.swapped < PAGE_CNT - HARD)
+    fail ("%d pages in swap, expected at least %d", ms.swapped,
+          PAGE_CNT - HARD);
+  /* Swap read-ahead turns some of the faults reading back into
+     minor ones, but none of them goes away. */
+  if (ms.faults < PAGE_CNT * 2 - HARD || ms.major_faults == 0)
+    fail ("%d faults, %d major: too few", ms.faults, ms.major_faults);
+  msg ("resident set stayed within its limit");
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-rss) begin
+(page-rss) reject negative limit
+(page-rss) reject soft limit above hard limit
+(page-rss) limit resident set to 128 pages
+(page-rss) write 512 pages
+(page-rss) read them back
+(page-rss) memstat
+(page-rss) resident set stayed within its limit
+(page-rss) end
+EOF
+pass;
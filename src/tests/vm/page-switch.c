@@ -0,0 +1,53 @@
+/* Reads back a file several times larger than the buffer cache, so
+   nearly every block read waits on the disk and the CPU switches
+   from this process to the idle thread and back, twice per block.
+   Kernel threads borrow the process's address space, so neither
+   switch should reload CR3 or flush the TLB.
+
+   The "cycles per context switch" lines that the kernel prints at
+   shutdown are the benchmark, and the "CR3 loads" count on the
+   "TLB:" line shows how many switches still paid a flush. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (256 * 1024)
+#define ROUNDS 4
+
+static char buf[4096];
+
+void
+test_main (void)
+{
+  int handle, round;
+  size_t ofs, i;
+
+  CHECK (create ("big", SIZE), "create \"big\"");
+  CHECK ((handle = open ("big")) > 1, "open \"big\"");
+
+  msg ("write \"big\"");
+  for (ofs = 0; ofs < SIZE; ofs += sizeof buf)
+    {
+      memset (buf, ofs / sizeof buf, sizeof buf);
+      if (write (handle, buf, sizeof buf) != (int) sizeof buf)
+        fail ("write at offset %zu failed", ofs);
+    }
+
+  msg ("read \"big\" %d times", ROUNDS);
+  for (round = 0; round < ROUNDS; round++)
+    {
+      seek (handle, 0);
+      for (ofs = 0; ofs < SIZE; ofs += sizeof buf)
+        {
+          if (read (handle, buf, sizeof buf) != (int) sizeof buf)
+            fail ("read at offset %zu failed", ofs);
+          for (i = 0; i < sizeof buf; i++)
+            if (buf[i] != (char) (ofs / sizeof buf))
+              fail ("byte %zu is %d, expected %d", ofs + i, buf[i],
+                    (char) (ofs / sizeof buf));
+        }
+    }
+  close (handle);
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+fail "switch cycles not reported\n"
+  if !grep (/^CPU\d+: \d+ cycles per context switch/, @output);
+
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-switch) begin
+(page-switch) create "big"
+(page-switch) open "big"
+(page-switch) write "big"
+(page-switch) read "big" 4 times
+(page-switch) end
+EOF
+pass;
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+fail "no huge page was mapped\n" if !grep (/^Huge pages: [1-9]/, @output);
+
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-tlb-huge) begin
+(page-tlb-huge) initialize
+(page-tlb-huge) sweep columns
+(page-tlb-huge) end
+EOF
+pass;
@@ -0,0 +1,45 @@
+/* Sweeps a 12 MB array column by column, touching a different
+   page on every access, so nearly every access needs a fresh TLB
+   entry when the array is mapped with 4 kB pages.
+
+   Built twice: page-tlb runs it with 4 kB pages only and
+   page-tlb-huge with huge pages enabled (-huge).  Comparing the
+   "Timer:" ticks and page fault counts that the two runs print at
+   shutdown shows what huge pages buy. */
+
+#include <stdint.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT (12 * 1024 * 1024 / PAGE_SIZE)
+#define STRIDE 64
+#define ROUNDS 4
+
+static uint8_t buf[PAGE_CNT * PAGE_SIZE];
+
+static uint8_t
+expected (size_t page, size_t ofs)
+{
+  return (page * 7 + ofs / STRIDE) & 0xff;
+}
+
+void
+test_main (void)
+{
+  size_t page, ofs;
+  int round;
+
+  msg ("initialize");
+  for (page = 0; page < PAGE_CNT; page++)
+    for (ofs = 0; ofs < PAGE_SIZE; ofs += STRIDE)
+      buf[page * PAGE_SIZE + ofs] = expected (page, ofs);
+
+  msg ("sweep columns");
+  for (round = 0; round < ROUNDS; round++)
+    for (ofs = 0; ofs < PAGE_SIZE; ofs += STRIDE)
+      for (page = 0; page < PAGE_CNT; page++)
+        if (buf[page * PAGE_SIZE + ofs] != expected (page, ofs))
+          fail ("byte %zu of page %zu is %d, expected %d", ofs, page,
+                buf[page * PAGE_SIZE + ofs], expected (page, ofs));
+}
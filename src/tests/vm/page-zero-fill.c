@@ -0,0 +1,33 @@
+/* Reads every page of a 4 MB zero-filled array, which should all
+   map the one shared page of zeros, then writes a few pages of it
+   and checks that only those changed. */
+
+#include <string.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (4 * 1024 * 1024)
+#define PAGE_SIZE 4096
+#define STRIDE (64 * PAGE_SIZE)
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    if (buf[i] != 0)
+      fail ("byte %zu is %d before any write", i, buf[i]);
+  msg ("read zero pages");
+
+  for (i = 0; i < SIZE; i += STRIDE)
+    memset (buf + i, (char) (i / STRIDE + 1), PAGE_SIZE);
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    {
+      char expected = i % STRIDE == 0 ? (char) (i / STRIDE + 1) : 0;
+      if (buf[i] != expected || buf[i + PAGE_SIZE - 1] != expected)
+        fail ("page at %zu is %d, expected %d", i, buf[i], expected);
+    }
+  msg ("wrote every 64th page");
+}
@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-zero-fill) begin
+(page-zero-fill) read zero pages
+(page-zero-fill) wrote every 64th page
+(page-zero-fill) end
+EOF
+pass;
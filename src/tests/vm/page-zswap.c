@@ -0,0 +1,42 @@
+/* Fills 5 MB of memory, more than fits in RAM, with pages that
+   compress well, each one different from the others, then checks
+   every page twice.  Evicted pages go to the compressed swap tier
+   and, once that fills, on to the swap disk. */
+
+#include <string.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (5 * 1024 * 1024)
+#define PAGE_SIZE 4096
+
+static char buf[SIZE];
+
+/* Byte I of page PAGE: a short repeating pattern tagged with the
+   page number. */
+static char
+expected (size_t page, size_t i)
+{
+  return i % 16 < 4 ? (char) (page >> (i % 4 * 8)) : (char) (i % 16);
+}
+
+void
+test_main (void)
+{
+  size_t page, i;
+  int pass;
+
+  msg ("initialize");
+  for (page = 0; page < SIZE / PAGE_SIZE; page++)
+    for (i = 0; i < PAGE_SIZE; i++)
+      buf[page * PAGE_SIZE + i] = expected (page, i);
+
+  for (pass = 0; pass < 2; pass++)
+    {
+      msg ("read pass %d", pass + 1);
+      for (page = 0; page < SIZE / PAGE_SIZE; page++)
+        for (i = 0; i < PAGE_SIZE; i++)
+          if (buf[page * PAGE_SIZE + i] != expected (page, i))
+            fail ("byte %zu of page %zu is wrong", i, page);
+    }
+}
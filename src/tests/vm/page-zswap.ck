@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+fail "no pages were stored in the compressed swap tier\n"
+  if !grep (/^Zswap: [1-9]\d* pages stored, /, @output);
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-zswap) begin
+(page-zswap) initialize
+(page-zswap) read pass 1
+(page-zswap) read pass 2
+(page-zswap) end
+EOF
+pass;
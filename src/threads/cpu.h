@@ -33,7 +33,13 @@ struct cpu
   uint64_t user_ticks;
   uint64_t kernel_ticks;
   uint64_t cs;          /* Number of context switches */
+  uint64_t cs_cycles;   /* Cycles spent in them */
+  uint64_t cs_start;    /* Time stamp of the switch under way, or 0 */
   
+  /* Page directory loaded in CR3, whose entries the TLB may
+     hold.  Owned by userprog/pagedir.c */
+  uint32_t *pd;
+
   /* Ready queue. Owned by scheduler.c */
   struct ready_queue rq;
 
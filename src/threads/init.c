@@ -47,6 +47,8 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/iosched.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -71,6 +73,11 @@ static const char *swap_bdev_name;
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+#ifdef VM
+/* -ksm: Merge identical anonymous pages in the background? */
+static bool enable_ksm;
+#endif
+
 static void bss_init (void);
 static void paging_init (void);
 static void pci_zone_init (void);
@@ -162,6 +169,10 @@ main (void)
 #endif
   frame_init();
   swap_init();
+#ifdef VM
+  if (enable_ksm)
+    ksm_start ();
+#endif
   
   /* start other processors */
   unsigned num_started = start_other_cpus ();
@@ -222,6 +233,7 @@ paging_init (void)
   pci_zone_init ();
   lapic_zone_init ();
   lcr3 (vtop (init_page_dir));
+  lcr4 (rcr4 () | CR4_PSE);
 }
 
 /* initialize PCI zone at PCI_ADDR_ZONE_BEGIN - PCI_ADDR_ZONE_END*/
@@ -272,6 +284,7 @@ ap_main (void)
 {
   /* Initialize kernel page directory (shared among CPUs). */
   lcr3 (vtop (init_page_dir));
+  lcr4 (rcr4 () | CR4_PSE);
 
   /* Initialize this CPU's LAPIC. */
   lapic_init ();
@@ -430,6 +443,15 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-cache"))
+        cache_size = atoi (value);
+      else if (!strcmp (name, "-iosched"))
+        {
+          if (value == NULL || !iosched_select (value))
+            PANIC ("unknown I/O scheduler `%s'", value != NULL ? value : "");
+        }
+      else if (!strcmp (name, "-nodma"))
+        ide_dma = false;
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -440,6 +462,12 @@ parse_options (char **argv)
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-ksm"))
+        enable_ksm = true;
+      else if (!strcmp (name, "-huge"))
+        huge_pages = true;
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -556,6 +584,10 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -cache=COUNT       Start the buffer cache with COUNT sectors.\n"
+          "  -iosched=NAME      Schedule disk requests with NAME: deadline\n"
+          "                     (the default) or clook.\n"
+          "  -nodma             Move IDE disk data by PIO instead of DMA.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -563,6 +595,10 @@ usage (void)
           "  -rs=SEED           Set random number seed to SEED.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -ksm               Merge identical user pages in the background.\n"
+          "  -huge              Map large anonymous regions with 4 MB pages.\n"
 #endif
           );
   shutdown_power_off ();
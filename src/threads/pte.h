@@ -78,8 +78,16 @@ static inline uintptr_t pd_no (const void *va) {
 #define PTE_CD (1 << 4)         /* 1=cache disabled, 0=cache enabled. */
 #define PTE_A 0x20              /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40              /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS (1 << 7)         /* 1=4 MB page (PDEs only, needs CR4_PSE). */
 #define PTE_G (1 << 8)          /* 1=global page, do not flush */
 
+/* A PDE with PTE_PS set maps a whole 4 MB "huge page" itself,
+   4 MB aligned both virtually and physically, instead of
+   pointing to a page table. */
+#define HUGE_PAGE_SIZE (1u << PDSHIFT)            /* Bytes in a huge page. */
+#define HUGE_PAGE_PAGES (1u << PTBITS)            /* Pages in a huge page. */
+#define PDE_HUGE_ADDR (~(HUGE_PAGE_SIZE - 1))     /* Address bits (22:31). */
+
 /* Returns a PDE that points to page table PT. */
 static inline uint32_t pde_create_user (uint32_t *pt) {
   ASSERT (pg_ofs (pt) == 0);
@@ -92,10 +100,18 @@ static inline uint32_t pde_create_kernel (uint32_t *pt) {
   return vtop (pt) | PTE_P | PTE_W | PTE_G;
 }
 
+/* Returns a PDE that maps the huge page at PAGE, usable by both
+   user and kernel code and writable if WRITABLE. */
+static inline uint32_t pde_create_huge (void *page, bool writable) {
+  ASSERT (vtop (page) % HUGE_PAGE_SIZE == 0);
+  return vtop (page) | PTE_PS | PTE_P | (writable ? PTE_W : 0) | PTE_U;
+}
+
 /* Returns a pointer to the page table that page directory entry
    PDE, which must "present", points to. */
 static inline uint32_t *pde_get_pt (uint32_t pde) {
   ASSERT (pde & PTE_P);
+  ASSERT (!(pde & PTE_PS));
   return ptov (pde & PTE_ADDR);
 }
 
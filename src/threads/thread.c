@@ -164,6 +164,9 @@ thread_print_stats (void)
       printf (
           "CPU%d: %llu idle ticks, %llu kernel ticks, %llu user ticks, %llu context switches\n",
           c->id, c->idle_ticks, c->kernel_ticks, c->user_ticks, c->cs);
+      if (c->cs > 0)
+        printf ("CPU%d: %llu cycles per context switch\n",
+                c->id, c->cs_cycles / c->cs);
     }
 }
 
@@ -273,8 +276,10 @@ thread_create (const char *name, int nice, thread_func *function, void *aux)
   /* Must save tid here - 't' could already be freed when we return 
      from wake_up_new_thread */ 
   tid_t tid = t->tid;
-  hash_init(&t->spt, page_hash, is_page_before, NULL);
+  spt_init(&t->spt);
+  vma_tree_init(&t->vmas);
   lock_init(&t->spt_lock);
+  swap_ra_init(&t->swap_ra);
   /* init mmap */
   list_init (&t->mmap_list);
   t->num_mapped = 0;
@@ -673,6 +678,7 @@ void
 thread_schedule_tail (struct thread *prev)
 {
   struct thread *cur = running_thread ();
+  struct cpu *c = get_cpu ();
 
   ASSERT(intr_get_level () == INTR_OFF);
 
@@ -684,6 +690,13 @@ thread_schedule_tail (struct thread *prev)
   process_activate ();
 #endif
 
+  /* The switch is done once the new address space is in place. */
+  if (c->cs_start != 0)
+    {
+      c->cs_cycles += rdtsc () - c->cs_start;
+      c->cs_start = 0;
+    }
+
   /* If the thread we switched from is dying, destroy its struct
      thread.  This must happen late so that thread_exit() doesn't
      pull out the rug under itself.  (We don't free
@@ -722,6 +735,7 @@ schedule (void)
   if (cur != next)
     {
       get_cpu ()->cs++;
+      get_cpu ()->cs_start = rdtsc ();
       get_cpu ()->rq.curr = next == get_cpu ()->rq.idle_thread ? NULL : next;
       prev = switch_threads (cur, next);
     }
@@ -8,6 +8,7 @@
 #include "threads/synch.h"
 #include "lib/kernel/hash.h"
 #include "vm/page.h"
+#include "vm/swap.h"
 /* States in a thread's life cycle. */
 enum thread_status
 {
@@ -139,12 +140,15 @@ struct thread
 #endif
 
    /* Virtual Memory */
-   struct hash spt;             /* Supplemental Page Table. */
+   struct spt spt;              /* Supplemental Page Table. */
+   struct vma_tree vmas;        /* Segments and mappings, paged in lazily. */
    struct lock spt_lock;        /* Lock for inserting/removing pages from the spt. */
+   struct rss rss;              /* Resident set size, limits and fault counts. */
+   struct swap_ra swap_ra;      /* Swap readahead window, sized by this process's hits. */
    size_t num_stack_pages;      /* The total number of stack pages in the thread. Starts at 1 but can grow to 2048. */
 
    struct list mmap_list;       /* List of mmapped files. */
-   size_t num_mapped;           /* Number of mmapped files, serves as fd to be handed to user. */
+   size_t num_mapped;           /* Last mmap ID handed to the user. */
 
    struct dir *cwd;             /* Current working directory. */
 
@@ -175,7 +179,7 @@ struct process {
 struct mapped_item
 {
    mapid_t id;              /* mmap ID. */
-   struct spt_entry* page;  /* Page table entry of mmapped file. */
+   struct vma *vma;         /* Area the file is mapped over. */
    struct list_elem elem;   /* List_elem for the parent's mmap_list. */
 };
 
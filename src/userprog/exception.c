@@ -18,6 +18,10 @@ static long long page_fault_cnt;
 
 static void kill(struct intr_frame *);
 static void page_fault(struct intr_frame *);
+static void fault_around(struct spt_entry *);
+
+/* Most neighbouring file pages mapped along with a faulting one. */
+#define FAULT_AROUND_PAGES 16
 /* Registers handlers for interrupts that can be caused by user
    programs.
 
@@ -152,10 +156,14 @@ page_fault(struct intr_frame *f)
    {
       goto exit;
    }
-   /* Pointer is good so get the page with it */
-   lock_frame();
+   t->rss.faults++;
+   /* Pointer is good so get the page with it.
+      No frame table lock is held here: find_frame() only takes it
+      for the scan, so faults on other CPUs proceed in parallel and
+      the disk I/O below happens with just the new frame pinned. */
+retry:
    lock_acquire(&t->spt_lock);
-   struct spt_entry *page = get_page_from_hash(fault_addr);
+   struct spt_entry *page = get_page_from_spt(fault_addr);
    lock_release(&t->spt_lock);
 
    if (page == NULL) /* Page not found */
@@ -164,36 +172,66 @@ page_fault(struct intr_frame *f)
       /* if its not in stack range */
       if (((PHYS_BASE - pg_round_down(fault_addr)) <= (1<<23) && fault_addr >= (f->esp - 32)))
       {
-         load_extra_stack_page(fault_addr);
-         unlock_frame();
+         load_extra_stack_page(fault_addr, (f->error_code & PF_W) != 0);
       }
       else
       {
-         unlock_frame();
          thread_exit(-1);
       }
       return;
    }
+   if (page->page_status == 4) /* read ahead into the swap cache */
+   {
+      load_swap_to_spt(page);
+      return;
+   }
+   struct frame *frame = page->frame;
+   if (frame != NULL && pagedir_get_page(t->pagedir, fault_addr) == NULL)
+   {
+      /* Still attached to a frame but unmapped: another CPU is writing
+         this page out.  Wait for it, then fault it back in from
+         wherever it went. */
+      lock_acquire(&frame->lock);
+      lock_release(&frame->lock);
+      goto retry;
+   }
+   if (page->page_status == 2 && frame_map_huge(page)) /* whole huge page */
+      return;
+   if (page->page_status == 5
+       || (page->page_status == 2 && page->bytes_read == 0)) /* never written */
+   {
+      if ((f->error_code & PF_W) != 0 && !page->writable)
+         thread_exit(-1);
+      load_zero_page(page, (f->error_code & PF_W) != 0);
+      return;
+   }
+   if ((f->error_code & PF_P) != 0 && (f->error_code & PF_W) != 0
+       && page->writable && page->page_status == 3)
+   {
+      /* Write to a page still shared copy-on-write since a fork. */
+      load_cow_copy(page);
+      return;
+   }
    if (page->page_status == 2) /* in filesys */
    {
+      t->rss.major_faults++;
       load_file_to_spt(page);
-      unlock_frame();
+      fault_around(page);
       return;
    }
    if (page->page_status == 1) /* in swap table */
    {
+      t->rss.major_faults++;
       load_swap_to_spt(page);
-      unlock_frame();
       return;
    }
    if (page->page_status == 0) /* mmapped file */
    {
+      t->rss.major_faults++;
       load_mmap_to_spt(page);
-      unlock_frame();
       return;
    }
 
-   unlock_frame();
    if (pagedir_get_page(t->pagedir, fault_addr) == NULL)
    {
       goto exit;
@@ -212,16 +250,14 @@ exit:
 }
 
 void load_swap_to_spt(struct spt_entry *page) {
+    if (page->page_status == 4 && swap_cache_map(page))
+        return;
+
     page->pinned = true;
-    page->frame = find_frame(page);
-    
-    if (page->frame == NULL) {
-        unlock_frame();
-        thread_exit(-1);
-    }
+    struct frame *new_frame = find_frame(page);
 
-    if ( !install_page(page->vaddr, page->frame->paddr, page->writable)) {
-        unlock_frame();
+    if ( !install_page(page->vaddr, new_frame->paddr, page->writable)) {
+        frame_unpin(new_frame);
         thread_exit(-1);
     }
 
@@ -230,121 +266,244 @@ void load_swap_to_spt(struct spt_entry *page) {
     page->page_status = 3;
     
     page->pinned = false;
+    frame_unpin(new_frame);
 }
 
 void load_mmap_to_spt(struct spt_entry *page) {
     page->pinned = true;
     struct frame * new_frame = find_frame(page);
 
-    if ( new_frame == NULL ) {
-        unlock_frame();
-        thread_exit(-1);
-    }
-
-    file_seek(page->file, page->offset);
-    if (file_read(page->file, new_frame, page->bytes_read) != (int) page->bytes_read ) {
-        palloc_free_page(new_frame->page);
-        unlock_frame();
+    if (file_read_at(page->file, new_frame->paddr, page->bytes_read, page->offset) != (int) page->bytes_read ) {
+        frame_unpin(new_frame);
         thread_exit(-1);
     }
-    memset(new_frame + page->bytes_read, 0, page->bytes_zero);
+    memset(new_frame->paddr + page->bytes_read, 0, page->bytes_zero);
 
     if (!install_page(page->vaddr, new_frame->paddr, page->writable)) {
-        unlock_frame();
+        frame_unpin(new_frame);
         thread_exit(-1);
     }
 
     page->page_status = 3;
     page->pinned = false;
+    frame_unpin(new_frame);
 }
 
 /*
-   loads a file into the spt by reading the files data into a frame's paddr
+   loads a file into the spt by reading the files data into a frame's paddr.
+   The read happens with only the new frame pinned, no global lock held.
 */
 void load_file_to_spt(struct spt_entry *page)
 {
+   if (page->bytes_read == 0)
+   {
+      load_zero_page(page, page->writable);
+      return;
+   }
+
+   /* Read-only file pages are shared with whoever has the same bytes
+      of the same file in a frame already. */
+   bool shareable = !page->writable;
+   if (shareable && frame_map_shared(page))
+      return;
+
    page->pinned = true;
    struct frame *new_frame = find_frame(page);
 
-   if (new_frame == NULL)
+   if (!install_page(page->vaddr, new_frame->paddr, page->writable))
+   {
+      frame_unpin(new_frame);
+      thread_exit(-1);
+   }
+   
+   if (file_read_at(page->file, new_frame->paddr, page->bytes_read, page->offset) != (int)page->bytes_read)
    {
-      unlock_frame();
+      frame_unpin(new_frame);
       thread_exit(-1);
+   }
+   /* memset the kpage + bytes read */
+   memset(new_frame->paddr + page->bytes_read, 0, page->bytes_zero); /* make sure page has memory correct range */
+   if (shareable)
+      frame_publish(new_frame, page);
+
+   page->page_status = 3; /* in frame table */
+   page->pinned = false;
+   frame_unpin(new_frame);
+}
+
+/*
+   Faults in PAGE, a stack or BSS page that has never been written.
+   Reads map the shared zero page, so a sparse array or a deep but
+   untouched stack costs no frames; a WRITE gets a private frame,
+   zeroed ahead of time by the zero daemon where possible.
+*/
+void load_zero_page(struct spt_entry *page, bool write)
+{
+   if (!write)
+   {
+      if (page->page_status != 5 && !frame_map_zero(page))
+         thread_exit(-1);
       return;
    }
+   if (page->page_status == 5)
+      pagedir_clear_page(page->pagedir, page->vaddr);
 
+   page->pinned = true;
+   struct frame *new_frame = find_zeroed_frame(page);
    if (!install_page(page->vaddr, new_frame->paddr, page->writable))
    {
-      unlock_frame();
+      frame_unpin(new_frame);
       thread_exit(-1);
    }
-   
-   if (page->bytes_read != 0)
+   page->page_status = 3;
+   page->pinned = false;
+   frame_unpin(new_frame);
+}
+
+/*
+   Gives PAGE, which is shared copy-on-write and was just written to,
+   a private writable frame of its own.  The last page left on a frame
+   just gets write access back.
+*/
+void load_cow_copy(struct spt_entry *page)
+{
+   struct frame *old = page->frame;
+   if (old == NULL)
+      return; /* Evicted meanwhile; the retried access faults it in. */
+
+   lock_acquire(&old->lock);
+   if (page->frame != old)
    {
-      file_seek(page->file, page->offset);
-      if (file_read(page->file, new_frame->paddr, page->bytes_read) != (int)page->bytes_read)
-      {
-         unlock_frame();
-         palloc_free_page(new_frame->page);
-         thread_exit(-1);
-      }
-      /* memset the kpage + bytes read */
+      lock_release(&old->lock);
+      return;
+   }
+   if (old->share_cnt == 1)
+   {
+      pagedir_set_writable(page->pagedir, page->vaddr, true);
+      lock_release(&old->lock);
+      return;
+   }
 
-      /* TODO: */
-      memset(new_frame->paddr + page->bytes_read, 0, page->bytes_zero); /* make sure page has memory correct range */
+   /* Copy out before letting go of the old frame, so that finding the
+      new one never happens under another frame's lock. */
+   void *copy = palloc_get_page(0);
+   if (copy == NULL)
+   {
+      lock_release(&old->lock);
+      thread_exit(-1);
    }
+   memcpy(copy, old->paddr, PGSIZE);
+   pagedir_clear_page(page->pagedir, page->vaddr);
+   frame_remove_sharer(old, page);
+   lock_release(&old->lock);
 
-   page->page_status = 3; /* in frame table */
+   page->pinned = true;
+   struct frame *new_frame = find_frame(page);
+   memcpy(new_frame->paddr, copy, PGSIZE);
+   palloc_free_page(copy);
+   if (!install_page(page->vaddr, new_frame->paddr, true))
+   {
+      frame_unpin(new_frame);
+      thread_exit(-1);
+   }
    page->pinned = false;
+   frame_unpin(new_frame);
 }
 
 /*
-   Creates a new page to put into the spt and a frame for a stack frame
+   Maps the not-yet-loaded file pages around PAGE, which was just faulted
+   in, whose data is already in the buffer cache: they cost a copy now
+   instead of a fault and a filesystem call each later. The window is
+   the FAULT_AROUND_PAGES-aligned block holding PAGE. Pages advised
+   MADV_SEQUENTIAL map the window ahead of the fault instead, cached or
+   not; MADV_RANDOM turns fault-around off.
 */
-void load_extra_stack_page(void *fault_addr)
+static void fault_around(struct spt_entry *page)
+{
+   struct thread *t = thread_current();
+   uint8_t *start, *end;
+
+   if (page->advice == MADV_RANDOM)
+      return;
+   if (page->advice == MADV_SEQUENTIAL)
+      start = (uint8_t *)page->vaddr + PGSIZE;
+   else
+      start = (uint8_t *)((uintptr_t)page->vaddr & ~(FAULT_AROUND_PAGES * PGSIZE - 1));
+   end = start + FAULT_AROUND_PAGES * PGSIZE;
+
+   for (uint8_t *va = start; va < end && is_user_vaddr(va); va += PGSIZE)
+   {
+      lock_acquire(&t->spt_lock);
+      struct spt_entry *n = get_page_from_spt(va);
+      lock_release(&t->spt_lock);
+
+      /* Only pages still wholly in their file; zero-fill pages are
+         cheaper to fault than to hold a frame for. */
+      if (n == NULL || n == page || n->page_status != 2 || n->frame != NULL
+          || n->pinned || n->bytes_read == 0)
+         continue;
+      if (n->advice != MADV_SEQUENTIAL
+          && !file_is_cached(n->file, n->bytes_read, n->offset))
+         continue;
+      load_file_to_spt(n);
+   }
+}
+
+/*
+   Creates a new page to put into the spt and a frame for a stack frame,
+   or just the zero page until the first WRITE
+*/
+void load_extra_stack_page(void *fault_addr, bool write)
 {
    ASSERT(!lock_held_by_current_thread(&thread_current()->spt_lock));
    struct spt_entry *new_page = (struct spt_entry *)malloc(sizeof(struct spt_entry));
    if (new_page == NULL)
    {
-      unlock_frame();
       thread_exit(-1);
    }
    /* Creates a new page */
    new_page->is_stack = true;
+   new_page->is_mmap = false;
    new_page->vaddr = pg_round_down(fault_addr);
-   new_page->page_status = 3;
+   new_page->frame = NULL;
+   new_page->page_status = write ? 3 : 5;
    new_page->writable = true;
    new_page->pinned = false;
    new_page->file = NULL;
    new_page->offset = 0;
    new_page->bytes_read = 0;
    new_page->pagedir = thread_current()->pagedir;
+   new_page->rss = &thread_current()->rss;
    new_page->swap_index = -1;
+   new_page->advice = MADV_NORMAL;
 
    lock_acquire(&thread_current()->spt_lock);
-   hash_insert(&thread_current()->spt, &new_page->elem);
+   bool inserted = spt_insert(&thread_current()->spt, new_page);
    lock_release(&thread_current()->spt_lock);
+   if (!inserted)
+   {
+      free(new_page);
+      thread_exit(-1);
+   }
 
    thread_current()->num_stack_pages++;
    if (thread_current()->num_stack_pages > 2048)
    {
-      unlock_frame();
       thread_exit(-1);
    }
-   
-   struct frame *new_frame = find_frame(new_page);
-   if (new_frame == NULL)
+
+   if (!write)
    {
-      unlock_frame();
-      thread_exit(-1);
+      if (!frame_map_zero(new_page))
+         PANIC("Error growing stack page!");
       return;
    }
+   struct frame *new_frame = find_zeroed_frame(new_page);
 
    /* Install */
    if (!install_page(new_page->vaddr, new_frame->paddr, new_page->writable))
    {
-      unlock_frame();
       PANIC("Error growing stack page!");
    }
-}
\ No newline at end of file
+   frame_unpin(new_frame);
+}
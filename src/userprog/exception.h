@@ -13,6 +13,8 @@ void exception_print_stats (void);
 void load_swap_to_spt(struct spt_entry* );
 void load_mmap_to_spt(struct spt_entry* );
 void load_file_to_spt(struct spt_entry* );
+void load_cow_copy(struct spt_entry* );
+void load_zero_page(struct spt_entry*, bool);
 //create another single stack page
-void load_extra_stack_page(void*);
+void load_extra_stack_page(void*, bool);
 #endif /* userprog/exception.h */
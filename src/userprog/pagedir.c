@@ -1,6 +1,7 @@
 #include "userprog/pagedir.h"
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
 #include "threads/pte.h"
@@ -11,9 +12,53 @@
 #include "lib/kernel/x86.h"
 #include "lib/atomic-ops.h"
 
-static uint32_t *active_pd (void);
 static void invalidate_pagedir (uint32_t *);
-static void invalidate_pagedir_others (uint32_t *pd);
+static void invalidate_page (uint32_t *, void *);
+static void flush_local (uint32_t *pd, void **pages, size_t cnt);
+static void shootdown (uint32_t *pd, void **pages, size_t cnt);
+static void serve_shootdowns (void);
+static uint32_t *lookup_entry (uint32_t *pd, const void *vaddr);
+static bool demote_huge (uint32_t *pd, uint32_t *pde);
+static void put_spare_pt (uint32_t *pt);
+static uint32_t *get_spare_pt (void);
+
+/* A TLB shootdown: pages of PD for other CPUs to invalidate.
+   It lives on the sender's stack until PENDING drops to 0. */
+struct shootdown_req
+  {
+    uint32_t *pd;
+    void **pages;
+    size_t cnt;                 /* Pages, FLUSH_ALL or FLUSH_DROP. */
+    int pending;                /* CPUs that have yet to do it. */
+  };
+
+/* MAILBOX[T][S] is the request CPU S has out to CPU T, if any. */
+static struct shootdown_req *mailbox[NCPU_MAX][NCPU_MAX];
+
+/* Instead of a list of pages: invalidate the whole page
+   directory, or stop using it altogether. */
+#define FLUSH_ALL ((size_t) -1)
+#define FLUSH_DROP ((size_t) -2)
+
+/* Shootdowns that had to interrupt other CPUs, and the IPIs they
+   sent. */
+static int shootdowns;
+static int shootdown_ipis;
+
+/* Address space switches that loaded CR3, and that found the
+   page directory loaded already. */
+static int cr3_loads;
+static int cr3_skips;
+
+/* Page tables set aside for splitting huge pages, one for every
+   huge page mapped, so that splitting one never has to allocate
+   memory.  Linked through their first word. */
+static struct lock spare_lock;
+static uint32_t *spare_pts;
+
+/* Huge pages mapped, and split back into page tables. */
+static int huge_promotions;
+static int huge_demotions;
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -39,8 +84,17 @@ pagedir_destroy (uint32_t *pd)
     return;
 
   ASSERT (pd != init_page_dir);
+
+  /* Kernel threads may still be running on PD lazily. */
+  shootdown (pd, NULL, FLUSH_DROP);
+
   for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
-    if (*pde & PTE_P) 
+    if (*pde & PTE_PS)
+      {
+        /* Its frames belong to the frame table. */
+        palloc_free_page (get_spare_pt ());
+      }
+    else if (*pde & PTE_P) 
       {
         uint32_t *pt = pde_get_pt (*pde);
         uint32_t *pte;
@@ -58,7 +112,9 @@ pagedir_destroy (uint32_t *pd)
    If PD does not have a page table for VADDR, behavior depends
    on CREATE.  If CREATE is true, then a new page table is
    created and a pointer into it is returned.  Otherwise, a null
-   pointer is returned. */
+   pointer is returned.
+   If VADDR lies in a huge page, the huge page is split into 4 kB
+   pages first. */
 static uint32_t *
 lookup_page (uint32_t *pd, const void *vaddr, bool create)
 {
@@ -85,6 +141,8 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
       else
         return NULL;
     }
+  else if (*pde & PTE_PS)
+    demote_huge (pd, pde);
 
   /* Return the page table entry. */
   pt = pde_get_pt (*pde);
@@ -124,6 +182,58 @@ pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable)
     return false;
 }
 
+/* Maps the huge page at user virtual address UPAGE in PD to the
+   HUGE_PAGE_SIZE bytes of physical memory starting at kernel
+   virtual address KPAGE, both aligned to HUGE_PAGE_SIZE.
+   None of the pages in UPAGE's range may be mapped.
+   If WRITABLE is true, the new page is read/write;
+   otherwise it is read-only.
+   Returns true if successful, false if part of the range is
+   mapped already or memory allocation failed. */
+bool
+pagedir_set_huge (uint32_t *pd, void *upage, void *kpage, bool writable)
+{
+  uint32_t *pde, *pt;
+  size_t i;
+
+  ASSERT ((uintptr_t) upage % HUGE_PAGE_SIZE == 0);
+  ASSERT (is_user_vaddr (upage));
+  ASSERT ((vtop (kpage) >> PTSHIFT) + HUGE_PAGE_PAGES <= init_ram_pages);
+  ASSERT (pd != init_page_dir);
+
+  pde = pd + pd_no (upage);
+  if (*pde & PTE_PS)
+    return false;
+  if (*pde != 0)
+    {
+      /* Keep the emptied page table as the spare. */
+      pt = pde_get_pt (*pde);
+      for (i = 0; i < HUGE_PAGE_PAGES; i++)
+        if (pt[i] & PTE_P)
+          return false;
+    }
+  else
+    {
+      pt = palloc_get_page (0);
+      if (pt == NULL)
+        return false;
+    }
+  put_spare_pt (pt);
+  *pde = pde_create_huge (kpage, writable);
+  invalidate_pagedir (pd);
+  atomic_inci (&huge_promotions);
+  return true;
+}
+
+/* Returns true if user virtual address UADDR is mapped by a huge
+   page in PD. */
+bool
+pagedir_is_huge (uint32_t *pd, const void *uaddr)
+{
+  ASSERT (is_user_vaddr (uaddr));
+  return (pd[pd_no (uaddr)] & PTE_PS) != 0;
+}
+
 /* Looks up the physical address that corresponds to user virtual
    address UADDR in PD.  Returns the kernel virtual address
    corresponding to that physical address, or a null pointer if
@@ -135,8 +245,10 @@ pagedir_get_page (uint32_t *pd, const void *uaddr)
 
   ASSERT (is_user_vaddr (uaddr));
   
-  pte = lookup_page (pd, uaddr, false);
-  if (pte != NULL && (*pte & PTE_P) != 0)
+  pte = lookup_entry (pd, uaddr);
+  if (pte != NULL && (*pte & PTE_PS) != 0)
+    return ptov (*pte & PDE_HUGE_ADDR) + ((uintptr_t) uaddr & ~PDE_HUGE_ADDR);
+  else if (pte != NULL && (*pte & PTE_P) != 0)
     return pte_get_page (*pte) + pg_ofs (uaddr);
   else
     return NULL;
@@ -158,18 +270,18 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      invalidate_page (pd, upage);
     }
 }
 
 /* Returns true if the PTE for virtual page VPAGE in PD is dirty,
    that is, if the page has been modified since the PTE was
-   installed.
+   installed.  In a huge page, that is any of its pages.
    Returns false if PD contains no PTE for VPAGE. */
 bool
 pagedir_is_dirty (uint32_t *pd, const void *vpage) 
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
+  uint32_t *pte = lookup_entry (pd, vpage);
   return pte != NULL && (*pte & PTE_D) != 0;
 }
 
@@ -186,22 +298,43 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
       else 
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, (void *) vpage);
         }
     }
 }
 
 /* Returns true if the PTE for virtual page VPAGE in PD has been
    accessed recently, that is, between the time the PTE was
-   installed and the last time it was cleared.  Returns false if
-   PD contains no PTE for VPAGE. */
+   installed and the last time it was cleared.  In a huge page,
+   that is any of its pages.  Returns false if PD contains no PTE
+   for VPAGE. */
 bool
 pagedir_is_accessed (uint32_t *pd, const void *vpage) 
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
+  uint32_t *pte = lookup_entry (pd, vpage);
   return pte != NULL && (*pte & PTE_A) != 0;
 }
 
+/* Clears the accessed bit in the PTE for virtual page VPAGE in PD
+   and returns whether it was set.  Unlike pagedir_set_accessed(),
+   flushes no TLB: a CPU still caching the entry just goes on without
+   setting the bit again, so the page looks idle until the entry
+   drops out, which is fine for sampling and saves a shootdown per
+   page.  The bit is cleared atomically, since the CPU may be setting
+   the dirty bit in the same entry.  Does not split huge pages. */
+bool
+pagedir_test_and_clear_accessed (uint32_t *pd, const void *vpage)
+{
+  uint32_t *pte = lookup_entry (pd, vpage);
+  bool was_set;
+
+  if (pte == NULL || (*pte & PTE_A) == 0)
+    return false;
+  asm volatile ("lock btrl %2, %0; setc %1"
+                : "+m" (*pte), "=q" (was_set) : "I" (5) : "memory", "cc");
+  return was_set;
+}
+
 /* Sets the accessed bit to ACCESSED in the PTE for virtual page
    VPAGE in PD. */
 void
@@ -215,16 +348,52 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
       else 
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          invalidate_page (pd, (void *) vpage);
+        }
+    }
+}
+
+/* Returns true if the PTE for virtual page VPAGE in PD lets the
+   page be written.  Returns false if PD contains no PTE for
+   VPAGE. */
+bool
+pagedir_is_writable (uint32_t *pd, const void *vpage) 
+{
+  uint32_t *pte = lookup_entry (pd, vpage);
+  return pte != NULL && (*pte & PTE_W) != 0;
+}
+
+/* Sets the writable bit to WRITABLE in the PTE for virtual page
+   VPAGE in PD.  Clearing it is how pages shared copy-on-write are
+   protected, so the first write to them faults. */
+void
+pagedir_set_writable (uint32_t *pd, const void *vpage, bool writable) 
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  if (pte != NULL) 
+    {
+      if (writable)
+        *pte |= PTE_W;
+      else 
+        {
+          *pte &= ~(uint32_t) PTE_W; 
+          invalidate_page (pd, (void *) vpage);
         }
     }
 }
 
 /* Loads page directory PD into the CPU's page directory base
-   register. */
+   register, and notes that this CPU may now cache its entries
+   in the TLB.  If PD is loaded already, as when a process gets
+   the CPU back from a kernel thread that borrowed its address
+   space (see process_activate()), leaves CR3 alone: shootdowns
+   have kept the TLB entries current, and reloading would only
+   flush them. */
 void
 pagedir_activate (uint32_t *pd) 
 {
+  struct cpu *c;
+
   if (pd == NULL)
     pd = init_page_dir;
 
@@ -232,79 +401,201 @@ pagedir_activate (uint32_t *pd)
      aka PDBR (page directory base register).  This activates our
      new page tables immediately.  See [IA32-v2a] "MOV--Move
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base
-     Address of the Page Directory". */
-  lcr3 (vtop (pd));
-}
-
-/* Returns the currently active page directory. */
-static uint32_t *
-active_pd (void) 
-{
-  /* Copy CR3, the page directory base register (PDBR), into
-     `pd'.
-     See [IA32-v2a] "MOV--Move to/from Control Registers" and
-     [IA32-v3a] 3.7.5 "Base Address of the Page Directory". */
-  uintptr_t pd;
-  asm volatile ("movl %%cr3, %0" : "=r" (pd));
-  return ptov (pd);
+     Address of the Page Directory".
+     The CPU's pd is set first: a shootdown that misses it was
+     begun before the load, so its entries are there already. */
+  intr_disable_push ();
+  c = get_cpu ();
+  if (c->pd != pd)
+    {
+      c->pd = pd;
+      lcr3 (vtop (pd));
+      atomic_inci (&cr3_loads);
+    }
+  else
+    atomic_inci (&cr3_skips);
+  intr_enable_pop ();
 }
 
 /* Some page table changes can cause the CPU's translation
    lookaside buffer (TLB) to become out-of-sync with the page
-   table.  When this happens, we have to "invalidate" the TLB by
-   re-activating it.
+   table.  When this happens, we have to "invalidate" the TLB
+   entries involved, on every CPU that has PD loaded, since only
+   those can have any.
 
-   This function invalidates the TLB if PD is the active page
-   directory.  (If PD is not active then its entries are not in
-   the TLB, so there is no need to invalidate anything.) */
+   This function invalidates every entry of PD. */
 static void
 invalidate_pagedir (uint32_t *pd) 
 {
-  if (active_pd () == pd) 
-    {
-      /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
-         "Translation Lookaside Buffers (TLBs)". */
-      pagedir_activate (pd);
-    } 
-  else
-    {
-      /* The PD is not active on the current CPU, but it could be
-         active on other CPUs.  Inform the other CPUs that they
-         need to invalidate any TLB entries related to this PD.
-         If Pintos supported multi-threaded processes, this PD
-         could be active on both this and other CPUs.
-       */
-      invalidate_pagedir_others (pd);
-    }
+  shootdown (pd, NULL, FLUSH_ALL);
 }
 
-static struct {
-  struct lock lock; /* only owner of this lock can initiate TLB flush. */
-  uint32_t *pd;     /* pagedir to be invalidated */
-  int remaining;    /* remaining number of CPUs that must acknowledge IPI_TLB */
-} tlb_flush_state;
+/* Invalidates the TLB entry for user page UPAGE of PD. */
+static void
+invalidate_page (uint32_t *pd, void *upage)
+{
+  shootdown (pd, &upage, 1);
+}
 
-/* Initialize the lock used to protect the TLB flushing protocol. */
+/* Initialize the lock used to protect the spare page tables. */
 void
 pagedir_init (void)
 {
-  lock_init (&tlb_flush_state.lock);
+  lock_init (&spare_lock);
+}
+
+/* Starts an empty batch of invalidations. */
+void
+pagedir_batch_init (struct tlb_batch *b)
+{
+  b->pd = NULL;
+  b->cnt = 0;
+}
+
+/* Like pagedir_clear_page(), but leaves the TLB entry to be
+   invalidated by pagedir_batch_flush() along with the others in
+   B, so that the other CPUs are interrupted once for all of them.
+   Until then, other CPUs may still reach the page: flush before
+   reading or reusing its frame. */
+void
+pagedir_clear_page_batch (struct tlb_batch *b, uint32_t *pd, void *upage)
+{
+  uint32_t *pte;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  pte = lookup_page (pd, upage, false);
+  if (pte == NULL || (*pte & PTE_P) == 0)
+    return;
+  *pte &= ~PTE_P;
+
+  if (b->pd != pd)
+    {
+      pagedir_batch_flush (b);
+      b->pd = pd;
+    }
+  if (b->cnt < TLB_BATCH_PAGES)
+    b->pages[b->cnt] = upage;
+  b->cnt++;
+}
+
+/* Invalidates the TLB entries of the pages cleared into B, and
+   empties it.  Past TLB_BATCH_PAGES pages, all of B's page
+   directory is flushed instead. */
+void
+pagedir_batch_flush (struct tlb_batch *b)
+{
+  if (b->cnt > 0)
+    shootdown (b->pd, b->pages, b->cnt > TLB_BATCH_PAGES ? FLUSH_ALL : b->cnt);
+  b->pd = NULL;
+  b->cnt = 0;
+}
+
+/* Drops the entries for the CNT pages in PAGES of PD from this
+   CPU's TLB, or all of PD's if CNT is FLUSH_ALL, if PD is loaded
+   here.  If CNT is FLUSH_DROP, switches to the kernel-only page
+   directory instead, so that PD can be freed.  Interrupts must be
+   off. */
+static void
+flush_local (uint32_t *pd, void **pages, size_t cnt)
+{
+  struct cpu *c = get_cpu ();
+  size_t i;
+
+  if (c->pd != pd)
+    return;
+  if (cnt == FLUSH_DROP)
+    {
+      c->pd = init_page_dir;
+      lcr3 (vtop (init_page_dir));
+    }
+  else if (cnt == FLUSH_ALL)
+    {
+      /* Reloading CR3 clears the TLB.  See [IA32-v3a] 3.12
+         "Translation Lookaside Buffers (TLBs)". */
+      lcr3 (vtop (pd));
+    }
+  else
+    for (i = 0; i < cnt; i++)
+      invlpg (pages[i]);
 }
 
+/* Invalidates the CNT pages in PAGES of PD, or all of PD if CNT
+   is FLUSH_ALL, on every CPU that has PD loaded, and waits until
+   they all have.
+
+   Requests are posted in per-CPU mailboxes, one slot for each
+   sending CPU, so shootdowns of different page directories (or
+   of the same one) from different CPUs proceed at once.  The
+   sender keeps interrupts off, so it has one request out at a
+   time, and serves requests sent to it while it waits: two CPUs
+   shooting at each other do not deadlock. */
 static void
-invalidate_pagedir_others (uint32_t *pd)
+shootdown (uint32_t *pd, void **pages, size_t cnt)
 {
-  lock_acquire (&tlb_flush_state.lock);
-  tlb_flush_state.remaining = ncpu - 1;
-  tlb_flush_state.pd = pd;
+  struct shootdown_req req;
+  struct cpu *self, *c;
+  bool target[NCPU_MAX];
+
+  intr_disable_push ();
+  self = get_cpu ();
+  flush_local (pd, pages, cnt);
+
+  /* The entry change must be visible before deciding who could
+     still hold the old one; see pagedir_activate(). */
   smp_barrier ();
-  lapic_send_ipi_to_all_but_self (IPI_TLB);
+  req.pd = pd;
+  req.pages = pages;
+  req.cnt = cnt;
+  req.pending = 0;
+  for (c = cpus; c < cpus + ncpu; c++)
+    {
+      target[c - cpus] = cpu_started_others && c != self && c->pd == pd;
+      if (target[c - cpus])
+        req.pending++;
+    }
+  if (req.pending == 0)
+    {
+      intr_enable_pop ();
+      return;
+    }
+
+  atomic_inci (&shootdowns);
+  for (c = cpus; c < cpus + ncpu; c++)
+    if (target[c - cpus])
+      {
+        mailbox[c - cpus][self - cpus] = &req;
+        smp_barrier ();
+        lapic_send_ipi_to (IPI_TLB, c->id);
+        atomic_inci (&shootdown_ipis);
+      }
 
   /* We busy-wait here rather than blocking the calling thread
      because we expect to be spinning for a short time only. */
-  while (atomic_load (&tlb_flush_state.remaining) > 0)
-    ;
-  lock_release (&tlb_flush_state.lock);
+  while (atomic_load (&req.pending) > 0)
+    serve_shootdowns ();
+  intr_enable_pop ();
+}
+
+/* Carries out the requests in this CPU's mailbox.  Interrupts
+   must be off. */
+static void
+serve_shootdowns (void)
+{
+  struct cpu *self = get_cpu ();
+  size_t i;
+
+  for (i = 0; i < ncpu; i++)
+    {
+      struct shootdown_req *req;
+      req = (struct shootdown_req *) atomic_xchg ((int *) &mailbox[self - cpus][i], 0);
+      if (req != NULL)
+        {
+          flush_local (req->pd, req->pages, req->cnt);
+          atomic_deci (&req->pending);
+        }
+    }
 }
 
 /* This method will be called from the IPI TLB_FLUSH interrupt
@@ -313,8 +604,91 @@ invalidate_pagedir_others (uint32_t *pd)
 void
 pagedir_handle_tlbflush_request (void)
 {
-  if (active_pd () == tlb_flush_state.pd)
-    pagedir_activate (active_pd ());
+  serve_shootdowns ();
+}
+
+/* Returns the entry mapping VADDR in PD: the PDE of the huge
+   page holding it, or else its page table entry as
+   lookup_page() finds it, without creating anything.  Unlike
+   lookup_page(), never splits a huge page. */
+static uint32_t *
+lookup_entry (uint32_t *pd, const void *vaddr)
+{
+  uint32_t *pde = pd + pd_no (vaddr);
+
+  if (*pde & PTE_PS)
+    return pde;
+  return lookup_page (pd, vaddr, false);
+}
+
+/* Splits the huge page mapped by PDE in PD into a page table of
+   4 kB pages with the same frames and flags, so that they can be
+   cleared, protected or evicted one at a time.  Another CPU may
+   split the same one, or set its accessed and dirty bits,
+   meanwhile; the entry is swapped in atomically so that neither
+   is lost.  Returns true if this call did the split. */
+static bool
+demote_huge (uint32_t *pd, uint32_t *pde)
+{
+  uint32_t old = *pde;
+  uint32_t new;
+  uint32_t *pt;
+  size_t i;
 
-  atomic_deci (&tlb_flush_state.remaining);
+  if (!(old & PTE_PS))
+    return false;
+  pt = get_spare_pt ();
+  do
+    {
+      if (!(old & PTE_PS))
+        {
+          put_spare_pt (pt);
+          return false;
+        }
+      for (i = 0; i < HUGE_PAGE_PAGES; i++)
+        pt[i] = ((old & PDE_HUGE_ADDR) + i * PGSIZE)
+                | (old & (PTE_P | PTE_W | PTE_U | PTE_A | PTE_D));
+      new = pde_create_user (pt);
+    }
+  while (!atomic_cmpxchg ((int *) pde, (int *) &old, (int *) &new));
+
+  invalidate_pagedir (pd);
+  atomic_inci (&huge_demotions);
+  return true;
+}
+
+/* Sets PT aside for splitting a huge page. */
+static void
+put_spare_pt (uint32_t *pt)
+{
+  lock_acquire (&spare_lock);
+  *(uint32_t **) pt = spare_pts;
+  spare_pts = pt;
+  lock_release (&spare_lock);
+}
+
+/* Takes a page table set aside by put_spare_pt().  There is one
+   for every huge page still mapped. */
+static uint32_t *
+get_spare_pt (void)
+{
+  uint32_t *pt;
+
+  lock_acquire (&spare_lock);
+  pt = spare_pts;
+  ASSERT (pt != NULL);
+  spare_pts = *(uint32_t **) pt;
+  lock_release (&spare_lock);
+  return pt;
+}
+
+/* Prints TLB shootdown and huge page statistics. */
+void
+pagedir_print_stats (void)
+{
+  printf ("TLB: %d shootdowns, %d IPIs, %d CR3 loads, %d skipped\n",
+          shootdowns, shootdown_ipis, cr3_loads, cr3_skips);
+  if (huge_promotions > 0)
+    printf ("Huge pages: %d mapped, %d split\n",
+            huge_promotions, huge_demotions);
 }
@@ -2,19 +2,39 @@
 #define USERPROG_PAGEDIR_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+/* TLB invalidations for cleared pages of one page directory,
+   gathered so that other CPUs get them in one shootdown. */
+#define TLB_BATCH_PAGES 16
+struct tlb_batch
+  {
+    uint32_t *pd;                       /* Page directory, or null. */
+    size_t cnt;                         /* Pages cleared into it. */
+    void *pages[TLB_BATCH_PAGES];       /* The first TLB_BATCH_PAGES. */
+  };
+
 void pagedir_init (void);
 uint32_t *pagedir_create (void);
 void pagedir_destroy (uint32_t *pd);
 bool pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool rw);
 void *pagedir_get_page (uint32_t *pd, const void *upage);
+bool pagedir_set_huge (uint32_t *pd, void *upage, void *kpage, bool rw);
+bool pagedir_is_huge (uint32_t *pd, const void *upage);
 void pagedir_clear_page (uint32_t *pd, void *upage);
+void pagedir_batch_init (struct tlb_batch *);
+void pagedir_clear_page_batch (struct tlb_batch *, uint32_t *pd, void *upage);
+void pagedir_batch_flush (struct tlb_batch *);
 bool pagedir_is_dirty (uint32_t *pd, const void *upage);
 void pagedir_set_dirty (uint32_t *pd, const void *upage, bool dirty);
 bool pagedir_is_accessed (uint32_t *pd, const void *upage);
 void pagedir_set_accessed (uint32_t *pd, const void *upage, bool accessed);
+bool pagedir_test_and_clear_accessed (uint32_t *pd, const void *upage);
+bool pagedir_is_writable (uint32_t *pd, const void *upage);
+void pagedir_set_writable (uint32_t *pd, const void *upage, bool writable);
 void pagedir_activate (uint32_t *pd);
 void pagedir_handle_tlbflush_request (void);
+void pagedir_print_stats (void);
 
 #endif /* userprog/pagedir.h */
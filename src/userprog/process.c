@@ -20,12 +20,36 @@
 #include "threads/vaddr.h"
 #include "userprog/syscall.h"
 #include "vm/page.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
 #include "lib/kernel/hash.h"
 
 static thread_func start_process NO_RETURN;
+static thread_func start_fork NO_RETURN;
 static bool load(const char *cmdline, void (**eip)(void), void **esp);
 struct process *find_child(pid_t child_pid);
 
+/* What a forked child needs from its parent to start. */
+struct fork_info
+{
+  struct intr_frame if_;  /* Parent's user context at the fork call. */
+  struct thread *parent;  /* Blocked in process_fork() until we are done. */
+};
+
+/* A file of the parent and its reopened copy in a forked child. */
+struct fork_file
+{
+  struct file *parent_file;
+  struct file *child_file;
+  struct list_elem elem;
+};
+
+static bool fork_address_space(struct thread *parent);
+static bool fork_page(struct spt_entry *p, struct spt_entry *c);
+static void free_vma(struct vma *v);
+static struct file *fork_file(struct list *files, struct file *file);
+static bool fork_files(struct thread *parent);
+
 /* Starts a new thread running a user program loaded from
    FILENAME.  The new thread may be scheduled (and may even exit)
    before process_execute() returns.  Returns the new process's
@@ -101,6 +125,293 @@ start_process(void *file_name_)
   NOT_REACHED();
 }
 
+/* Starts a copy of the current process, whose user context at the
+   system call is IF_.  Memory is shared copy-on-write: both
+   processes map the same frames read-only until one writes.  Returns
+   the child's thread id to the parent (the child sees 0), or
+   TID_ERROR if the child could not be set up. */
+tid_t process_fork(struct intr_frame *if_)
+{
+  struct fork_info *info = malloc(sizeof *info);
+  tid_t tid;
+
+  if (info == NULL)
+    return TID_ERROR;
+  info->if_ = *if_;
+  info->parent = thread_current();
+
+  tid = thread_create(thread_current()->name, NICE_DEFAULT, start_fork, info);
+  if (tid == TID_ERROR) {
+    free(info);
+    return tid;
+  }
+  else {
+    struct process * child = find_child((pid_t) tid);
+    sema_down(&child->wait_sema);
+
+    if ( child->status == PROCESS_ABORT ) {
+        lock_acquire(&thread_current()->children_lock);
+        list_remove(&child->elem);
+        lock_release(&thread_current()->children_lock);
+        free(child);
+        tid = -1;
+    }
+  }
+
+  return tid;
+}
+
+/* A thread function that copies its parent's process, then returns
+   to user mode from the parent's fork() call with 0 as result. */
+static void
+start_fork(void *info_)
+{
+  struct fork_info *info = info_;
+  struct thread *t = thread_current();
+  struct thread *parent = info->parent;
+  struct intr_frame if_ = info->if_;
+
+  free(info);
+  t->pagedir = pagedir_create();
+  if (t->pagedir != NULL)
+    rss_register(&t->rss, &parent->rss);
+  if (t->pagedir == NULL || !fork_files(parent) || !fork_address_space(parent))
+  {
+    t->parent->status = PROCESS_ABORT;
+    thread_exit(-1);
+  }
+  process_activate();
+  if_.eax = 0;
+  sema_up(&t->parent->wait_sema);
+
+  asm volatile("movl %0, %%esp; jmp intr_exit" : : "g"(&if_) : "memory");
+  NOT_REACHED();
+}
+
+/* Gives the current thread, a forked child of PARENT, its own
+   descriptors for PARENT's executable, open files and working
+   directory, at the same positions. */
+static bool
+fork_files(struct thread *parent)
+{
+  struct thread *t = thread_current();
+  bool success = true;
+
+  lock_file();
+  if (parent->exec_file != NULL)
+  {
+    t->exec_file = file_reopen(parent->exec_file);
+    if (t->exec_file == NULL)
+      success = false;
+    else
+      file_deny_write(t->exec_file);
+  }
+  if (parent->cwd != NULL)
+    t->cwd = dir_reopen(parent->cwd);
+
+  for (struct list_elem *e = list_begin(&parent->fdToFile);
+       success && e != list_end(&parent->fdToFile); e = list_next(e))
+  {
+    struct file_descriptor *pfd = list_entry(e, struct file_descriptor, elem);
+    struct file_descriptor *fd = malloc(sizeof(struct file_descriptor));
+    if (fd == NULL)
+    {
+      success = false;
+      break;
+    }
+    fd->fd = pfd->fd;
+    fd->is_dir = pfd->is_dir;
+    fd->dir = pfd->dir != NULL ? dir_reopen(pfd->dir) : NULL;
+    fd->file = NULL;
+    if (pfd->file != NULL)
+    {
+      fd->file = file_reopen(pfd->file);
+      if (fd->file != NULL)
+        file_seek(fd->file, file_tell(pfd->file));
+    }
+    list_push_back(&t->fdToFile, &fd->elem);
+    if ((pfd->file != NULL && fd->file == NULL) || (pfd->dir != NULL && fd->dir == NULL))
+      success = false;
+  }
+  t->fd = parent->fd;
+  unlock_file();
+  return success;
+}
+
+/* Copies PARENT's supplemental page table and memory mappings into
+   the current thread, a forked child of PARENT.  Pages in frames
+   are shared copy-on-write, pages in swap share their slot, and
+   pages not loaded yet stay lazy. */
+static bool
+fork_address_space(struct thread *parent)
+{
+  struct thread *t = thread_current();
+  struct list files;
+  struct fork_file exec;
+  struct spt_entry *p;
+  bool success = true;
+
+  list_init(&files);
+  exec.parent_file = parent->exec_file;
+  exec.child_file = t->exec_file;
+  list_push_back(&files, &exec.elem);
+  /* Reopen mapped files up front, not under the page table lock. */
+  for (struct list_elem *e = list_begin(&parent->mmap_list);
+       e != list_end(&parent->mmap_list); e = list_next(e))
+    fork_file(&files, list_entry(e, struct mapped_item, elem)->vma->file);
+
+  lock_acquire(&parent->spt_lock);
+  for (p = spt_next(&parent->spt, NULL, PHYS_BASE); success && p != NULL;
+       p = spt_next(&parent->spt, (uint8_t *)p->vaddr + PGSIZE, PHYS_BASE))
+  {
+    struct spt_entry *c = malloc(sizeof(struct spt_entry));
+    if (c == NULL)
+    {
+      success = false;
+      break;
+    }
+    *c = *p;
+    c->pagedir = t->pagedir;
+    c->rss = &t->rss;
+    c->pinned = false;
+    c->frame = NULL;
+    c->file = fork_file(&files, p->file);
+    success = (p->file == NULL || c->file != NULL) && fork_page(p, c);
+
+    lock_acquire(&t->spt_lock);
+    bool inserted = spt_insert(&t->spt, c);
+    lock_release(&t->spt_lock);
+    if (!inserted)
+    {
+      destroy_page(c);
+      success = false;
+    }
+  }
+
+  /* Areas, for the pages neither process has touched yet. */
+  for (struct vma *pv = vma_first(&parent->vmas, NULL, PHYS_BASE);
+       success && pv != NULL; pv = vma_first(&parent->vmas, pv->end, PHYS_BASE))
+  {
+    struct vma *v = malloc(sizeof(struct vma));
+    if (v == NULL)
+    {
+      success = false;
+      break;
+    }
+    *v = *pv;
+    v->file = fork_file(&files, pv->file);
+    lock_acquire(&t->spt_lock);
+    bool inserted = v->file != NULL && vma_insert(&t->vmas, v);
+    lock_release(&t->spt_lock);
+    if (!inserted)
+    {
+      free(v);
+      success = false;
+    }
+  }
+  lock_release(&parent->spt_lock);
+  t->num_stack_pages = parent->num_stack_pages;
+
+  /* Same mappings under the same ids, over the child's pages. */
+  for (struct list_elem *e = list_begin(&parent->mmap_list);
+       success && e != list_end(&parent->mmap_list); e = list_next(e))
+  {
+    struct mapped_item *pm = list_entry(e, struct mapped_item, elem);
+    struct mapped_item *m = malloc(sizeof(struct mapped_item));
+    if (m == NULL)
+    {
+      success = false;
+      break;
+    }
+    m->id = pm->id;
+    lock_acquire(&t->spt_lock);
+    m->vma = vma_find(&t->vmas, pm->vma->start);
+    lock_release(&t->spt_lock);
+    list_push_back(&t->mmap_list, &m->elem);
+  }
+  t->num_mapped = parent->num_mapped;
+
+  while (list_size(&files) > 1)
+    free(list_entry(list_pop_back(&files), struct fork_file, elem));
+  return success;
+}
+
+/* Frees area V; its file is closed by whoever opened it. */
+static void
+free_vma(struct vma *v)
+{
+  free(v);
+}
+
+/* Makes child page C, a copy of parent page P, share P's contents.
+   Returns false if C could not be mapped. */
+static bool
+fork_page(struct spt_entry *p, struct spt_entry *c)
+{
+  struct frame *f;
+  bool success = true;
+
+  /* Hold P's frame, if any, so that P is not evicted halfway. */
+  for (;;)
+  {
+    f = p->frame;
+    if (f == NULL)
+      break;
+    lock_acquire(&f->lock);
+    if (p->frame == f)
+      break;
+    lock_release(&f->lock);
+  }
+
+  if (p->page_status == 1 || p->page_status == 4)
+  {
+    /* The parent keeps its swap cache frame; the child reads the slot. */
+    c->page_status = 1;
+    swap_ref(c);
+  }
+  else if (p->page_status == 5)
+    success = frame_map_zero(c);
+  else if (f != NULL)
+  {
+    if (p->writable)
+      pagedir_set_writable(p->pagedir, p->vaddr, false);
+    success = pagedir_set_page(c->pagedir, c->vaddr, f->paddr, false);
+    if (success)
+      frame_add_sharer(f, c);
+  }
+
+  if (f != NULL)
+    lock_release(&f->lock);
+  return success;
+}
+
+/* Returns the forked child's copy of its parent's FILE, using the
+   copies made so far in FILES and reopening FILE the first time. */
+static struct file *
+fork_file(struct list *files, struct file *file)
+{
+  struct fork_file *ff;
+
+  if (file == NULL)
+    return NULL;
+  for (struct list_elem *e = list_begin(files); e != list_end(files); e = list_next(e))
+  {
+    ff = list_entry(e, struct fork_file, elem);
+    if (ff->parent_file == file)
+      return ff->child_file;
+  }
+
+  ff = malloc(sizeof *ff);
+  if (ff == NULL)
+    return NULL;
+  lock_file();
+  ff->parent_file = file;
+  ff->child_file = file_reopen(file);
+  unlock_file();
+  list_push_back(files, &ff->elem);
+  return ff->child_file;
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -135,22 +446,15 @@ void process_exit(int status)
 {
   struct thread *cur = thread_current();
 
-  while (cur->num_mapped != 0)
+  while (!list_empty(&cur->mmap_list))
   {
-    munmap(cur->num_mapped);
+    munmap(list_entry(list_front(&cur->mmap_list), struct mapped_item, elem)->id);
   }
 
   /* Process Termination Message */
   char *tmp;
   printf("%s: exit(%d)\n", strtok_r(cur->name, " ", &tmp), status);
   
-  lock_file();
-  if ( cur->exec_file != NULL ) {
-    file_allow_write(cur->exec_file);
-  }
-  file_close(cur->exec_file);
-  unlock_file();
-  
   /* Mark orphanized child processes */
   lock_acquire(&cur->children_lock);
   for ( struct list_elem * e = list_begin(&cur->children); e != list_end(&cur->children);) {
@@ -186,11 +490,21 @@ void process_exit(int status)
   }
 
   /* Destroy the current process's spt entries */
-  lock_frame();
   lock_acquire(&cur->spt_lock);
-  hash_destroy(&cur->spt, destroy_page);
+  spt_destroy(&cur->spt, destroy_page);
+  vma_destroy(&cur->vmas, free_vma);
   lock_release(&cur->spt_lock);
-  unlock_frame();
+  if (cur->pagedir != NULL)
+    rss_unregister(&cur->rss);
+
+  /* Only now, with none of its pages left in the page cache, may the
+     executable's inode go away. */
+  lock_file();
+  if ( cur->exec_file != NULL ) {
+    file_allow_write(cur->exec_file);
+  }
+  file_close(cur->exec_file);
+  unlock_file();
 }
 
 
@@ -201,8 +515,11 @@ void process_activate(void)
 {
   struct thread *t = thread_current();
 
-  /* Activate thread's page tables. */
-  pagedir_activate(t->pagedir);
+  /* Activate thread's page tables.  A kernel thread has no user
+     address space and borrows whichever one is loaded, so switching
+     to it and back to the same process flushes nothing. */
+  if (t->pagedir != NULL)
+    pagedir_activate(t->pagedir);
 
   /* Set thread's kernel stack for use in processing
      interrupts. */
@@ -317,6 +634,7 @@ bool load(const char *file_name, void (**eip)(void), void **esp)
   t->pagedir = pagedir_create();
   if (t->pagedir == NULL)
     goto done;
+  rss_register(&t->rss, NULL);
   process_activate();
 
   /* Open executable file. */
@@ -520,41 +838,28 @@ load_segment(struct file *file, off_t ofs, uint8_t *upage,
 
   struct thread *t = thread_current();
 
-  while (read_bytes > 0 || zero_bytes > 0)
+  /* One area for the segment; its pages are described on first touch. */
+  struct vma *v = malloc(sizeof(struct vma));
+  if (v == NULL)
   {
-    /* Calculate how to fill this page.
-       We will read PAGE_READ_BYTES bytes from FILE
-       and zero the final PAGE_ZERO_BYTES bytes. */
-    size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-    size_t page_zero_bytes = PGSIZE - page_read_bytes;
-    
-    /* Creates a page*/
-    struct spt_entry *page = (struct spt_entry *)malloc(sizeof(struct spt_entry));
-    if (page == NULL)
-    {
-      return false;
-    }
-    page->vaddr = upage;
-    page->is_stack = false;
-    page->frame = NULL;
-    page->file = file;
-    page->offset = ofs;
-    page->page_status = 2; /* file page */
-    page->writable = writable;
-    page->bytes_read = page_read_bytes;
-    page->bytes_zero = page_zero_bytes;
-    page->pagedir = t->pagedir;
-    page->swap_index = -1;
-    lock_acquire(&t->spt_lock);
-    hash_insert(&t->spt, &page->elem);
-    lock_release(&t->spt_lock);
-    /* Advance. */
-    read_bytes -= page_read_bytes;
-    zero_bytes -= page_zero_bytes;
-    ofs += page_read_bytes;
-    upage += PGSIZE;
+    return false;
   }
-  file_seek(file, ofs);
+  v->start = upage;
+  v->end = upage + read_bytes + zero_bytes;
+  v->file = file;
+  v->offset = ofs;
+  v->file_bytes = read_bytes;
+  v->writable = writable;
+  v->is_mmap = false;
+  lock_acquire(&t->spt_lock);
+  bool inserted = vma_insert(&t->vmas, v);
+  lock_release(&t->spt_lock);
+  if (!inserted)
+  {
+    free(v);
+    return false;
+  }
+  file_seek(file, ofs + read_bytes);
 
   return true;
 }
@@ -575,28 +880,30 @@ setup_stack(void **esp)
     return false;
   }
   page->is_stack = true;
+  page->is_mmap = false;
   page->vaddr = pg_round_down(upage);
+  page->frame = NULL;
   page->page_status = 3;
   page->writable = true;
+  page->pinned = false;
   page->file = NULL;
   page->offset = 0;
   page->bytes_read = 0;
   page->pagedir = curr->pagedir;
+  page->rss = &curr->rss;
+  page->advice = MADV_NORMAL;
   page->swap_index = -1;
   lock_acquire(&curr->spt_lock);
-  hash_insert(&curr->spt, &page->elem);
+  bool inserted = spt_insert(&curr->spt, page);
   lock_release(&curr->spt_lock);
-  thread_current()->num_stack_pages++;
-
-  lock_frame();
-  struct frame *stack_frame = find_frame(page);
-  
-  if (stack_frame == NULL || stack_frame->paddr == NULL)
+  if (!inserted)
   {
     free(page);
-    unlock_frame();
-    thread_exit(-1);
+    return false;
   }
+  thread_current()->num_stack_pages++;
+
+  struct frame *stack_frame = find_zeroed_frame(page);
 
   /* By setting kpage to the frame the rest of stack setup is good */
   success = install_page(page->vaddr, page->frame->paddr, page->writable);
@@ -604,11 +911,7 @@ setup_stack(void **esp)
   {
     *esp = PHYS_BASE;
   }
-  else
-  {
-    free(page);
-  }
-  unlock_frame();
+  frame_unpin(stack_frame);
   return success;
 }
 
@@ -6,9 +6,13 @@
 #include "filesys/inode.h"
 #include "filesys/filesys.h"
 #include "filesys/directory.h"
+#include "filesys/cache.h"
 #include "userprog/process.h"
 #include "threads/cpu.h"
+#include "vm/writeback.h"
+#include "devices/timer.h"
 #include <string.h>
+#include <round.h>
 struct lock file_lock;
 
 static void syscall_handler(struct intr_frame *);
@@ -218,6 +222,52 @@ syscall_handler(struct intr_frame *f)
     }
     f->eax = (uint32_t)inumber(args[0]);
     break;
+  case SYS_MADVISE:
+    if (!parse_arguments(f, &args[0], 3))
+    {
+      thread_exit(-1);
+      return;
+    }
+    f->eax = (uint32_t)madvise((void *)args[0], args[1], args[2]);
+    break;
+  case SYS_FORK:
+    f->eax = (uint32_t)process_fork(f);
+    break;
+  case SYS_MEMSTAT:
+    if (!parse_arguments(f, &args[0], 1))
+    {
+      thread_exit(-1);
+      return;
+    }
+    f->eax = (uint32_t)memstat((struct memstat *)args[0]);
+    break;
+  case SYS_RSSLIMIT:
+    if (!parse_arguments(f, &args[0], 2))
+    {
+      thread_exit(-1);
+      return;
+    }
+    f->eax = (uint32_t)rsslimit(args[0], args[1]);
+    break;
+  case SYS_MSYNC:
+    if (!parse_arguments(f, &args[0], 2))
+    {
+      thread_exit(-1);
+      return;
+    }
+    f->eax = (uint32_t)msync((void *)args[0], args[1]);
+    break;
+  case SYS_CACHESTAT:
+    if (!parse_arguments(f, &args[0], 1))
+    {
+      thread_exit(-1);
+      return;
+    }
+    f->eax = (uint32_t)cachestat((struct cachestat *)args[0]);
+    break;
+  case SYS_UPTIME:
+    f->eax = (uint32_t)timer_ticks();
+    break;
   default:
     thread_exit(-1);
   }
@@ -368,7 +418,10 @@ int read(int fd, void *buffer, unsigned size, void* esp)
 		thread_exit(-1);
 	}
 
-	if((void*)get_page_from_hash(buffer) == NULL) 
+	lock_acquire(&thread_current()->spt_lock);
+	struct spt_entry *first = get_page_from_spt(buffer);
+	lock_release(&thread_current()->spt_lock);
+	if(first == NULL) 
 	{
 		if ( buffer < esp) {
 		  thread_exit(-1);
@@ -387,10 +440,12 @@ int read(int fd, void *buffer, unsigned size, void* esp)
   
   for (buffer_page = buffer_start; buffer_page <= buffer + size; buffer_page += PGSIZE)
   {
-    struct spt_entry *page = get_page_from_hash(buffer_page);
+    lock_acquire(&thread_current()->spt_lock);
+    struct spt_entry *page = get_page_from_spt(buffer_page);
+    lock_release(&thread_current()->spt_lock);
     if (page == NULL) /* Page not found */
     {
-      load_extra_stack_page(buffer_page);
+      load_extra_stack_page(buffer_page, true);
       byteCount++;
     }
     else if (page->page_status == 2) /* Page in filesys */
@@ -398,7 +453,7 @@ int read(int fd, void *buffer, unsigned size, void* esp)
       load_file_to_spt(page);
       byteCount++;
     }
-    else if (page->page_status == 1 ) {
+    else if (page->page_status == 1 || page->page_status == 4 ) {
         load_swap_to_spt(page);
         byteCount++;
     }
@@ -406,6 +461,10 @@ int read(int fd, void *buffer, unsigned size, void* esp)
       load_mmap_to_spt(page);
       byteCount++;
     }
+    else if (page->page_status == 5 && page->writable) {
+      load_zero_page(page, true);
+      byteCount++;
+    }
   }
   /* If fd == 0, reads from keyboard using input_getc() */
   if (fd == 0)
@@ -651,99 +710,271 @@ mapid_t mmap(int fd, void *addr)
   }
   lock_release(&file_lock);
 
-  int num_of_page = length_of_file / PGSIZE + 1;
-  for (int i = 0; i < num_of_page; i++)
+  /* One area for the whole file; its pages are only described when
+     first touched, so mapping costs the same at any length. */
+  struct thread *t = thread_current();
+  uint8_t *end = (uint8_t *)addr + ROUND_UP(length_of_file, PGSIZE);
+  if (end < (uint8_t *)addr || !is_user_vaddr(end - 1))
   {
-    void *pg_addr = addr + (PGSIZE * i);
-    if (get_page_from_hash(pg_addr) != NULL)
-    {
-      return -1;
-    }
+    file_close(fileCopy);
+    return -1;
   }
-
-  thread_current()->num_mapped++;
-  mapid_t id = thread_current()->num_mapped;
-  off_t offset = 0;
-  uint32_t read_bytes = length_of_file;
-
-  while (read_bytes > 0)
+  struct vma *v = malloc(sizeof(struct vma));
+  if (v == NULL)
   {
-    size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-    struct spt_entry *page = malloc(sizeof(struct spt_entry));
-    if (page == NULL)
-    {
-      return -1;
-    }
-
-    page->file = fileCopy;
-    page->offset = offset;
-    page->vaddr = addr;
-    page->bytes_read = page_read_bytes;
-    page->bytes_zero = PGSIZE - page_read_bytes;
-    page->writable = true;
-    page->page_status = 2;
-    page->pagedir = thread_current()->pagedir;
-
-    lock_acquire(&thread_current()->spt_lock);
-    hash_insert(&thread_current()->spt, &page->elem);
-    lock_release(&thread_current()->spt_lock);
-
-    if (put_mmap_in_list(page) == false)
-    {
-      munmap(id);
-      return -1;
-    }
-
-    read_bytes -= page_read_bytes;
-    addr += PGSIZE;
-    offset += PGSIZE;
+    file_close(fileCopy);
+    return -1;
+  }
+  v->start = addr;
+  v->end = end;
+  v->file = fileCopy;
+  v->offset = 0;
+  v->file_bytes = length_of_file;
+  v->writable = true;
+  v->is_mmap = true;
+
+  lock_acquire(&t->spt_lock);
+  bool inserted = spt_next(&t->spt, v->start, v->end) == NULL
+                  && vma_insert(&t->vmas, v);
+  lock_release(&t->spt_lock);
+  if (!inserted)
+  {
+    free(v);
+    file_close(fileCopy);
+    return -1;
+  }
+  if (put_mmap_in_list(v) == false)
+  {
+    lock_acquire(&t->spt_lock);
+    vma_remove(&t->vmas, v);
+    lock_release(&t->spt_lock);
+    free(v);
+    file_close(fileCopy);
+    return -1;
   }
-  return id;
+  return t->num_mapped;
 }
 
 
 /*
  * VM munmap
+ * Writes back the dirty pages in batches, then frees the pages that
+ * were ever touched, found by walking the page table over the area,
+ * and drops the area.
  */
 bool munmap(mapid_t mapping)
 {
-  lock_acquire(&file_lock);
+  struct thread *t = thread_current();
+  struct mapped_item *mmapped = NULL;
+  struct list_elem *e;
+
   if (mapping <= 0)
   {
-    lock_release(&file_lock);
     return false;
   }
-  struct list *map_list = &(thread_current()->mmap_list);
-  struct list_elem *e = list_begin(map_list);
-  for (e = list_begin(map_list); e != list_end(map_list); e = e)
+  for (e = list_begin(&t->mmap_list); e != list_end(&t->mmap_list); e = list_next(e))
   {
-    struct mapped_item *mmapped = list_entry(e, struct mapped_item, elem);
-
-    if (mmapped->id == mapping)
+    if (list_entry(e, struct mapped_item, elem)->id == mapping)
     {
+      mmapped = list_entry(e, struct mapped_item, elem);
+      break;
+    }
+  }
+  if (mmapped == NULL)
+  {
+    return false;
+  }
 
-      struct spt_entry *page = mmapped->page;
-      file_seek(page->file, 0);
+  struct vma *v = mmapped->vma;
+  writeback_range(v, v->start, v->end);
 
-      if (pagedir_is_dirty(thread_current()->pagedir, page->vaddr))
-      {
-        file_write_at(page->file, page->vaddr, page->bytes_read, page->offset);
-      }
+  uint8_t *va = v->start;
+  while (true)
+  {
+    lock_acquire(&t->spt_lock);
+    struct spt_entry *page = spt_next(&t->spt, va, v->end);
+    lock_release(&t->spt_lock);
+    if (page == NULL)
+      break;
+    va = (uint8_t *)page->vaddr + PGSIZE;
+
+    lock_acquire(&t->spt_lock);
+    spt_remove(&t->spt, page->vaddr);
+    lock_release(&t->spt_lock);
+    destroy_page(page);
+  }
+
+  lock_acquire(&t->spt_lock);
+  vma_remove(&t->vmas, v);
+  lock_release(&t->spt_lock);
+  lock_acquire(&file_lock);
+  file_close(v->file);
+  lock_release(&file_lock);
+  free(v);
+
+  list_remove(&mmapped->elem);
+  free(mmapped);
+  return true;
+}
 
-      lock_acquire(&thread_current()->spt_lock);
-      hash_delete(&thread_current()->spt, &page->elem);
-      lock_release(&thread_current()->spt_lock);
+/*
+ * VM madvise
+ * Records ADVICE for every page in [ADDR, ADDR + LENGTH), or for
+ * MADV_WILLNEED faults them all in now. Returns -1 if ADDR is not
+ * page-aligned or part of the range is not mapped, 0 otherwise.
+ */
+int madvise(void *addr, unsigned length, int advice)
+{
+  struct thread *t = thread_current();
+  uint8_t *start = addr;
+  uint8_t *end = start + length;
+  int result = 0;
 
-      e = list_remove(&mmapped->elem);
-      free(mmapped);
+  if (pg_ofs(addr) != 0 || advice < MADV_NORMAL || advice > MADV_WILLNEED)
+    return -1;
+  if (end < start || (length > 0 && !is_user_vaddr(end - 1)))
+    return -1;
+
+  for (uint8_t *va = start; va < end; va += PGSIZE)
+  {
+    lock_acquire(&t->spt_lock);
+    struct spt_entry *page = get_page_from_spt(va);
+    lock_release(&t->spt_lock);
+    if (page == NULL)
+    {
+      result = -1;
+      continue;
     }
-    else
+    if (advice != MADV_WILLNEED)
     {
-      e = list_next(e);
+      page->advice = advice;
+      continue;
     }
+    /* Already mapped, or still being written out elsewhere: let the
+       fault path deal with it. */
+    if (pagedir_get_page(t->pagedir, va) != NULL
+        || (page->frame != NULL && page->page_status != 4))
+      continue;
+    if (page->page_status == 2)
+      load_file_to_spt(page);
+    else if (page->page_status == 1 || page->page_status == 4)
+      load_swap_to_spt(page);
   }
-  lock_release(&file_lock);
-  thread_current()->num_mapped--;
+  return result;
+}
+
+/*
+ * VM memstat
+ * Fills in MS with the current process's memory use. Pages in swap
+ * are counted off the page table, the rest kept up to date by the
+ * frame table. Returns false if MS is not a user address.
+ */
+bool memstat(struct memstat *ms)
+{
+  struct thread *t = thread_current();
+  struct memstat stat;
+  struct spt_entry *p;
+
+  if (!is_user_vaddr(ms) || !is_user_vaddr((uint8_t *)(ms + 1) - 1))
+    return false;
+
+  stat.swapped = 0;
+  lock_acquire(&t->spt_lock);
+  for (p = spt_next(&t->spt, NULL, PHYS_BASE); p != NULL;
+       p = spt_next(&t->spt, (uint8_t *)p->vaddr + PGSIZE, PHYS_BASE))
+    if (p->page_status == 1 || p->page_status == 4)
+      stat.swapped++;
+  lock_release(&t->spt_lock);
+
+  stat.resident = t->rss.resident;
+  stat.working_set = t->rss.working_set;
+  stat.soft_limit = t->rss.soft_limit;
+  stat.hard_limit = t->rss.hard_limit;
+  stat.faults = t->rss.faults;
+  stat.major_faults = t->rss.major_faults;
+
+  /* Copied out only now: faulting ms in takes the page table lock. */
+  *ms = stat;
+  return true;
+}
+
+/*
+ * VM rsslimit
+ * Sets the current process's resident set limits, in pages, 0 for
+ * none. Children forked later inherit them. Above SOFT_PAGES, its
+ * pages are the first to go when memory runs short; at HARD_PAGES, it
+ * makes room for each new page by evicting one of its own. Returns
+ * false if a limit is negative or SOFT_PAGES exceeds HARD_PAGES.
+ */
+bool rsslimit(int soft_pages, int hard_pages)
+{
+  struct thread *t = thread_current();
+
+  if (soft_pages < 0 || hard_pages < 0
+      || (hard_pages > 0 && soft_pages > hard_pages))
+    return false;
+  t->rss.soft_limit = soft_pages;
+  t->rss.hard_limit = hard_pages;
+  return true;
+}
+
+/*
+ * VM msync
+ * Writes the dirty pages of the mappings in [ADDR, ADDR + LENGTH) back
+ * to their files; they stay mapped. Returns 0, or -1 if ADDR is not
+ * page aligned or part of the range is not mapped from a file.
+ */
+int msync(void *addr, unsigned length)
+{
+  struct thread *t = thread_current();
+  uint8_t *start = addr;
+  uint8_t *end;
+
+  /* Check the length before rounding it, which could wrap around. */
+  if (pg_ofs(addr) != 0 || !is_user_vaddr(addr)
+      || length > (uintptr_t)PHYS_BASE - (uintptr_t)start)
+    return -1;
+  end = start + ROUND_UP(length, PGSIZE);
+
+  /* Check the whole range before writing any of it. */
+  uint8_t *va = start;
+  while (va < end)
+  {
+    lock_acquire(&t->spt_lock);
+    struct vma *v = vma_first(&t->vmas, va, end);
+    lock_release(&t->spt_lock);
+    if (v == NULL || (uint8_t *)v->start > va || !v->is_mmap)
+      return -1;
+    va = v->end;
+  }
+
+  /* Mappings are only removed by this thread, so V stays valid. */
+  va = start;
+  while (va < end)
+  {
+    lock_acquire(&t->spt_lock);
+    struct vma *v = vma_first(&t->vmas, va, end);
+    lock_release(&t->spt_lock);
+    uint8_t *stop = (uint8_t *)v->end < end ? v->end : end;
+    writeback_range(v, va, stop);
+    va = stop;
+  }
+  return 0;
+}
+
+/*
+ * Filesys cachestat
+ * Fills in ST with the buffer cache's size and hit counts. Returns
+ * false if ST is not a user address.
+ */
+bool cachestat(struct cachestat *st)
+{
+  struct cachestat stat;
+
+  if (!is_user_vaddr(st) || !is_user_vaddr((uint8_t *)(st + 1) - 1))
+    return false;
+  cache_stat(&stat);
+  *st = stat;
   return true;
 }
 
@@ -751,7 +982,7 @@ bool munmap(mapid_t mapping)
  * Helper for mmap
  * Puts page in mmap list
  */
-bool put_mmap_in_list(struct spt_entry *page)
+bool put_mmap_in_list(struct vma *v)
 {
   struct mapped_item *mmapped = malloc(sizeof(struct mapped_item));
   if (mmapped == NULL)
@@ -760,8 +991,8 @@ bool put_mmap_in_list(struct spt_entry *page)
   }
 
   struct thread *t = thread_current();
-  mmapped->page = page;
-  mmapped->id = t->num_mapped;
+  mmapped->vma = v;
+  mmapped->id = ++t->num_mapped;
   list_push_back(&t->mmap_list, &mmapped->elem);
   return true;
 }
@@ -3,6 +3,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <syscall-nr.h>
+#include <syscall-types.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "filesys/filesys.h"
@@ -34,7 +35,11 @@ void unlock_file(void);
 /* Virtual Memory Functions */
 mapid_t mmap(int, void *);
 bool munmap(mapid_t);
-bool put_mmap_in_list(struct spt_entry *);
+bool put_mmap_in_list(struct vma *);
+int madvise(void *, unsigned, int);
+bool memstat(struct memstat *);
+bool rsslimit(int, int);
+int msync(void *, unsigned);
 
 /* Filesystem Functions */
 bool chdir (const char *dir);
@@ -42,5 +47,6 @@ bool mkdir (const char *dir);
 bool readdir (int fd, char *name);
 bool isdir (int fd);
 int inumber (int fd);
+bool cachestat (struct cachestat *);
 
 #endif /* userprog/syscall.h */
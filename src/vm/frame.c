@@ -3,27 +3,98 @@
 #include <bitmap.h>
 #include <round.h>
 #include <string.h>
+#include <atomic-ops.h>
 #include "vm/page.h"
 #include "vm/swap.h"
+#include "vm/writeback.h"
+#include "filesys/cache.h"
 #include "userprog/pagedir.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "threads/pte.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
+#include "devices/timer.h"
 #include "userprog/syscall.h"
 #include "userprog/process.h"
 
 static struct list frame_list;       /* Frame list */
-static struct lock frame_table_lock; /* Frame table lock */
+static struct lock frame_table_lock; /* Protects frame_list, pinned, page and sharers */
 
-void lock_frame() {
-    lock_acquire(&frame_table_lock);
-}
+static struct hash file_frames;      /* Page cache: read-only file pages by (inode, offset) */
+static struct lock file_frames_lock; /* Protects file_frames */
+
+static void *zero_page;              /* Shared read-only page of zeros */
+static struct condition zero_cond;   /* Signalled when a free frame needs zeroing */
+static int zero_pending;             /* Frames freed since the zeroer last looked */
+
+static struct frame **frame_index;  /* Every frame, by physical address */
+static size_t frame_cnt;             /* Frames in frame_index */
+
+/* -huge: Map large anonymous regions with huge pages? */
+bool huge_pages;
+
+/* Frames lent to the buffer cache */
+#define LEND_RESERVE 8                /* Never lend the last 1/8 of free frames */
+static int frames_lent;              /* Frames the cache holds; frame_table_lock */
+
+/* Resident set accounting */
+#define WSS_SAMPLE_TICKS TIMER_FREQ  /* Working set sampling period */
+
+static struct list rss_list;         /* Registered resident sets; frame_table_lock */
+static int rss_limit_evictions;      /* Frames taken back for a resident set limit */
+
+static void charge(struct spt_entry *);
+static void uncharge(struct spt_entry *);
+static bool over_soft_limit(struct frame *);
+static struct frame *pick_own_victim(struct rss *);
+static void wss_daemon(void *);
+static void wss_sample(void);
+
+static struct frame *get_frame(struct spt_entry *, bool);
+static void zero_daemon(void *);
+static bool huge_candidate(struct spt_entry *);
+static size_t huge_claim(void);
+static void huge_release(size_t);
+
+/* Kernel same-page merging */
+#define KSM_SCAN_TICKS TIMER_FREQ    /* Pause between sweeps of the scanner */
+
+/* A frame the current sweep has seen, by checksum of its contents */
+struct ksm_item {
+    struct hash_elem elem;
+    unsigned checksum;
+    struct frame *frame;
+};
+
+static bool ksm_running;             /* Scanner was started */
+static int ksm_merges;               /* Pages merged away since boot */
+
+static void ksm_daemon(void *);
+static void ksm_scan(struct hash *);
+static bool ksm_candidate(struct frame *);
+static bool ksm_merge(struct frame *, struct frame *);
+static bool ksm_protect(struct frame *);
+static void ksm_unprotect(struct frame *);
+static unsigned ksm_item_hash(const struct hash_elem *, void *);
+static bool ksm_item_less(const struct hash_elem *, const struct hash_elem *, void *);
+static void ksm_item_free(struct hash_elem *, void *);
+
+static struct frame *pick_victim(void);
+static bool frame_pinned(struct frame *);
+static bool frame_accessed(struct frame *);
+static bool frame_dirty(struct frame *);
+static bool swap_bound(struct spt_entry *);
+static bool file_bound(struct spt_entry *);
+static size_t gather_cluster(struct frame *, struct frame **);
+static size_t cluster_batch(struct spt_entry *, struct frame **, size_t,
+                            struct spt_entry **, struct tlb_batch *);
+static void evict(struct frame *, struct frame **, size_t);
+static void frame_uncache(struct frame *);
+static unsigned file_frame_hash(const struct hash_elem *, void *);
+static bool file_frame_less(const struct hash_elem *, const struct hash_elem *, void *);
 
-void unlock_frame() {
-    lock_release(&frame_table_lock);
-}
 /*
  * Set up frame table
  */
@@ -32,9 +103,13 @@ void frame_init()
 
     list_init(&frame_list);
     lock_init(&frame_table_lock);
+    list_init(&rss_list);
+    hash_init(&file_frames, file_frame_hash, file_frame_less, NULL);
+    lock_init(&file_frames_lock);
+    cond_init(&zero_cond);
+    zero_page = palloc_get_page(PAL_ASSERT | PAL_ZERO);
 
-    if (!lock_held_by_current_thread(&frame_table_lock))
-        lock_acquire(&frame_table_lock);
+    lock_acquire(&frame_table_lock);
     void *addr = palloc_get_page(PAL_USER | PAL_ZERO);
     /* Creates a frame struct for every page created, and puts it into list */
     while (addr != NULL)
@@ -43,107 +118,1162 @@ void frame_init()
         struct frame *frame_entry = malloc(sizeof(struct frame));
         frame_entry->pinned = false;
         frame_entry->page = NULL;
+        list_init(&frame_entry->sharers);
+        frame_entry->share_cnt = 0;
+        frame_entry->cached = false;
+        frame_entry->zeroed = true;
+        frame_entry->merged = false;
         frame_entry->paddr = addr;
+        lock_init(&frame_entry->lock);
         list_push_front(&frame_list, &frame_entry->elem);
+        frame_cnt++;
         addr = palloc_get_page(PAL_USER | PAL_ZERO);
     }
+
+    /* The user pool hands its pages out in address order, so the list
+       holds them highest first.  huge_claim() still checks a run is
+       contiguous, in case the pool had holes. */
+    frame_index = malloc(frame_cnt * sizeof *frame_index);
+    ASSERT(frame_index != NULL);
+    size_t i = frame_cnt;
+    for (struct list_elem *e = list_begin(&frame_list); e != list_end(&frame_list); e = list_next(e))
+        frame_index[--i] = list_entry(e, struct frame, elem);
+    lock_release(&frame_table_lock);
+    thread_create("zero_daemon", NICE_MAX, zero_daemon, NULL);
+    thread_create("wss_daemon", NICE_MAX, wss_daemon, NULL);
+}
+
+/*
+ * Starts accounting for RSS, the resident set of a new process that
+ * has no pages yet, inheriting the limits of PARENT if not NULL.
+ */
+void rss_register(struct rss *rss, const struct rss *parent)
+{
+    rss->resident = 0;
+    rss->soft_limit = parent != NULL ? parent->soft_limit : 0;
+    rss->hard_limit = parent != NULL ? parent->hard_limit : 0;
+    rss->working_set = 0;
+    rss->sampled = 0;
+    rss->faults = 0;
+    rss->major_faults = 0;
+    lock_acquire(&frame_table_lock);
+    list_push_back(&rss_list, &rss->elem);
     lock_release(&frame_table_lock);
 }
 
+/*
+ * Stops accounting for RSS, whose process has given up all its pages.
+ */
+void rss_unregister(struct rss *rss)
+{
+    ASSERT(rss->resident == 0);
+    lock_acquire(&frame_table_lock);
+    list_remove(&rss->elem);
+    lock_release(&frame_table_lock);
+}
+
+/* Counts PAGE's new frame against its owner. */
+static void charge(struct spt_entry *page)
+{
+    atomic_inci(&page->rss->resident);
+}
+
+/* Takes PAGE's frame, about to be dropped, off its owner's count. */
+static void uncharge(struct spt_entry *page)
+{
+    atomic_deci(&page->rss->resident);
+}
+
 /**
  * Find a usable frame for an incoming frame request.
+ * The frame is returned pinned; the caller fills it, installs it and
+ * then calls frame_unpin().  The table lock is dropped before any
+ * eviction I/O, so faults on other CPUs only contend on the scan.
+ * Its old contents are left in place: the caller overwrites them.
  */
 struct frame *find_frame(struct spt_entry * page)
 {
-    for (struct list_elem *e = list_begin(&frame_list); e != list_end(&frame_list); e = list_next(e))
-    {
-        struct frame *f = list_entry(e, struct frame, elem);
-        if (f->pinned)
-            continue;
+    return get_frame(page, false);
+}
 
-        else if (f->page == NULL || f->page->pagedir == NULL || f->page->vaddr == NULL )
+/*
+ * Like find_frame(), but the frame comes back filled with zeros, taken
+ * from the frames the zero daemon already cleared when there is one.
+ */
+struct frame *find_zeroed_frame(struct spt_entry *page)
+{
+    return get_frame(page, true);
+}
+
+/*
+ * Finds a frame for PAGE, preferring a free one that is already zeroed
+ * if ZERO, and one that is not otherwise so the zeroed ones are kept
+ * for the faults that need them.
+ */
+static struct frame *get_frame(struct spt_entry *page, bool zero)
+{
+    struct frame *f = NULL;
+    struct rss *rss = page->rss;
+
+    lock_acquire(&frame_table_lock);
+    /* A process at its hard limit makes room among its own pages, even
+       with frames to spare; failing that, it takes one like anyone. */
+    if (rss->hard_limit > 0 && atomic_load(&rss->resident) >= rss->hard_limit)
+        f = pick_own_victim(rss);
+    while (f == NULL)
+    {
+        for (struct list_elem *e = list_begin(&frame_list); e != list_end(&frame_list); e = list_next(e))
         {
-            list_remove(e);
-            list_push_back(&frame_list, e);
-            f->page = page;
-            page->frame = f;
-            return f;
+            struct frame *cur = list_entry(e, struct frame, elem);
+            if (!cur->pinned && cur->page == NULL)
+            {
+                if (f == NULL)
+                    f = cur;
+                if (cur->zeroed == zero) {
+                    f = cur;
+                    break;
+                }
+            }
+        }
+        if (f == NULL && frames_lent > 0)
+        {
+            /* The buffer cache gives up a frame before anyone's page. */
+            lock_release(&frame_table_lock);
+            bool returned = cache_shrink();
+            lock_acquire(&frame_table_lock);
+            if (returned)
+                continue;
+        }
+        if (f == NULL)
+            f = pick_victim();
+        if (f == NULL)
+        {
+            /* Every frame is pinned by an in-flight fault; let them finish. */
+            lock_release(&frame_table_lock);
+            thread_yield();
+            lock_acquire(&frame_table_lock);
         }
-        
     }
-    struct frame *f;
-        
-    f = evict();
-    ASSERT(f != NULL);
+    f->pinned = true;
+    bool zeroed = f->zeroed;
+    f->zeroed = false;
+    f->merged = false;
     list_remove(&f->elem);
     list_push_back(&frame_list, &f->elem);
+    struct frame *cluster[SWAP_CLUSTER_PAGES - 1];
+    size_t cluster_cnt = f->page != NULL ? gather_cluster(f, cluster) : 0;
+    lock_release(&frame_table_lock);
+
+    lock_acquire(&f->lock);
+    if (f->page != NULL)
+        evict(f, cluster, cluster_cnt);
+    if (zero && !zeroed)
+        memset(f->paddr, 0, PGSIZE);
+    lock_acquire(&frame_table_lock);
     f->page = page;
+    list_init(&f->sharers);
+    list_push_back(&f->sharers, &page->share_elem);
+    f->share_cnt = 1;
+    lock_release(&frame_table_lock);
+    lock_release(&f->lock);
+
     page->frame = f;
+    charge(page);
     return f;
 }
 
 /*
- * Frees frame
+ * Pins F, if no one else has it pinned and it still holds PAGE, so that
+ * PAGE's contents stay put until frame_unpin(). Returns false if not:
+ * F is probably being evicted.
+ */
+bool frame_pin(struct frame *f, struct spt_entry *page)
+{
+    bool pinned = false;
+
+    lock_acquire(&frame_table_lock);
+    if (!f->pinned && page->frame == f) {
+        f->pinned = true;
+        pinned = true;
+    }
+    lock_release(&frame_table_lock);
+    return pinned;
+}
+
+/*
+ * Lends a free frame to the buffer cache to grow into, pinned so that
+ * nothing else uses it until frame_return(). Returns NULL unless more
+ * than 1/LEND_RESERVE of the frames are free: the cache never makes
+ * anyone's page go.
+ */
+struct frame *frame_lend(void)
+{
+    struct frame *f = NULL;
+    size_t free_cnt = 0;
+
+    if (frame_index == NULL)
+        return NULL;    /* The file system comes up first */
+    lock_acquire(&frame_table_lock);
+    for (struct list_elem *e = list_begin(&frame_list); e != list_end(&frame_list); e = list_next(e))
+    {
+        struct frame *cur = list_entry(e, struct frame, elem);
+        if (!cur->pinned && cur->page == NULL)
+        {
+            free_cnt++;
+            f = cur;
+        }
+    }
+    if (f != NULL && free_cnt > frame_cnt / LEND_RESERVE)
+    {
+        f->pinned = true;
+        f->zeroed = false;
+        frames_lent++;
+    }
+    else
+        f = NULL;
+    lock_release(&frame_table_lock);
+    return f;
+}
+
+/*
+ * Takes back frame F from the buffer cache. Its contents are left for
+ * the zero daemon to clear.
+ */
+void frame_return(struct frame *f)
+{
+    lock_acquire(&frame_table_lock);
+    ASSERT(f->pinned && f->page == NULL);
+    f->pinned = false;
+    frames_lent--;
+    zero_pending++;
+    cond_signal(&zero_cond, &frame_table_lock);
+    lock_release(&frame_table_lock);
+}
+
+/*
+ * Makes a frame returned by find_frame() eligible for eviction again.
+ */
+void frame_unpin(struct frame *f)
+{
+    lock_acquire(&frame_table_lock);
+    f->pinned = false;
+    lock_release(&frame_table_lock);
+}
+
+/*
+ * Frees frame, dropping every page that maps it. Caller must hold the
+ * frame's lock. Its contents are left for the zero daemon to clear.
  */
 void free_frame(struct frame *f)
 {
-    //list_remove(&f->elem);
+    ASSERT(lock_held_by_current_thread(&f->lock));
+    frame_uncache(f);
+    lock_acquire(&frame_table_lock);
     f->page = NULL;
-    //list_push_back(&frame_list, &f->elem);
+    list_init(&f->sharers);
+    f->share_cnt = 0;
+    f->merged = false;
+    zero_pending++;
+    cond_signal(&zero_cond, &frame_table_lock);
+    lock_release(&frame_table_lock);
+}
+
+/*
+ * Maps PAGE, a page that has never been written, read-only onto the
+ * page of zeros shared by every such page in the system. The first
+ * write to it faults and gets a private frame (see load_zero_page).
+ * PAGE's page directory need not be the current one.
+ */
+bool frame_map_zero(struct spt_entry *page)
+{
+    if (!pagedir_set_page(page->pagedir, page->vaddr, zero_page, false))
+        return false;
+    page->page_status = 5;
+    return true;
+}
+
+/*
+ * Maps the HUGE_PAGE_SIZE-aligned block around PAGE, a page of the
+ * current process not loaded yet, with one huge page: when huge pages
+ * are on, the block lies whole in a writable anonymous area with none
+ * of it loaded, the process's hard limit leaves room for all of it,
+ * and an aligned run of free frames is there to back it. Every page
+ * of the block gets its frame from the run, so evicting one later
+ * just splits the huge page (see pagedir.c). Returns false, with PAGE
+ * untouched, if it cannot, and the fault maps a 4 kB page instead.
+ */
+bool frame_map_huge(struct spt_entry *page)
+{
+    struct thread *t = thread_current();
+    struct rss *rss = page->rss;
+    uint8_t *base = (uint8_t *) ((uintptr_t) page->vaddr & PDE_HUGE_ADDR);
+    size_t run, i;
+
+    if (!huge_pages || !huge_candidate(page))
+        return false;
+    if (rss->hard_limit > 0
+        && atomic_load(&rss->resident) + (int) HUGE_PAGE_PAGES > rss->hard_limit)
+        return false;
+    run = huge_claim();
+    if (run == BITMAP_ERROR)
+        return false;
+
+    for (i = 0; i < HUGE_PAGE_PAGES; i++) {
+        struct frame *f = frame_index[run + i];
+        if (!f->zeroed)
+            memset(f->paddr, 0, PGSIZE);
+    }
+
+    lock_acquire(&t->spt_lock);
+    for (i = 0; i < HUGE_PAGE_PAGES; i++) {
+        struct spt_entry *p = get_page_from_spt(base + i * PGSIZE);
+        if (p == NULL) {
+            lock_release(&t->spt_lock);
+            huge_release(run);
+            return false;
+        }
+    }
+    for (i = 0; i < HUGE_PAGE_PAGES; i++) {
+        struct spt_entry *p = get_page_from_spt(base + i * PGSIZE);
+        struct frame *f = frame_index[run + i];
+        lock_acquire(&f->lock);
+        lock_acquire(&frame_table_lock);
+        f->page = p;
+        list_init(&f->sharers);
+        list_push_back(&f->sharers, &p->share_elem);
+        f->share_cnt = 1;
+        f->zeroed = false;
+        lock_release(&frame_table_lock);
+        lock_release(&f->lock);
+        p->frame = f;
+        charge(p);
+        p->page_status = 3;
+    }
+    lock_release(&t->spt_lock);
+
+    bool mapped = pagedir_set_huge(t->pagedir, base, frame_index[run]->paddr, true);
+    for (i = 0; i < HUGE_PAGE_PAGES && !mapped; i++) {
+        if (!install_page(base + i * PGSIZE, frame_index[run + i]->paddr, true)) {
+            for (i = 0; i < HUGE_PAGE_PAGES; i++)
+                frame_unpin(frame_index[run + i]);
+            thread_exit(-1);
+        }
+    }
+    for (i = 0; i < HUGE_PAGE_PAGES; i++)
+        frame_unpin(frame_index[run + i]);
+    return true;
+}
+
+/*
+ * True if the huge page block around PAGE qualifies for
+ * frame_map_huge(): all of it in one writable area with no file behind
+ * it there, and none of it loaded. Mmapped areas never qualify: the
+ * huge page has a single dirty bit, so writing one byte would make
+ * munmap, msync and eviction write all of it back to the file.
+ */
+static bool huge_candidate(struct spt_entry *page)
+{
+    struct thread *t = thread_current();
+    uint8_t *base = (uint8_t *) ((uintptr_t) page->vaddr & PDE_HUGE_ADDR);
+    uint8_t *end = base + HUGE_PAGE_SIZE;
+    bool ok;
+
+    lock_acquire(&t->spt_lock);
+    struct vma *v = vma_find(&t->vmas, base);
+    ok = v != NULL && v->end >= end && v->writable
+         && !v->is_mmap && v->file_bytes <= (size_t) (base - v->start);
+    for (struct spt_entry *p = spt_next(&t->spt, base, end); ok && p != NULL;
+         p = spt_next(&t->spt, (uint8_t *) p->vaddr + PGSIZE, end))
+        ok = p->page_status == 2 && p->frame == NULL && !p->pinned;
+    lock_release(&t->spt_lock);
+    return ok;
+}
+
+/*
+ * Finds HUGE_PAGE_PAGES free frames, physically contiguous and aligned
+ * to HUGE_PAGE_SIZE, and pins them all. Returns the index of the first
+ * in frame_index, or BITMAP_ERROR if there is no such run.
+ */
+static size_t huge_claim(void)
+{
+    size_t run = BITMAP_ERROR;
+
+    lock_acquire(&frame_table_lock);
+    for (size_t r = 0; run == BITMAP_ERROR && r + HUGE_PAGE_PAGES <= frame_cnt; r++) {
+        uint8_t *start = frame_index[r]->paddr;
+        size_t i;
+        if (vtop(start) % HUGE_PAGE_SIZE != 0
+            || frame_index[r + HUGE_PAGE_PAGES - 1]->paddr != start + (HUGE_PAGE_PAGES - 1) * PGSIZE)
+            continue;
+        for (i = 0; i < HUGE_PAGE_PAGES; i++) {
+            struct frame *f = frame_index[r + i];
+            if (f->pinned || f->page != NULL)
+                break;
+        }
+        if (i == HUGE_PAGE_PAGES)
+            run = r;
+    }
+    for (size_t i = 0; run != BITMAP_ERROR && i < HUGE_PAGE_PAGES; i++) {
+        struct frame *f = frame_index[run + i];
+        f->pinned = true;
+        f->merged = false;
+        list_remove(&f->elem);
+        list_push_back(&frame_list, &f->elem);
+    }
+    lock_release(&frame_table_lock);
+    return run;
+}
+
+/*
+ * Gives back a run claimed by huge_claim() and never used.
+ */
+static void huge_release(size_t run)
+{
+    lock_acquire(&frame_table_lock);
+    for (size_t i = 0; i < HUGE_PAGE_PAGES; i++) {
+        frame_index[run + i]->pinned = false;
+        frame_index[run + i]->zeroed = false;
+    }
+    zero_pending++;
+    cond_signal(&zero_cond, &frame_table_lock);
+    lock_release(&frame_table_lock);
+}
+
+/*
+ * Zeroes free frames in the background, so that the stack and BSS
+ * faults taking them with find_zeroed_frame() need not. Runs at the
+ * lowest priority and sleeps until free_frame() hands it work; frames
+ * reused straight from eviction never pass through here.
+ */
+static void zero_daemon(void *aux UNUSED)
+{
+    lock_acquire(&frame_table_lock);
+    for (;;)
+    {
+        while (zero_pending == 0)
+            cond_wait(&zero_cond, &frame_table_lock);
+        zero_pending = 0;
+
+        /* A pinned frame keeps its place in the list, so the sweep can
+           carry on from it once the lock is back. */
+        for (struct list_elem *e = list_begin(&frame_list); e != list_end(&frame_list); e = list_next(e))
+        {
+            struct frame *f = list_entry(e, struct frame, elem);
+            if (f->pinned || f->page != NULL || f->zeroed)
+                continue;
+            f->pinned = true;
+            lock_release(&frame_table_lock);
+            memset(f->paddr, 0, PGSIZE);
+            lock_acquire(&frame_table_lock);
+            f->zeroed = true;
+            f->pinned = false;
+        }
+    }
+}
+
+/*
+ * Maps PAGE, a read-only page of the current process backed by its
+ * file, onto the frame that already holds the same bytes of the same
+ * file for some other page, if the page cache has one. Returns false
+ * if it does not, in which case PAGE is untouched.
+ */
+bool frame_map_shared(struct spt_entry *page)
+{
+    struct frame key;
+    struct hash_elem *e;
+    struct frame *f;
+
+    key.inode = file_get_inode(page->file);
+    key.offset = page->offset;
+    key.read_bytes = page->bytes_read;
+    lock_acquire(&file_frames_lock);
+    e = hash_find(&file_frames, &key.cache_elem);
+    f = e != NULL ? hash_entry(e, struct frame, cache_elem) : NULL;
+    lock_release(&file_frames_lock);
+    if (f == NULL)
+        return false;
+
+    /* The key only changes under the frame's lock, so recheck it there:
+       the frame may have been evicted and reused since the lookup. */
+    lock_acquire(&f->lock);
+    if (!f->cached || f->inode != key.inode || f->offset != key.offset
+        || f->read_bytes != key.read_bytes) {
+        lock_release(&f->lock);
+        return false;
+    }
+    if (!install_page(page->vaddr, f->paddr, false)) {
+        lock_release(&f->lock);
+        thread_exit(-1);
+    }
+    frame_add_sharer(f, page);
+    page->page_status = 3;
+    lock_release(&f->lock);
+    return true;
+}
+
+/*
+ * Enters pinned frame F, just filled from PAGE's file, into the page
+ * cache so that other processes mapping the same read-only bytes share
+ * it. If another frame already holds them, F simply stays private.
+ */
+void frame_publish(struct frame *f, struct spt_entry *page)
+{
+    ASSERT(!page->writable);
+
+    lock_acquire(&f->lock);
+    f->inode = file_get_inode(page->file);
+    f->offset = page->offset;
+    f->read_bytes = page->bytes_read;
+    lock_acquire(&file_frames_lock);
+    f->cached = hash_insert(&file_frames, &f->cache_elem) == NULL;
+    lock_release(&file_frames_lock);
+    lock_release(&f->lock);
+}
+
+/*
+ * Adds PAGE to the pages mapping F. Caller must hold the frame's lock
+ * and map PAGE itself.
+ */
+void frame_add_sharer(struct frame *f, struct spt_entry *page)
+{
+    ASSERT(lock_held_by_current_thread(&f->lock));
+    lock_acquire(&frame_table_lock);
+    list_push_back(&f->sharers, &page->share_elem);
+    f->share_cnt++;
+    lock_release(&frame_table_lock);
+    page->frame = f;
+    charge(page);
+}
+
+/*
+ * Removes PAGE from the pages mapping F, freeing F when it was the
+ * last one. Caller must hold the frame's lock and unmap PAGE itself.
+ */
+void frame_remove_sharer(struct frame *f, struct spt_entry *page)
+{
+    ASSERT(lock_held_by_current_thread(&f->lock));
+    ASSERT(page->frame == f);
+
+    if (f->share_cnt == 1) {
+        free_frame(f);
+    }
+    else {
+        lock_acquire(&frame_table_lock);
+        list_remove(&page->share_elem);
+        f->share_cnt--;
+        if (f->page == page)
+            f->page = list_entry(list_front(&f->sharers), struct spt_entry, share_elem);
+        lock_release(&frame_table_lock);
+    }
+    page->frame = NULL;
+    uncharge(page);
 }
 
 /*
- * Eviction - choose a frame to clear out and saves/swaps as needed
+ * Starts the background scanner that merges identical anonymous pages
+ * of different processes into one copy-on-write frame.
  */
-struct frame *evict(void)
+void ksm_start(void)
 {
-    struct frame *candidate = NULL;
+    ksm_running = true;
+    thread_create("ksm_daemon", NICE_MAX, ksm_daemon, NULL);
+}
+
+/*
+ * Prints how much memory page merging is saving right now, and how
+ * many frames resident set limits took back.
+ */
+void frame_print_stats(void)
+{
+    int saved = 0;
+
+    if (rss_limit_evictions > 0)
+        printf("RSS: %d frames evicted for resident set limits\n", rss_limit_evictions);
+    if (!ksm_running)
+        return;
+    lock_acquire(&frame_table_lock);
     for (struct list_elem *e = list_begin(&frame_list); e != list_end(&frame_list); e = list_next(e)) {
         struct frame *f = list_entry(e, struct frame, elem);
-        ASSERT(f != NULL);
-        ASSERT(f->page != NULL);
-        if (!f->page->pinned) {
-            bool page_accessed = pagedir_is_accessed(f->page->pagedir, f->page->vaddr);
-            ASSERT(f->page != NULL);
-            if (!page_accessed) {
-                candidate = f;
-                break;
-            } else {
-                pagedir_set_accessed(f->page->pagedir, f->page->vaddr, false);
+        if (f->merged)
+            saved += f->share_cnt - 1;
+    }
+    lock_release(&frame_table_lock);
+    printf("KSM: %d pages merged, %d bytes saved\n", ksm_merges, saved * PGSIZE);
+}
+
+/*
+ * Samples the working set of every process once every
+ * WSS_SAMPLE_TICKS.
+ */
+static void wss_daemon(void *aux UNUSED)
+{
+    for (;;)
+    {
+        timer_sleep(WSS_SAMPLE_TICKS);
+        wss_sample();
+    }
+}
+
+/*
+ * Counts, for every process, its pages accessed since the last sample,
+ * and clears their accessed bits for the next one. The bits are
+ * cleared without a TLB flush (see pagedir.c), so a page whose entry
+ * stays cached is missed until it drops out of the TLB; the estimate
+ * errs low. The clock in pick_victim() then sees pages untouched
+ * since the last sample as idle.
+ */
+static void wss_sample(void)
+{
+    struct list_elem *e;
+
+    lock_acquire(&frame_table_lock);
+    for (e = list_begin(&rss_list); e != list_end(&rss_list); e = list_next(e))
+        list_entry(e, struct rss, elem)->sampled = 0;
+    for (e = list_begin(&frame_list); e != list_end(&frame_list); e = list_next(e)) {
+        struct frame *f = list_entry(e, struct frame, elem);
+        if (f->page == NULL)
+            continue;
+        for (struct list_elem *s = list_begin(&f->sharers); s != list_end(&f->sharers); s = list_next(s)) {
+            struct spt_entry *p = list_entry(s, struct spt_entry, share_elem);
+            if (pagedir_test_and_clear_accessed(p->pagedir, p->vaddr))
+                p->rss->sampled++;
+        }
+    }
+    for (e = list_begin(&rss_list); e != list_end(&rss_list); e = list_next(e)) {
+        struct rss *rss = list_entry(e, struct rss, elem);
+        rss->working_set = rss->sampled;
+    }
+    lock_release(&frame_table_lock);
+}
+
+/*
+ * Sweeps the frame table once every KSM_SCAN_TICKS. Each sweep starts
+ * over with no frames seen, so contents that changed since the last
+ * one are simply found under their new checksum.
+ */
+static void ksm_daemon(void *aux UNUSED)
+{
+    struct hash seen;
+
+    hash_init(&seen, ksm_item_hash, ksm_item_less, NULL);
+    for (;;)
+    {
+        timer_sleep(KSM_SCAN_TICKS);
+        ksm_scan(&seen);
+        hash_clear(&seen, ksm_item_free);
+    }
+}
+
+/*
+ * Checksums every candidate frame and merges it into the first frame
+ * of the sweep with the same checksum, if their contents really match.
+ * Frame structs are never freed, so the snapshot taken under the table
+ * lock stays safe to walk without it; ksm_merge() rechecks each one.
+ */
+static void ksm_scan(struct hash *seen)
+{
+    struct frame **frames;
+    size_t cnt = 0;
+
+    lock_acquire(&frame_table_lock);
+    frames = malloc(list_size(&frame_list) * sizeof *frames);
+    if (frames == NULL) {
+        lock_release(&frame_table_lock);
+        return;
+    }
+    for (struct list_elem *e = list_begin(&frame_list); e != list_end(&frame_list); e = list_next(e)) {
+        struct frame *f = list_entry(e, struct frame, elem);
+        if (ksm_candidate(f))
+            frames[cnt++] = f;
+    }
+    lock_release(&frame_table_lock);
+
+    for (size_t i = 0; i < cnt; i++) {
+        struct ksm_item key, *item;
+        struct hash_elem *e;
+
+        /* Racy, but only a hint: the merge compares under the locks. */
+        key.checksum = hash_bytes(frames[i]->paddr, PGSIZE);
+        e = hash_find(seen, &key.elem);
+        if (e != NULL) {
+            ksm_merge(frames[i], hash_entry(e, struct ksm_item, elem)->frame);
+            continue;
+        }
+        item = malloc(sizeof *item);
+        if (item == NULL)
+            break;
+        item->checksum = key.checksum;
+        item->frame = frames[i];
+        hash_insert(seen, &item->elem);
+    }
+    free(frames);
+}
+
+/*
+ * True if F holds an anonymous page (stack or program data, never an
+ * mmapped file) that could be merged. Must be called with
+ * frame_table_lock held.
+ */
+static bool ksm_candidate(struct frame *f)
+{
+    struct spt_entry *p = f->page;
+    return !f->pinned && p != NULL && !f->cached && p->page_status == 3
+           && p->writable && !p->is_mmap && !frame_pinned(f);
+}
+
+/*
+ * Moves every page mapping frame A onto frame B, read-only, if the two
+ * hold the same bytes, and frees A. Writes to the pages then split them
+ * apart again through the copy-on-write fault. Returns true if merged.
+ */
+static bool ksm_merge(struct frame *a, struct frame *b)
+{
+    struct frame *first = a < b ? a : b, *second = a < b ? b : a;
+    bool merged = false, a_rw, b_rw;
+
+    if (a == b)
+        return false;
+    lock_acquire(&frame_table_lock);
+    if (!ksm_candidate(a) || !ksm_candidate(b)) {
+        lock_release(&frame_table_lock);
+        return false;
+    }
+    a->pinned = b->pinned = true;
+    lock_release(&frame_table_lock);
+
+    /* Pinned, neither can be picked as an eviction companion, so no
+       one else ever holds one of these locks while waiting for the
+       other. */
+    lock_acquire(&first->lock);
+    lock_acquire(&second->lock);
+    if (a->page == NULL || b->page == NULL || a->page->page_status != 3
+        || b->page->page_status != 3)
+        goto done;
+
+    /* Write-protect first, so neither can change after the compare.
+       If they differ, give back write access to whichever had it, or
+       every later write would take a needless copy-on-write fault. */
+    a_rw = ksm_protect(a);
+    b_rw = ksm_protect(b);
+    if (memcmp(a->paddr, b->paddr, PGSIZE) != 0) {
+        if (a_rw)
+            ksm_unprotect(a);
+        if (b_rw)
+            ksm_unprotect(b);
+        goto done;
+    }
+
+    /* A page's frame is never NULL on the way across, so its owner
+       faulting meanwhile just waits on one of the two locks. */
+    while (!list_empty(&a->sharers)) {
+        struct spt_entry *p = list_entry(list_front(&a->sharers), struct spt_entry, share_elem);
+        pagedir_clear_page(p->pagedir, p->vaddr);
+        lock_acquire(&frame_table_lock);
+        list_remove(&p->share_elem);
+        a->share_cnt--;
+        list_push_back(&b->sharers, &p->share_elem);
+        b->share_cnt++;
+        lock_release(&frame_table_lock);
+        p->frame = b;
+        if (!pagedir_set_page(p->pagedir, p->vaddr, b->paddr, false))
+            PANIC("KSM: remapping a merged page failed");
+        ksm_merges++;
+    }
+    free_frame(a);
+    b->merged = true;
+    merged = true;
+
+done:
+    lock_release(&second->lock);
+    lock_release(&first->lock);
+    frame_unpin(a);
+    frame_unpin(b);
+    return merged;
+}
+
+/*
+ * Write-protects every page mapping F, whose lock must be held.
+ * Returns true if any of them was writable.
+ */
+static bool ksm_protect(struct frame *f)
+{
+    bool writable = false;
+
+    for (struct list_elem *e = list_begin(&f->sharers); e != list_end(&f->sharers); e = list_next(e)) {
+        struct spt_entry *p = list_entry(e, struct spt_entry, share_elem);
+        if (pagedir_is_writable(p->pagedir, p->vaddr)) {
+            writable = true;
+            pagedir_set_writable(p->pagedir, p->vaddr, false);
+        }
+    }
+    return writable;
+}
+
+/*
+ * Undoes ksm_protect() on F, which was writable: only a frame with
+ * a single page mapping it is, so that page gets write access back.
+ * F's lock must be held.
+ */
+static void ksm_unprotect(struct frame *f)
+{
+    for (struct list_elem *e = list_begin(&f->sharers); e != list_end(&f->sharers); e = list_next(e)) {
+        struct spt_entry *p = list_entry(e, struct spt_entry, share_elem);
+        pagedir_set_writable(p->pagedir, p->vaddr, true);
+    }
+}
+
+/* KSM checksum table hash function */
+static unsigned ksm_item_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+    return hash_int(hash_entry(e, struct ksm_item, elem)->checksum);
+}
+
+/* KSM checksum table ordering */
+static bool ksm_item_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+    return hash_entry(a, struct ksm_item, elem)->checksum
+           < hash_entry(b, struct ksm_item, elem)->checksum;
+}
+
+/* Frees a KSM checksum table entry */
+static void ksm_item_free(struct hash_elem *e, void *aux UNUSED)
+{
+    free(hash_entry(e, struct ksm_item, elem));
+}
+
+/*
+ * Clock over the frame table. Must be called with frame_table_lock held.
+ * Returns NULL if every frame is pinned.
+ */
+static struct frame *pick_victim(void)
+{
+    /* Read-ahead pages nobody has touched yet cost nothing to drop. */
+    for (struct list_elem *e = list_begin(&frame_list); e != list_end(&frame_list); e = list_next(e)) {
+        struct frame *f = list_entry(e, struct frame, elem);
+        if (!f->pinned && f->page != NULL && f->page->page_status == 4)
+            return f;
+    }
+    /* Then the idle pages of processes above their soft limit, so the
+       one that outgrew its share gives frames back before the rest. */
+    for (int run = 0; run < 2; run++) {
+        for (struct list_elem *e = list_begin(&frame_list); e != list_end(&frame_list); e = list_next(e)) {
+            struct frame *f = list_entry(e, struct frame, elem);
+            if (f->pinned || f->page == NULL || !over_soft_limit(f) || frame_pinned(f))
+                continue;
+            if (!frame_accessed(f)) {
+                rss_limit_evictions++;
+                return f;
             }
         }
     }
-    if (candidate == NULL) {
-        /* 2nd run. Unless all the pages are pinned, this should find a candidate. */
+    /* 2 runs. Unless all the pages are pinned, the 2nd should find a candidate. */
+    for (int run = 0; run < 2; run++) {
         for (struct list_elem *e = list_begin(&frame_list); e != list_end(&frame_list); e = list_next(e)) {
             struct frame *f = list_entry(e, struct frame, elem);
-            if (!f->page->pinned) {
-                bool page_accessed = pagedir_is_accessed(f->page->pagedir, f->page->vaddr);
-                if (!page_accessed) {
-                    candidate = f;
-                    break;
-                } else {
-                    pagedir_set_accessed(f->page->pagedir, f->page->vaddr, false);
-                }
+            if (f->pinned || f->page == NULL || frame_pinned(f))
+                continue;
+            if (!frame_accessed(f))
+                return f;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * True if F is private to a process holding more frames than its soft
+ * limit. Must be called with frame_table_lock held.
+ */
+static bool over_soft_limit(struct frame *f)
+{
+    struct rss *rss = f->page->rss;
+    return f->share_cnt == 1 && rss->soft_limit > 0
+           && atomic_load(&rss->resident) > rss->soft_limit;
+}
+
+/*
+ * Clock over the frames private to RSS's process. Must be called
+ * with frame_table_lock held. Returns NULL if every one is pinned.
+ */
+static struct frame *pick_own_victim(struct rss *rss)
+{
+    for (int run = 0; run < 2; run++) {
+        for (struct list_elem *e = list_begin(&frame_list); e != list_end(&frame_list); e = list_next(e)) {
+            struct frame *f = list_entry(e, struct frame, elem);
+            if (f->pinned || f->page == NULL || f->share_cnt != 1
+                || f->page->rss != rss || frame_pinned(f))
+                continue;
+            if (!frame_accessed(f)) {
+                rss_limit_evictions++;
+                return f;
             }
         }
     }
-    ASSERT(candidate != NULL);
-    ASSERT(candidate->page != NULL);
-    candidate->page->pinned = true;
-    
-    pagedir_clear_page(candidate->page->pagedir, candidate->page->vaddr);
+    return NULL;
+}
+
+/*
+ * True if any page mapping F is pinned. Must be called with
+ * frame_table_lock held.
+ */
+static bool frame_pinned(struct frame *f)
+{
+    for (struct list_elem *e = list_begin(&f->sharers); e != list_end(&f->sharers); e = list_next(e)) {
+        struct spt_entry *p = list_entry(e, struct spt_entry, share_elem);
+        if (p->pinned)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * True if any page mapping F was accessed since the last call; clears
+ * the accessed bits for the next sweep of the clock. Must be called
+ * with frame_table_lock held.
+ */
+static bool frame_accessed(struct frame *f)
+{
+    bool accessed = false;
+    for (struct list_elem *e = list_begin(&f->sharers); e != list_end(&f->sharers); e = list_next(e)) {
+        struct spt_entry *p = list_entry(e, struct spt_entry, share_elem);
+        if (pagedir_is_accessed(p->pagedir, p->vaddr)) {
+            accessed = true;
+            pagedir_set_accessed(p->pagedir, p->vaddr, false);
+        }
+    }
+    return accessed;
+}
+
+/*
+ * True if any page mapping F has written to it.
+ */
+static bool frame_dirty(struct frame *f)
+{
+    for (struct list_elem *e = list_begin(&f->sharers); e != list_end(&f->sharers); e = list_next(e)) {
+        struct spt_entry *p = list_entry(e, struct spt_entry, share_elem);
+        if (pagedir_is_dirty(p->pagedir, p->vaddr))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * True if evicting PAGE sends it to swap rather than back to its file.
+ */
+static bool swap_bound(struct spt_entry *page)
+{
+    return !page->is_mmap && !(!page->writable && page->file != NULL);
+}
+
+/*
+ * True if evicting PAGE, a page of an mmapped file, writes it back.
+ */
+static bool file_bound(struct spt_entry *page)
+{
+    return page->is_mmap && pagedir_is_dirty(page->pagedir, page->vaddr);
+}
+
+/*
+ * Picks pages to go out to swap together with victim V, so the batch
+ * costs one contiguous disk write and a later fault on any of them reads
+ * from neighbouring slots. Candidates belong to the same address space,
+ * sit in the same SWAP_CLUSTER_PAGES-aligned window of virtual memory,
+ * and are idle (not accessed since the clock last cleared them).
+ * Shared frames are left out; they are evicted on their own.
+ * A dirty mmapped V takes dirty pages of the same mapping instead, which
+ * writeback coalesces with it (see writeback.c).
+ * They are pinned and stored into OUT sorted by address, leaving room
+ * for V itself. Must be called with frame_table_lock held.
+ */
+static size_t gather_cluster(struct frame *v, struct frame **out)
+{
+    struct spt_entry *vp = v->page;
+    uintptr_t window = pg_no(vp->vaddr) / SWAP_CLUSTER_PAGES;
+    bool to_file = file_bound(vp);
+    size_t cnt = 0;
+
+    if (vp->page_status != 3 || v->share_cnt != 1 || !(to_file || swap_bound(vp)))
+        return 0;
+    for (struct list_elem *e = list_begin(&frame_list);
+         e != list_end(&frame_list) && cnt < SWAP_CLUSTER_PAGES - 1; e = list_next(e))
+    {
+        struct frame *cur = list_entry(e, struct frame, elem);
+        struct spt_entry *p = cur->page;
+        if (cur->pinned || p == NULL || cur->share_cnt != 1 || p->pinned
+            || p->page_status != 3 || p->pagedir != vp->pagedir
+            || pg_no(p->vaddr) / SWAP_CLUSTER_PAGES != window
+            || pagedir_is_accessed(p->pagedir, p->vaddr)
+            || !(to_file ? file_bound(p) && p->file == vp->file : swap_bound(p)))
+            continue;
+        cur->pinned = true;
+
+        /* Insertion sort by address; the batch is at most 15 long. */
+        size_t i = cnt++;
+        while (i > 0 && out[i - 1]->page->vaddr > p->vaddr) {
+            out[i] = out[i - 1];
+            i--;
+        }
+        out[i] = cur;
+    }
+    return cnt;
+}
+
+/*
+ * Eviction - clears out the pages held by pinned frame F and saves/swaps
+ * them as needed.  Runs with only F's lock held, so the owners of the
+ * pages wait on that lock (see page_fault) rather than on the frame table.
+ * Read-only file pages are simply dropped; their file still has them.
+ * Mmapped pages go back to their file, and only if dirty.
+ * Pages shared after a fork all take the same swap slot.
+ * The CNT pinned frames in CLUSTER, from gather_cluster(), are written
+ * to swap or to the file in the same batch as F's page and then freed.
+ */
+static void evict(struct frame *f, struct frame **cluster, size_t cnt)
+{
+    struct spt_entry *victim = f->page;
+    struct spt_entry *batch[SWAP_CLUSTER_PAGES];
+    struct frame *freed[SWAP_CLUSTER_PAGES - 1];
+    size_t batch_cnt = 0, freed_cnt = 0;
+    struct list_elem *e;
+    ASSERT(lock_held_by_current_thread(&f->lock));
+    ASSERT(victim != NULL);
+
+    if (victim->page_status == 4) {
+        /* Swap cache: never mapped, and its slot still holds the data. */
+        ASSERT(cnt == 0);
+        victim->page_status = 1;
+        barrier();
+        victim->frame = NULL;
+        uncharge(victim);
+        return;
+    }
+
+    /* Companions may have been freed by their exiting owner, or shared
+       by a fork, since they were picked; only their lock makes the page
+       pointer stable. */
+    for (size_t i = 0; i < cnt; i++) {
+        struct frame *c = cluster[i];
+        lock_acquire(&c->lock);
+        if (c->page == NULL || c->share_cnt != 1) {
+            lock_release(&c->lock);
+            frame_unpin(c);
+            continue;
+        }
+        freed[freed_cnt++] = c;
+    }
 
-    if ( candidate->page->writable && candidate->page->page_status == 0 && pagedir_is_dirty(candidate->page->pagedir, candidate->page->vaddr) ) {
-        lock_file();
-        file_write_at(candidate->page->file, candidate->page->vaddr, candidate->page->bytes_read, candidate->page->offset);
-        unlock_file();
+    /* Unmapping is batched, so each CPU running one of the owners is
+       interrupted once for the whole cluster; the batch is flushed
+       before the contents are read. */
+    struct tlb_batch tlb;
+    pagedir_batch_init(&tlb);
+    for (e = list_begin(&f->sharers); e != list_end(&f->sharers); e = list_next(e)) {
+        struct spt_entry *p = list_entry(e, struct spt_entry, share_elem);
+        pagedir_clear_page_batch(&tlb, p->pagedir, p->vaddr);
+    }
+
+    if (f->cached || (!victim->writable && victim->file != NULL)) {
+        frame_uncache(f);
+        for (e = list_begin(&f->sharers); e != list_end(&f->sharers); e = list_next(e))
+            list_entry(e, struct spt_entry, share_elem)->page_status = 2;
+    }
+    else if (victim->is_mmap) {
+        /* Back to the file, the dirty neighbours gathered into the
+           cluster coalesced with it; a clean page is just dropped and
+           read from the file again on the next fault. */
+        if (freed_cnt > 0 || frame_dirty(f)) {
+            batch_cnt = cluster_batch(victim, freed, freed_cnt, batch, &tlb);
+            pagedir_batch_flush(&tlb);
+            writeback_pages(batch, batch_cnt);
+        }
+        for (e = list_begin(&f->sharers); e != list_end(&f->sharers); e = list_next(e))
+            list_entry(e, struct spt_entry, share_elem)->page_status = 2;
+        for (size_t i = 0; i < freed_cnt; i++)
+            freed[i]->page->page_status = 2;
     }
     else {
-        swap_insert(candidate->page);
+        batch_cnt = cluster_batch(victim, freed, freed_cnt, batch, &tlb);
+        pagedir_batch_flush(&tlb);
+        swap_insert_batch(batch, batch_cnt);
+
+        for (e = list_begin(&f->sharers); e != list_end(&f->sharers); e = list_next(e)) {
+            struct spt_entry *p = list_entry(e, struct spt_entry, share_elem);
+            if (p == victim)
+                continue;
+            p->swap_index = victim->swap_index;
+            p->page_status = 1;
+            swap_ref(p);
+        }
+    }
+
+    pagedir_batch_flush(&tlb);
+    for (size_t i = 0; i < freed_cnt; i++) {
+        struct frame *c = freed[i];
+        struct spt_entry *p = c->page;
+        free_frame(c);
+        barrier();
+        p->frame = NULL;
+        uncharge(p);
+        lock_release(&c->lock);
+        frame_unpin(c);
+    }
+
+    barrier();
+    for (e = list_begin(&f->sharers); e != list_end(&f->sharers); e = list_next(e)) {
+        struct spt_entry *p = list_entry(e, struct spt_entry, share_elem);
+        p->frame = NULL;
+        uncharge(p);
     }
-    
-    memset(candidate->paddr, 0, PGSIZE);
-    candidate->page->pinned = false;
-    return candidate;
-}
\ No newline at end of file
+}
+
+/*
+ * Stores victim VICTIM and the pages of the CNT cluster frames in FREED
+ * into BATCH in address order, and clears the companions' mappings
+ * into TLB. Returns the length of the batch.
+ */
+static size_t cluster_batch(struct spt_entry *victim, struct frame **freed, size_t cnt,
+                            struct spt_entry **batch, struct tlb_batch *tlb)
+{
+    size_t batch_cnt = 0, i = 0;
+
+    for (; i < cnt && freed[i]->page->vaddr < victim->vaddr; i++)
+        batch[batch_cnt++] = freed[i]->page;
+    batch[batch_cnt++] = victim;
+    for (; i < cnt; i++)
+        batch[batch_cnt++] = freed[i]->page;
+    for (i = 0; i < cnt; i++)
+        pagedir_clear_page_batch(tlb, freed[i]->page->pagedir, freed[i]->page->vaddr);
+    return batch_cnt;
+}
+
+/*
+ * Takes F out of the page cache, if it is there. Caller must hold the
+ * frame's lock.
+ */
+static void frame_uncache(struct frame *f)
+{
+    if (!f->cached)
+        return;
+    lock_acquire(&file_frames_lock);
+    hash_delete(&file_frames, &f->cache_elem);
+    lock_release(&file_frames_lock);
+    f->cached = false;
+}
+
+/* Page cache hash function: (inode, offset) */
+static unsigned file_frame_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+    const struct frame *f = hash_entry(e, struct frame, cache_elem);
+    return hash_bytes(&f->inode, sizeof f->inode) ^ hash_int(f->offset);
+}
+
+/* Page cache ordering: by inode, then offset, then read_bytes */
+static bool file_frame_less(const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED)
+{
+    const struct frame *a = hash_entry(a_, struct frame, cache_elem);
+    const struct frame *b = hash_entry(b_, struct frame, cache_elem);
+    if (a->inode != b->inode)
+        return a->inode < b->inode;
+    if (a->offset != b->offset)
+        return a->offset < b->offset;
+    return a->read_bytes < b->read_bytes;
+}
@@ -1,21 +1,94 @@
 #ifndef VM_FRAME_H
 #define VM_FRAME_H
 #include <stdbool.h>
+#include <hash.h>
 #include <list.h>
+#include "filesys/off_t.h"
+#include "threads/synch.h"
 
+struct spt_entry;
+struct inode;
+
+/* Locking:
+   frame_table_lock (in frame.c) protects the frame list, the pinned
+   flags, the page pointers and the sharer lists.  It is only ever
+   held for short, non-blocking scans.  Each frame's own lock is held
+   while its contents are in transit (eviction I/O), so a thread that
+   needs the old contents waits on that one frame instead of on the
+   whole table.  A frame's page pointer and sharers are only changed
+   while holding both locks, and its page cache key only with its own
+   lock.
+
+   Sharing:
+   A frame can be mapped by several pages at once: read-only file
+   pages of the same (inode, offset) found through the page cache,
+   the pages of forked processes until one of them writes, and
+   identical anonymous pages merged by the KSM scanner.  PAGE
+   is any one of them and SHARERS lists them all. */
 struct frame {
-	struct spt_entry * page;
+	struct spt_entry * page; /* A page held by this frame, NULL if free */
+	struct list sharers; /* Every page mapping this frame, via share_elem */
+	int share_cnt; /* Length of sharers */
 	struct list_elem elem; /* List element for frame table */
     bool pinned; /* If pinned, don't evict */
+    struct lock lock; /* Held while the frame's contents are being evicted */
 	void* paddr; /* Physical address */
+    bool zeroed; /* Free and known to hold only zeros */
+    bool merged; /* Pages were merged onto it by the KSM scanner */
+
+    /* Page cache of read-only file pages */
+    bool cached; /* Findable in the page cache under the key below */
+    struct hash_elem cache_elem; /* Element in the page cache */
+    struct inode *inode; /* Key: file's inode */
+    off_t offset; /* Key: offset of the page within the file */
+    size_t read_bytes; /* Key: bytes of the page that come from the file */
+};
+
+/* Resident set of a process: how many of its pages sit in frames,
+   and how many it may keep there.  Sizes are in pages; a limit of 0
+   means none.  A frame shared by several processes counts toward
+   each of them.  Registered processes have their working set sampled
+   about once a second. */
+struct rss {
+    int resident; /* Pages mapped to a frame, changed atomically */
+    int soft_limit; /* Above this, evicted from first when memory is short */
+    int hard_limit; /* At this, new pages replace the process's own */
+    int working_set; /* Pages touched during the last sampling period */
+    int sampled; /* Pages seen touched so far in this one */
+    int faults; /* Page faults, counted by the process itself */
+    int major_faults; /* Those that read the page from a file or swap */
+    struct list_elem elem; /* Element in frame.c's list of resident sets */
 };
 
 /* Methods */
 void frame_init(void);
-void lock_frame(void);
-void unlock_frame(void);
 struct frame* find_frame(struct spt_entry *);
+struct frame* find_zeroed_frame(struct spt_entry *);
+bool frame_pin(struct frame *, struct spt_entry *);
+struct frame *frame_lend(void);
+void frame_return(struct frame *);
+void frame_unpin(struct frame *);
 void free_frame(struct frame *);
-struct frame* evict(void);
 
-#endif
\ No newline at end of file
+/* Resident sets */
+void rss_register(struct rss *, const struct rss *parent);
+void rss_unregister(struct rss *);
+
+/* Sharing */
+bool frame_map_shared(struct spt_entry *);
+void frame_publish(struct frame *, struct spt_entry *);
+void frame_add_sharer(struct frame *, struct spt_entry *);
+void frame_remove_sharer(struct frame *, struct spt_entry *);
+
+/* Zero page */
+bool frame_map_zero(struct spt_entry *);
+
+/* Huge pages */
+extern bool huge_pages;
+bool frame_map_huge(struct spt_entry *);
+
+/* Same-page merging */
+void ksm_start(void);
+void frame_print_stats(void);
+
+#endif
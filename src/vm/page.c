@@ -8,29 +8,206 @@
 #include "vm/frame.h"
 #include "vm/swap.h"
 
-/* Returns a hash value for spt_entry p. */
-unsigned
-page_hash (const struct hash_elem *elem1, void *aux UNUSED)
+/* Radix tree indexes of a user virtual address */
+#define SPT_ROOT_IDX(VA) (pg_no (VA) >> (SPT_MID_BITS + SPT_LEAF_BITS))
+#define SPT_MID_IDX(VA) ((pg_no (VA) >> SPT_LEAF_BITS) & (SPT_MID_CNT - 1))
+#define SPT_LEAF_IDX(VA) (pg_no (VA) & (SPT_LEAF_CNT - 1))
+
+/* Virtual address of the first page under leaf M of root slot R */
+#define SPT_LEAF_ADDR(R, M) \
+  ((uint8_t *) (((((uintptr_t) (R) << SPT_MID_BITS) + (M)) << SPT_LEAF_BITS) << PGBITS))
+
+static struct spt_leaf *spt_leaf (struct spt *, const void *, bool create);
+static struct spt_entry *page_from_vma (struct vma *, void *);
+
+/* Makes S an empty supplemental page table. */
+void
+spt_init (struct spt *s)
 {
-  const struct spt_entry *page = hash_entry (elem1, struct spt_entry, elem);
-  return hash_bytes (&page->vaddr, sizeof page->vaddr);
+  s->root = NULL;
+}
+
+/* Returns the leaf of S covering VADDR. If it does not exist yet,
+   allocates it if CREATE, or returns NULL. */
+static struct spt_leaf *
+spt_leaf (struct spt *s, const void *vaddr, bool create)
+{
+  struct spt_mid **mid;
+  struct spt_leaf **leaf;
+
+  if (s->root == NULL)
+    {
+      if (!create)
+        return NULL;
+      s->root = calloc (SPT_ROOT_CNT, sizeof *s->root);
+      if (s->root == NULL)
+        return NULL;
+    }
+  mid = &s->root[SPT_ROOT_IDX (vaddr)];
+  if (*mid == NULL)
+    {
+      struct spt_mid *new_mid;
+      struct spt_leaf *new_leaf;
+
+      /* Allocate both before linking either in, so that a failure
+         leaves no empty middle node behind. */
+      if (!create || (new_mid = calloc (1, sizeof *new_mid)) == NULL)
+        return NULL;
+      new_leaf = calloc (1, sizeof *new_leaf);
+      if (new_leaf == NULL)
+        {
+          free (new_mid);
+          return NULL;
+        }
+      new_mid->leaves[SPT_MID_IDX (vaddr)] = new_leaf;
+      new_mid->cnt = 1;
+      *mid = new_mid;
+      return new_leaf;
+    }
+  leaf = &(*mid)->leaves[SPT_MID_IDX (vaddr)];
+  if (*leaf == NULL)
+    {
+      if (!create || (*leaf = calloc (1, sizeof **leaf)) == NULL)
+        return NULL;
+      (*mid)->cnt++;
+    }
+  return *leaf;
 }
 
-/* True if spt_entry 1 is before 2 */
-bool is_page_before (const struct hash_elem *elem1, const struct hash_elem *elem2, void *aux UNUSED)
+/* Adds page P to S. Returns false if S already has a page at P's
+   address or memory ran out. */
+bool
+spt_insert (struct spt *s, struct spt_entry *p)
 {
-  const struct spt_entry *page_one = hash_entry (elem1, struct spt_entry, elem);
-  const struct spt_entry *page_two = hash_entry (elem2, struct spt_entry, elem);
+  struct spt_leaf *leaf = spt_leaf (s, p->vaddr, true);
+  struct spt_entry **slot;
+
+  if (leaf == NULL)
+    return false;
+  slot = &leaf->pages[SPT_LEAF_IDX (p->vaddr)];
+  if (*slot != NULL)
+    return false;
+  *slot = p;
+  leaf->cnt++;
+  return true;
+}
 
-  return  pg_no(page_one->vaddr) < pg_no(page_two->vaddr);
+/* Returns the page of S containing VADDR, or NULL. */
+struct spt_entry *
+spt_find (struct spt *s, const void *vaddr)
+{
+  struct spt_leaf *leaf = spt_leaf (s, vaddr, false);
+  return leaf != NULL ? leaf->pages[SPT_LEAF_IDX (vaddr)] : NULL;
+}
+
+/* Takes the page containing VADDR out of S and returns it, or NULL if
+   there is none. Frees tree nodes left empty. */
+struct spt_entry *
+spt_remove (struct spt *s, const void *vaddr)
+{
+  struct spt_mid **mid;
+  struct spt_leaf **leaf;
+  struct spt_entry *p;
+
+  if (s->root == NULL)
+    return NULL;
+  mid = &s->root[SPT_ROOT_IDX (vaddr)];
+  if (*mid == NULL)
+    return NULL;
+  leaf = &(*mid)->leaves[SPT_MID_IDX (vaddr)];
+  if (*leaf == NULL)
+    return NULL;
+  p = (*leaf)->pages[SPT_LEAF_IDX (vaddr)];
+  if (p == NULL)
+    return NULL;
+
+  (*leaf)->pages[SPT_LEAF_IDX (vaddr)] = NULL;
+  if (--(*leaf)->cnt == 0)
+    {
+      free (*leaf);
+      *leaf = NULL;
+      if (--(*mid)->cnt == 0)
+        {
+          free (*mid);
+          *mid = NULL;
+        }
+    }
+  return p;
+}
+
+/* Returns the lowest page of S at or above VADDR and below END, or
+   NULL if there is none. Skips absent subtrees whole, so walking a
+   range page by page costs in proportion to what is mapped there:
+     for (p = spt_next (s, start, end); p != NULL;
+          p = spt_next (s, p->vaddr + PGSIZE, end)) */
+struct spt_entry *
+spt_next (struct spt *s, const void *vaddr, const void *end)
+{
+  const uint8_t *va = pg_round_down (vaddr);
+
+  if (s->root == NULL)
+    return NULL;
+  while (va < (const uint8_t *) end && is_user_vaddr (va))
+    {
+      struct spt_mid *mid = s->root[SPT_ROOT_IDX (va)];
+      if (mid == NULL)
+        {
+          va = SPT_LEAF_ADDR (SPT_ROOT_IDX (va) + 1, 0);
+          continue;
+        }
+      struct spt_leaf *leaf = mid->leaves[SPT_MID_IDX (va)];
+      if (leaf == NULL)
+        {
+          va = SPT_LEAF_ADDR (SPT_ROOT_IDX (va), SPT_MID_IDX (va) + 1);
+          continue;
+        }
+      struct spt_entry *p = leaf->pages[SPT_LEAF_IDX (va)];
+      if (p != NULL)
+        return p;
+      va += PGSIZE;
+    }
+  return NULL;
+}
+
+/* Calls DESTROY on every page of S in address order, then frees the
+   tree. DESTROY may free the page but not touch S. */
+void
+spt_destroy (struct spt *s, void (*destroy) (struct spt_entry *))
+{
+  if (s->root == NULL)
+    return;
+  for (int r = 0; r < SPT_ROOT_CNT; r++)
+    {
+      struct spt_mid *mid = s->root[r];
+      if (mid == NULL)
+        continue;
+      for (int m = 0; m < SPT_MID_CNT; m++)
+        {
+          struct spt_leaf *leaf = mid->leaves[m];
+          if (leaf == NULL)
+            continue;
+          for (int i = 0; i < SPT_LEAF_CNT; i++)
+            if (leaf->pages[i] != NULL)
+              destroy (leaf->pages[i]);
+          free (leaf);
+        }
+      free (mid);
+    }
+  free (s->root);
+  s->root = NULL;
 }
 
 /* Destroy the page. Clear any references as well */
-void destroy_page (struct hash_elem *elem1, void *aux UNUSED)
+void destroy_page (struct spt_entry *page)
 {
-  struct spt_entry *page = hash_entry (elem1, struct spt_entry, elem);
-  if ( page->frame != NULL && page == page->frame->page ) {
-    page->frame->page = NULL;
+  struct frame *f = page->frame;
+  if ( f != NULL ) {
+    /* Waits out an eviction of this page that may be in flight. */
+    lock_acquire (&f->lock);
+    if ( page->frame == f ) {
+      frame_remove_sharer (f, page);
+    }
+    lock_release (&f->lock);
   }
   if ( page->swap_index != -1 ) {
     swap_free(page);
@@ -39,15 +216,55 @@ void destroy_page (struct hash_elem *elem1, void *aux UNUSED)
   free (page);
 }
 
-/* Search the hash table for a page, returns null if no such */
-struct spt_entry * get_page_from_hash (void *given_address)
+/* Search the current process's page table for a page, returns null if no such.
+   A page of a VMA gets its descriptor here, the first time it is looked up.
+   Must be called with the spt_lock held. */
+struct spt_entry * get_page_from_spt (void *given_address)
 {
   struct thread *t = thread_current ();
-  struct spt_entry page;
-  struct hash_elem *elem_in_hash;
+  struct spt_entry *page;
+  struct vma *v;
 
-  page.vaddr = (void *) (pg_no(given_address) << PGBITS);
-  elem_in_hash = hash_find (&t->spt, &page.elem);
-  return elem_in_hash != NULL ? hash_entry (elem_in_hash, struct spt_entry, elem) : NULL;
+  ASSERT (lock_held_by_current_thread (&t->spt_lock));
+  page = spt_find (&t->spt, given_address);
+  if (page != NULL || !is_user_vaddr (given_address))
+    return page;
+  v = vma_find (&t->vmas, given_address);
+  return v != NULL ? page_from_vma (v, pg_round_down (given_address)) : NULL;
 }
 
+/* Makes the descriptor of page VADDR of area V, not loaded yet, and
+   adds it to the current process's page table. */
+static struct spt_entry *
+page_from_vma (struct vma *v, void *vaddr)
+{
+  struct thread *t = thread_current ();
+  size_t delta = (uint8_t *) vaddr - v->start;
+  struct spt_entry *page = malloc (sizeof *page);
+
+  if (page == NULL)
+    return NULL;
+  page->vaddr = vaddr;
+  page->frame = NULL;
+  page->pagedir = t->pagedir;
+  page->rss = &t->rss;
+  page->file = v->file;
+  page->offset = v->offset + delta;
+  page->swap_index = -1;
+  page->bytes_read = delta < v->file_bytes
+                     ? (v->file_bytes - delta < PGSIZE ? v->file_bytes - delta : PGSIZE)
+                     : 0;
+  page->bytes_zero = PGSIZE - page->bytes_read;
+  page->page_status = 2; /* file page */
+  page->advice = MADV_NORMAL;
+  page->is_stack = false;
+  page->is_mmap = v->is_mmap;
+  page->writable = v->writable;
+  page->pinned = false;
+  if (!spt_insert (&t->spt, page))
+    {
+      free (page);
+      return NULL;
+    }
+  return page;
+}
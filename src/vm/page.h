@@ -2,36 +2,76 @@
 #define VM_PAGE_H
 
 #include <stdint.h>
-#include <hash.h>
+#include <syscall-types.h>
 #include "threads/palloc.h"
+#include "threads/vaddr.h"
 #include "filesys/file.h"
 #include "vm/frame.h"
+#include "vm/vma.h"
 #include "threads/synch.h"
 
+/* Page descriptor, kept small: a process has one for every page of
+   its address space. */
 struct spt_entry
 {
-	struct hash_elem elem; /* Hash table elem */
     void *vaddr; /* Page's virtual address */
     struct frame *frame; /* Frame that holds this page */
-    int page_status; /* 0: mmaped 1: in swap 2: in file 3: in frame */
+    struct list_elem share_elem; /* Element in frame's sharers */
     uint32_t *pagedir; /* Holder for owner page directory, used instead of holding owner thread */
+    struct rss *rss; /* Owner's resident set, charged while this page has a frame */
 
     /* MMAP */
 	struct file * file;
-    size_t bytes_read;
-    size_t bytes_zero;
 	off_t offset;
+    int swap_index; /* Used for swap table */
+    uint16_t bytes_read;
+    uint16_t bytes_zero;
 
+    uint8_t page_status; /* 0: mmaped 1: in swap 2: in file 3: in frame 4: in swap cache (read ahead, unmapped) 5: on the zero page */
+    uint8_t advice; /* MADV_* given to madvise, steers fault-around */
 	bool is_stack;
+    bool is_mmap; /* Backed by a file mapped with mmap */
 	bool writable;
     bool pinned;
-    struct spinlock lock;
-    int swap_index; /* Used for swap table */
 };
 
-unsigned page_hash (const struct hash_elem *, void *);
-bool is_page_before (const struct hash_elem *, const struct hash_elem *, void *);
-void destroy_page (struct hash_elem *, void *);
-struct spt_entry * get_page_from_hash (void *);
+/* Supplemental page table: a radix tree over user virtual page
+   numbers, like the page directory with one more level.  A leaf
+   covers SPT_LEAF_CNT consecutive pages and a middle node
+   SPT_MID_CNT leaves, so a sparse address space only pays for the
+   regions it uses and walks over a range touch neighbouring slots. */
+#define SPT_LEAF_BITS 6
+#define SPT_MID_BITS 6
+#define SPT_ROOT_BITS (32 - PGBITS - SPT_MID_BITS - SPT_LEAF_BITS)
+#define SPT_LEAF_CNT (1 << SPT_LEAF_BITS)
+#define SPT_MID_CNT (1 << SPT_MID_BITS)
+#define SPT_ROOT_CNT (1 << SPT_ROOT_BITS)
+
+struct spt_leaf
+{
+    struct spt_entry *pages[SPT_LEAF_CNT];
+    int cnt; /* Non-null pages */
+};
+
+struct spt_mid
+{
+    struct spt_leaf *leaves[SPT_MID_CNT];
+    int cnt; /* Non-null leaves */
+};
+
+struct spt
+{
+    struct spt_mid **root; /* SPT_ROOT_CNT middle nodes, NULL while empty */
+};
+
+void spt_init (struct spt *);
+bool spt_insert (struct spt *, struct spt_entry *);
+struct spt_entry *spt_find (struct spt *, const void *);
+struct spt_entry *spt_remove (struct spt *, const void *);
+struct spt_entry *spt_next (struct spt *, const void *, const void *);
+void spt_destroy (struct spt *, void (*) (struct spt_entry *));
+
+void destroy_page (struct spt_entry *);
+struct spt_entry * get_page_from_spt (void *);
 
-#endif
\ No newline at end of file
+#endif
@@ -4,16 +4,27 @@
 #include <bitmap.h>
 #include "devices/block.h"
 #include "vm/frame.h"
+#include "vm/zswap.h"
 #include "threads/vaddr.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "userprog/process.h"
 #include "vm/page.h"
 
 #define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE) // 8
+#define SWAP_INFLIGHT 4         /* Most runs of a batch written at once */
 static struct bitmap *used_blocks;
+static uint16_t *slot_refs;     /* Pages referring to each slot, for forked processes */
 struct block *block_swap;
-static struct lock block_lock;
+static struct lock block_lock;  /* Protects used_blocks and swap_cursor only */
+static size_t swap_cursor;      /* Next-fit allocation point */
+
+static size_t swap_alloc(size_t cnt);
+static void swap_release(size_t slot);
+static size_t swap_ra_window(size_t slot);
+static struct spt_entry *swap_ra_candidate(struct spt_entry *, size_t slot);
 
 /*
  * Creates bitmap
@@ -23,6 +34,63 @@ void swap_init(void)
     lock_init(&block_lock);
     block_swap = block_get_role(BLOCK_SWAP);
     used_blocks = bitmap_create(block_size(block_swap) / SECTORS_PER_PAGE);
+    slot_refs = calloc(bitmap_size(used_blocks), sizeof *slot_refs);
+    swap_cursor = 0;
+    zswap_init();
+}
+
+/*
+ * Starts RA off reading just the faulting page.
+ */
+void swap_ra_init(struct swap_ra *ra)
+{
+    ra->hits = 0;
+    ra->window = 1;
+    ra->last_slot = 0;
+}
+
+/*
+ * Allocates CNT contiguous slots. Searches forward from where the last
+ * allocation ended so that consecutive batches land next to each other
+ * on disk, then wraps around. Returns BITMAP_ERROR if no run of CNT
+ * free slots exists.
+ */
+static size_t swap_alloc(size_t cnt)
+{
+    lock_acquire(&block_lock);
+    size_t slot = bitmap_scan_and_flip(used_blocks, swap_cursor, cnt, false);
+    if (slot == BITMAP_ERROR)
+        slot = bitmap_scan_and_flip(used_blocks, 0, cnt, false);
+    if (slot != BITMAP_ERROR) {
+        swap_cursor = slot + cnt;
+        for (size_t i = 0; i < cnt; i++)
+            slot_refs[slot + i] = 1;
+    }
+    lock_release(&block_lock);
+    return slot;
+}
+
+/*
+ * Drops one reference to SLOT, freeing it with the last one.
+ * Must be called with block_lock held.
+ */
+static void swap_release(size_t slot)
+{
+    ASSERT(slot_refs[slot] > 0);
+    if (--slot_refs[slot] == 0 && zswap_invalidate(slot))
+        bitmap_reset(used_blocks, slot);
+}
+
+/*
+ * Frees SLOT, which nothing refers to any more, once zswap has
+ * finished writing its old contents back.
+ */
+void swap_unreserve(size_t slot)
+{
+    lock_acquire(&block_lock);
+    ASSERT(slot_refs[slot] == 0);
+    bitmap_reset(used_blocks, slot);
+    lock_release(&block_lock);
 }
 
 /*
@@ -30,39 +98,235 @@ void swap_init(void)
  */
 void swap_insert(struct spt_entry *p)
 {
-    lock_acquire(&block_lock);
-    size_t sector_num = bitmap_scan_and_flip(used_blocks, 0, 1, false);
+    swap_insert_batch(&p, 1);
+}
+
+/*
+ * Writes PAGE to the disk under SLOT. Used by the compressed tier to
+ * move its oldest pages out.
+ */
+void swap_write_slot(size_t slot, const void *page)
+{
+    struct block_iovec iov = { (void *) page, SECTORS_PER_PAGE };
+    block_writev(block_swap, slot * SECTORS_PER_PAGE, &iov, 1);
+}
+
+/*
+ * Writes the CNT pages in PAGES, each still held in its frame, to swap.
+ * Slots come from one contiguous run when one is free. Pages that
+ * compress well stay in RAM in the compressed tier; the rest go to the
+ * disk, each run of neighbouring slots as a single multi-sector write,
+ * up to SWAP_INFLIGHT of them on their way at once. Returns once all
+ * are written. If swap is too fragmented the batch is split in half
+ * until the pieces fit.
+ */
+void swap_insert_batch(struct spt_entry **pages, size_t cnt)
+{
+    struct block_iovec iov[SWAP_CLUSTER_PAGES];
+    struct bio bios[SWAP_INFLIGHT];
+    struct semaphore done;
+    size_t first = 0, disk = 0, inflight = 0;
 
-    ASSERT( sector_num != BITMAP_ERROR );
+    ASSERT(cnt > 0 && cnt <= SWAP_CLUSTER_PAGES);
 
-    p->swap_index = sector_num;
-    p->page_status = 1;
+    size_t slot = swap_alloc(cnt);
+    if (slot == BITMAP_ERROR) {
+        ASSERT(cnt > 1);
+        swap_insert_batch(pages, cnt / 2);
+        swap_insert_batch(pages + cnt / 2, cnt - cnt / 2);
+        return;
+    }
 
-    for (int i = 0; i < SECTORS_PER_PAGE; i++)
-    {
-        block_write(block_swap, sector_num * SECTORS_PER_PAGE + i, (uint8_t *) p->frame->paddr + i * BLOCK_SECTOR_SIZE);
+    /* IOV holds the pages bound for the disk; those from FIRST on
+       make up the current run. */
+    sema_init(&done, 0);
+    for (size_t i = 0; i <= cnt; i++) {
+        if (i < cnt) {
+            pages[i]->swap_index = slot + i;
+            pages[i]->page_status = 1;
+            if (!zswap_store(slot + i, pages[i]->frame->paddr)) {
+                iov[disk].buffer = pages[i]->frame->paddr;
+                iov[disk].cnt = SECTORS_PER_PAGE;
+                disk++;
+                continue;
+            }
+        }
+        if (disk > first) {
+            struct bio *bio = &bios[inflight++];
+            bio->write = true;
+            bio->sector = (slot + i - (disk - first)) * SECTORS_PER_PAGE;
+            bio->iov = iov + first;
+            bio->iov_cnt = disk - first;
+            bio->end = block_bio_wake;
+            bio->aux = &done;
+            block_submit(block_swap, bio);
+            first = disk;
+        }
+        if (inflight == SWAP_INFLIGHT || i == cnt) {
+            while (inflight > 0) {
+                sema_down(&done);
+                inflight--;
+            }
+        }
     }
+}
 
-    lock_release(&block_lock);
+/*
+ * Sizes the readahead window for a swap-in of SLOT by the current
+ * process from how many pages its previous readahead brought in were
+ * actually used, so that each process's window follows its own access
+ * pattern. With H hits the window is H + 2 rounded up to a power of
+ * two, at most SWAP_CLUSTER_PAGES. With none it is 2 if SLOT is next
+ * to the slot read last time and 1 otherwise. Either way it never
+ * drops below half the previous window, so a run of misses halves it
+ * each time: 16, 8, 4, 2 and then 1, the faulting page alone (or 2 for
+ * an adjacent fault).
+ */
+static size_t swap_ra_window(size_t slot)
+{
+    struct swap_ra *ra = &thread_current()->swap_ra;
+    size_t pages = ra->hits + 2;
+    if (pages == 2) {
+        if (slot != ra->last_slot + 1 && slot + 1 != ra->last_slot)
+            pages = 1;
+    }
+    else {
+        size_t pow = 1;
+        while (pow < pages)
+            pow <<= 1;
+        pages = pow;
+    }
+    if (pages > SWAP_CLUSTER_PAGES)
+        pages = SWAP_CLUSTER_PAGES;
+    if (pages < ra->window / 2)
+        pages = ra->window / 2;
+    ra->window = pages;
+    ra->hits = 0;
+    ra->last_slot = slot;
+    return pages;
 }
 
 /*
- * Read from swap into the page
+ * Returns the page of the current process whose data is in SLOT, if it
+ * sits where swap clustering would have put it relative to P and is
+ * still only in swap, on disk. Otherwise NULL.
+ */
+static struct spt_entry *swap_ra_candidate(struct spt_entry *p, size_t slot)
+{
+    struct thread *t = thread_current();
+    uint8_t *vaddr = (uint8_t *) p->vaddr + ((int) slot - p->swap_index) * PGSIZE;
+
+    if (vaddr == NULL || !is_user_vaddr(vaddr))
+        return NULL;
+    lock_acquire(&t->spt_lock);
+    struct spt_entry *c = spt_find(&t->spt, vaddr);
+    lock_release(&t->spt_lock);
+    if (c == NULL || c->page_status != 1 || c->frame != NULL || c->pinned
+        || c->swap_index != (int) slot || zswap_contains(slot))
+        return NULL;
+    return c;
+}
+
+/*
+ * Read from swap into the page, decompressing it if the compressed
+ * tier has it and reading the disk otherwise.
+ * Neighbouring slots holding neighbouring pages of the same process are
+ * read in the same transfer and left in the swap cache: in a frame, but
+ * unmapped and still owning their slot (page_status 4). A later fault
+ * maps them with swap_cache_map() without any I/O, and the frame table
+ * can take them back without writing anything.
  */
 void swap_get(struct spt_entry *p)
 {
-    lock_acquire(&block_lock);
+    struct spt_entry *run[SWAP_CLUSTER_PAGES];
+    struct block_iovec iov[SWAP_CLUSTER_PAGES];
+    size_t slot = p->swap_index;
+    size_t win, lo, hi;
+    size_t first = slot, cnt = 0;
 
-    for (int i = 0; i < SECTORS_PER_PAGE; i++)
-    {
-        block_read(block_swap, p->swap_index * SECTORS_PER_PAGE + i, (uint8_t *) p->frame->paddr + i * BLOCK_SECTOR_SIZE);
+    if (zswap_load(slot, p->frame->paddr))
+        goto done;
+
+    win = swap_ra_window(slot);
+    lo = slot - slot % win;
+    hi = lo + win;
+    if (hi > bitmap_size(used_blocks))
+        hi = bitmap_size(used_blocks);
+
+    /* Grow a run of slots around SLOT, stopping at the first slot that
+       does not hold the matching neighbour. Backwards first, into the
+       tail of run[], then moved to the front in slot order. */
+    while (first > lo) {
+        struct spt_entry *c = swap_ra_candidate(p, first - 1);
+        if (c == NULL)
+            break;
+        first--;
+        run[SWAP_CLUSTER_PAGES - (slot - first)] = c;
+    }
+    for (; cnt < slot - first; cnt++)
+        run[cnt] = run[SWAP_CLUSTER_PAGES - (slot - first) + cnt];
+    run[cnt++] = p;
+    for (size_t next = slot + 1; next < hi; next++) {
+        struct spt_entry *c = swap_ra_candidate(p, next);
+        if (c == NULL)
+            break;
+        run[cnt++] = c;
+    }
+
+    for (size_t i = 0; i < cnt; i++) {
+        if (run[i] != p)
+            find_frame(run[i]);
+        iov[i].buffer = run[i]->frame->paddr;
+        iov[i].cnt = SECTORS_PER_PAGE;
     }
+    block_readv(block_swap, first * SECTORS_PER_PAGE, iov, cnt);
 
-    bitmap_reset(used_blocks, p->swap_index);
+    for (size_t i = 0; i < cnt; i++) {
+        if (run[i] == p)
+            continue;
+        run[i]->page_status = 4;
+        frame_unpin(run[i]->frame);
+    }
+
+done:
+    lock_acquire(&block_lock);
+    swap_release(p->swap_index);
+    lock_release(&block_lock);
 
     p->swap_index = -1;
     p->page_status = 3;
+}
+
+/*
+ * Maps P, a page of the current process, straight from the swap cache.
+ * Returns false if the frame table has reclaimed it meanwhile; P is then
+ * back in swap and must be read in as usual.
+ */
+bool swap_cache_map(struct spt_entry *p)
+{
+    struct frame *f = p->frame;
+
+    if (f == NULL)
+        return false;
+    lock_acquire(&f->lock);
+    if (f->page != p || p->page_status != 4) {
+        lock_release(&f->lock);
+        return false;
+    }
+    if (!install_page(p->vaddr, f->paddr, p->writable)) {
+        lock_release(&f->lock);
+        thread_exit(-1);
+    }
+    p->page_status = 3;
+
+    lock_acquire(&block_lock);
+    swap_release(p->swap_index);
     lock_release(&block_lock);
+    thread_current()->swap_ra.hits++;
+    p->swap_index = -1;
+
+    lock_release(&f->lock);
+    return true;
 }
 
 /*
@@ -71,6 +335,19 @@ void swap_get(struct spt_entry *p)
 void swap_free(struct spt_entry *p)
 {
     lock_acquire(&block_lock);
-    bitmap_reset(used_blocks, p->swap_index);
+    swap_release(p->swap_index);
+    lock_release(&block_lock);
+}
+
+/*
+ * Records that P, a copy of another page made by fork, refers to the
+ * same swap slot as that page. The slot is freed once every page
+ * referring to it has read it back or gone away.
+ */
+void swap_ref(struct spt_entry *p)
+{
+    lock_acquire(&block_lock);
+    ASSERT(slot_refs[p->swap_index] > 0);
+    slot_refs[p->swap_index]++;
     lock_release(&block_lock);
-}
\ No newline at end of file
+}
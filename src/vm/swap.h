@@ -1,10 +1,30 @@
 #ifndef VM_SWAP_H
 #define VM_SWAP_H
+#include <stdbool.h>
+#include <stddef.h>
 #include "vm/page.h"
 
+/* Most pages evicted to swap together in one batch. Their slots are
+   allocated as one contiguous run and written with a single transfer. */
+#define SWAP_CLUSTER_PAGES 16
+
+/* A process's swap readahead state. Only the process itself reads
+   its pages back from swap, so this needs no lock. */
+struct swap_ra {
+    unsigned hits; /* Swap cache hits since its last swap-in */
+    size_t window; /* Window used by its last swap-in */
+    size_t last_slot; /* Slot read by its last swap-in */
+};
+
 void swap_init (void);
+void swap_ra_init (struct swap_ra *);
 void swap_insert (struct spt_entry *);
+void swap_insert_batch (struct spt_entry **, size_t);
 void swap_get (struct spt_entry *);
+void swap_write_slot (size_t slot, const void *page);
+void swap_unreserve (size_t slot);
+bool swap_cache_map (struct spt_entry *);
 void swap_free (struct spt_entry *);
+void swap_ref (struct spt_entry *);
 
-#endif
\ No newline at end of file
+#endif
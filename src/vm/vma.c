@@ -0,0 +1,200 @@
+#include "vm/vma.h"
+#include <debug.h>
+
+static int height (struct vma *);
+static void update_height (struct vma *);
+static struct vma *rebalance (struct vma *);
+static struct vma *tree_insert (struct vma *, struct vma *);
+static struct vma *tree_remove (struct vma *, struct vma *);
+static struct vma *tree_remove_min (struct vma *, struct vma **);
+static void tree_destroy (struct vma *, void (*) (struct vma *));
+
+/* Makes T an empty tree. */
+void
+vma_tree_init (struct vma_tree *t)
+{
+  t->root = NULL;
+}
+
+/* Adds area V to T. Returns false, leaving T alone, if V overlaps an
+   area already there. */
+bool
+vma_insert (struct vma_tree *t, struct vma *v)
+{
+  ASSERT (v->start < v->end);
+  if (vma_first (t, v->start, v->end) != NULL)
+    return false;
+  t->root = tree_insert (t->root, v);
+  return true;
+}
+
+/* Takes area V out of T. */
+void
+vma_remove (struct vma_tree *t, struct vma *v)
+{
+  t->root = tree_remove (t->root, v);
+}
+
+/* Returns the area of T containing ADDR, or NULL. */
+struct vma *
+vma_find (struct vma_tree *t, const void *addr)
+{
+  return vma_first (t, addr, (const uint8_t *) addr + 1);
+}
+
+/* Returns the lowest area of T overlapping [START, END), or NULL.
+   That is the area with the lowest end above START, if it begins
+   below END. */
+struct vma *
+vma_first (struct vma_tree *t, const void *start, const void *end)
+{
+  struct vma *n = t->root, *found = NULL;
+
+  while (n != NULL)
+    {
+      if (n->end > (const uint8_t *) start)
+        {
+          found = n;
+          n = n->left;
+        }
+      else
+        n = n->right;
+    }
+  return found != NULL && found->start < (const uint8_t *) end ? found : NULL;
+}
+
+/* Calls DESTROY on every area of T, which is left empty. */
+void
+vma_destroy (struct vma_tree *t, void (*destroy) (struct vma *))
+{
+  tree_destroy (t->root, destroy);
+  t->root = NULL;
+}
+
+/* Height of subtree N. */
+static int
+height (struct vma *n)
+{
+  return n != NULL ? n->height : 0;
+}
+
+/* Recomputes the height of N from its children's. */
+static void
+update_height (struct vma *n)
+{
+  int l = height (n->left), r = height (n->right);
+  n->height = 1 + (l > r ? l : r);
+}
+
+/* Right rotation at N; returns the new subtree root. */
+static struct vma *
+rotate_right (struct vma *n)
+{
+  struct vma *l = n->left;
+  n->left = l->right;
+  l->right = n;
+  update_height (n);
+  update_height (l);
+  return l;
+}
+
+/* Left rotation at N; returns the new subtree root. */
+static struct vma *
+rotate_left (struct vma *n)
+{
+  struct vma *r = n->right;
+  n->right = r->left;
+  r->left = n;
+  update_height (n);
+  update_height (r);
+  return r;
+}
+
+/* Restores the AVL balance of N, whose children are balanced, and
+   returns the new subtree root. */
+static struct vma *
+rebalance (struct vma *n)
+{
+  int balance = height (n->left) - height (n->right);
+
+  if (balance > 1)
+    {
+      if (height (n->left->left) < height (n->left->right))
+        n->left = rotate_left (n->left);
+      return rotate_right (n);
+    }
+  if (balance < -1)
+    {
+      if (height (n->right->right) < height (n->right->left))
+        n->right = rotate_right (n->right);
+      return rotate_left (n);
+    }
+  update_height (n);
+  return n;
+}
+
+/* Inserts V into subtree N; returns the new subtree root. */
+static struct vma *
+tree_insert (struct vma *n, struct vma *v)
+{
+  if (n == NULL)
+    {
+      v->left = v->right = NULL;
+      v->height = 1;
+      return v;
+    }
+  if (v->start < n->start)
+    n->left = tree_insert (n->left, v);
+  else
+    n->right = tree_insert (n->right, v);
+  return rebalance (n);
+}
+
+/* Removes V from subtree N; returns the new subtree root. */
+static struct vma *
+tree_remove (struct vma *n, struct vma *v)
+{
+  struct vma *min;
+
+  if (n == NULL)
+    return NULL;
+  if (v->start < n->start)
+    n->left = tree_remove (n->left, v);
+  else if (v->start > n->start)
+    n->right = tree_remove (n->right, v);
+  else
+    {
+      if (n->right == NULL)
+        return n->left;
+      n->right = tree_remove_min (n->right, &min);
+      min->left = n->left;
+      min->right = n->right;
+      n = min;
+    }
+  return rebalance (n);
+}
+
+/* Removes the lowest area of subtree N, storing it in *MIN; returns
+   the new subtree root. */
+static struct vma *
+tree_remove_min (struct vma *n, struct vma **min)
+{
+  if (n->left == NULL)
+    {
+      *min = n;
+      return n->right;
+    }
+  n->left = tree_remove_min (n->left, min);
+  return rebalance (n);
+}
+
+/* Calls DESTROY on every area of subtree N. */
+static void
+tree_destroy (struct vma *n, void (*destroy) (struct vma *))
+{
+  if (n == NULL)
+    return;
+  tree_destroy (n->left, destroy);
+  tree_destroy (n->right, destroy);
+  destroy (n);
+}
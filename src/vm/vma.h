@@ -0,0 +1,43 @@
+#ifndef VM_VMA_H
+#define VM_VMA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+
+struct file;
+
+/* A virtual memory area: one contiguous run of pages mapped from one
+   file (an ELF segment or an mmap), with the same permissions.  Pages
+   get their own descriptor in the SPT only when first touched. */
+struct vma
+{
+    uint8_t *start;        /* First page */
+    uint8_t *end;          /* Just past the last page */
+    struct file *file;     /* Backing file */
+    off_t offset;          /* File offset of START */
+    size_t file_bytes;     /* Bytes read from the file; the rest is zeros */
+    bool writable;
+    bool is_mmap;          /* Mapped with mmap, written back on munmap */
+
+    /* Interval tree.  Areas never overlap, so ordering by start also
+       orders their ends, and a balanced search tree on start answers
+       overlap queries. */
+    struct vma *left, *right;
+    int height;            /* AVL height of the subtree */
+};
+
+struct vma_tree
+{
+    struct vma *root;
+};
+
+void vma_tree_init (struct vma_tree *);
+bool vma_insert (struct vma_tree *, struct vma *);
+void vma_remove (struct vma_tree *, struct vma *);
+struct vma *vma_find (struct vma_tree *, const void *);
+struct vma *vma_first (struct vma_tree *, const void *, const void *);
+void vma_destroy (struct vma_tree *, void (*) (struct vma *));
+
+#endif
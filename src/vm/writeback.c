@@ -0,0 +1,152 @@
+#include "vm/writeback.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic-ops.h>
+#include "vm/page.h"
+#include "vm/frame.h"
+#include "vm/vma.h"
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "userprog/pagedir.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "threads/synch.h"
+
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Statistics, changed atomically. */
+static int page_cnt;                /* Dirty pages written back */
+static int write_cnt;               /* Writes issued for them */
+static int direct_cnt;              /* Of those, runs written around the cache */
+
+static size_t write_run(struct spt_entry **, size_t cnt);
+
+/*
+ * Writes the CNT pages in PAGES back to their file, which they all
+ * share, from the frames holding them. The pages are sorted by offset
+ * and their frames pinned or locked so that the contents hold still.
+ * Runs of consecutive whole pages are written together.
+ */
+void writeback_pages(struct spt_entry **pages, size_t cnt)
+{
+    size_t i = 0;
+
+    while (i < cnt)
+    {
+        size_t n = 1;
+        while (i + n < cnt && pages[i + n - 1]->bytes_read == PGSIZE
+               && pages[i + n]->offset == pages[i + n - 1]->offset + PGSIZE)
+            n++;
+        while (n > 0)
+        {
+            size_t done = write_run(pages + i, n);
+            i += done;
+            n -= done;
+        }
+    }
+}
+
+/*
+ * Writes the CNT pages of PAGES, consecutive in their file, and returns
+ * how many it wrote: all of them, unless a direct write fell short, in
+ * which case the rest is left for another try through the cache.
+ */
+static size_t write_run(struct spt_entry **pages, size_t cnt)
+{
+    struct file *file = pages[0]->file;
+    size_t whole = pages[cnt - 1]->bytes_read == PGSIZE ? cnt : cnt - 1;
+
+    /* Only whole pages go direct: the tail of the file's last sector
+       is the cache's business. */
+    if (whole >= WB_DIRECT_PAGES)
+    {
+        struct block_iovec iov[WB_BATCH_PAGES];
+        size_t n = whole < WB_BATCH_PAGES ? whole : WB_BATCH_PAGES;
+        for (size_t i = 0; i < n; i++)
+        {
+            iov[i].buffer = pages[i]->frame->paddr;
+            iov[i].cnt = SECTORS_PER_PAGE;
+        }
+        off_t written = inode_write_direct(file_get_inode(file), iov, n,
+                                           pages[0]->offset);
+        size_t done = written / PGSIZE;
+        atomic_addi(&page_cnt, done);
+        atomic_inci(&write_cnt);
+        atomic_inci(&direct_cnt);
+        if (done > 0)
+            return done;
+    }
+
+    file_write_at(file, pages[0]->frame->paddr, pages[0]->bytes_read,
+                  pages[0]->offset);
+    atomic_inci(&page_cnt);
+    atomic_inci(&write_cnt);
+    return 1;
+}
+
+/*
+ * Writes back the dirty pages of the current process's mmapped area V
+ * that lie in [START, END), leaving them mapped and clean. Pages are
+ * gathered WB_BATCH_PAGES at a time, each with its frame pinned so
+ * that it cannot be evicted halfway, and its dirty bit cleared before
+ * the write, so that stores made meanwhile dirty it again.
+ */
+void writeback_range(struct vma *v, void *start, void *end)
+{
+    struct thread *t = thread_current();
+    struct spt_entry *batch[WB_BATCH_PAGES];
+    size_t cnt = 0;
+    uint8_t *va = start;
+
+    ASSERT(v->is_mmap);
+    for (;;)
+    {
+        lock_acquire(&t->spt_lock);
+        struct spt_entry *p = spt_next(&t->spt, va, end);
+        lock_release(&t->spt_lock);
+
+        if (p != NULL)
+        {
+            va = (uint8_t *) p->vaddr + PGSIZE;
+
+            /* A frame pinned by someone else is being evicted, which
+               writes the page back if it needs it; wait that out. */
+            struct frame *f;
+            while ((f = p->frame) != NULL && !frame_pin(f, p))
+            {
+                lock_acquire(&f->lock);
+                lock_release(&f->lock);
+                thread_yield();
+            }
+            if (f != NULL)
+            {
+                if (p->page_status == 3 && pagedir_is_dirty(t->pagedir, p->vaddr))
+                {
+                    pagedir_set_dirty(t->pagedir, p->vaddr, false);
+                    batch[cnt++] = p;
+                }
+                else
+                    frame_unpin(f);
+            }
+        }
+
+        if (cnt == WB_BATCH_PAGES || (p == NULL && cnt > 0))
+        {
+            writeback_pages(batch, cnt);
+            for (size_t i = 0; i < cnt; i++)
+                frame_unpin(batch[i]->frame);
+            cnt = 0;
+        }
+        if (p == NULL)
+            break;
+    }
+}
+
+/*
+ * Prints how much writeback there was and how well it coalesced.
+ */
+void writeback_print_stats(void)
+{
+    printf("Writeback: %d pages in %d writes, %d direct\n",
+           page_cnt, write_cnt, direct_cnt);
+}
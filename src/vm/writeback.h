@@ -0,0 +1,24 @@
+#ifndef VM_WRITEBACK_H
+#define VM_WRITEBACK_H
+#include <stddef.h>
+
+struct spt_entry;
+struct vma;
+
+/* Writeback of dirty mmapped pages to their files.  Pages are taken
+   in file order and consecutive ones coalesced into runs; a run of at
+   least WB_DIRECT_PAGES whole pages goes to the disk directly, with
+   one request per stretch of contiguous sectors, and shorter ones go
+   through the buffer cache.  Clean pages cost nothing. */
+
+/* Most pages gathered before they are written. */
+#define WB_BATCH_PAGES 32
+
+/* Shortest run written around the buffer cache. */
+#define WB_DIRECT_PAGES 8
+
+void writeback_pages (struct spt_entry **pages, size_t cnt);
+void writeback_range (struct vma *, void *start, void *end);
+void writeback_print_stats (void);
+
+#endif
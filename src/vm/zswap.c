@@ -0,0 +1,406 @@
+#include "vm/zswap.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <bitmap.h>
+#include <hash.h>
+#include <list.h>
+#include <round.h>
+#include "vm/swap.h"
+#include "threads/vaddr.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+
+#define ZSWAP_CHUNK 64                  /* Arena allocation unit, in bytes */
+#define ZSWAP_MAX_SIZE (PGSIZE * 3 / 4) /* Pages compressing worse go to disk */
+#define LZ_HASH_BITS 12                 /* Compressor match table size */
+#define LZ_MIN_MATCH 4
+
+/* A page held compressed in the arena */
+struct zswap_entry {
+    struct hash_elem elem;      /* Element in zswap_index, by slot */
+    struct list_elem lru_elem;  /* Element in zswap_lru */
+    size_t slot;                /* Swap slot the page was given */
+    size_t chunk;               /* First arena chunk holding it */
+    size_t len;                 /* Compressed length in bytes */
+    bool writing;               /* Being written back to its slot? */
+    bool freed;                 /* Slot freed during the write-back? */
+};
+
+/* Scratch space for one zswap_store() call, so that compressing a
+   page and writing one back need no lock. */
+struct zswap_scratch {
+    uint16_t lz_table[1 << LZ_HASH_BITS]; /* Compressor match finder */
+    uint8_t zbuf[ZSWAP_MAX_SIZE];         /* Compressor output */
+    uint8_t wbuf[PGSIZE];                 /* Page on its way to disk */
+};
+
+static uint8_t *arena;              /* Compressed pages, NULL if no memory */
+static struct bitmap *arena_used;   /* One bit per ZSWAP_CHUNK of arena */
+static struct hash zswap_index;     /* Entries by slot */
+static struct list zswap_lru;       /* Entries not being written back, least recently stored first */
+static struct lock zswap_lock;      /* Protects all of the above */
+
+/* Statistics, under zswap_lock. */
+static long long stored_cnt;        /* Pages compressed into the arena */
+static long long loaded_cnt;        /* Swap-ins served from the arena */
+static long long writeback_cnt;     /* Pages moved on to disk */
+static long long reject_cnt;        /* Pages that did not compress well */
+
+static struct zswap_entry *zswap_find(size_t slot);
+static void zswap_remove(struct zswap_entry *);
+static void zswap_writeback(struct zswap_entry *, uint8_t *wbuf);
+static size_t lz_compress(const uint8_t *src, uint8_t *dst, size_t cap,
+                          uint16_t *table);
+static bool lz_decompress(const uint8_t *src, size_t len, uint8_t *dst);
+static unsigned zswap_hash(const struct hash_elem *, void *);
+static bool zswap_less(const struct hash_elem *, const struct hash_elem *, void *);
+
+/*
+ * Sets up the arena, as large as the kernel pool allows up to
+ * ZSWAP_ARENA_PAGES. Without any, every page goes straight to disk.
+ */
+void zswap_init(void)
+{
+    size_t pages = ZSWAP_ARENA_PAGES;
+
+    lock_init(&zswap_lock);
+    hash_init(&zswap_index, zswap_hash, zswap_less, NULL);
+    list_init(&zswap_lru);
+    while (pages > 0 && (arena = palloc_get_multiple(0, pages)) == NULL)
+        pages /= 2;
+    if (arena != NULL)
+        arena_used = bitmap_create(pages * PGSIZE / ZSWAP_CHUNK);
+    if (arena_used == NULL && arena != NULL) {
+        palloc_free_multiple(arena, pages);
+        arena = NULL;
+    }
+}
+
+/*
+ * Compresses PAGE into the arena as the contents of SLOT. Makes room
+ * by writing the oldest entries to their slots on disk if need be.
+ * Returns false if PAGE does not compress well enough to be worth it,
+ * in which case the caller writes it to disk itself.
+ */
+bool zswap_store(size_t slot, const void *page)
+{
+    struct zswap_scratch *scratch;
+    struct zswap_entry *e;
+    size_t len, chunks, chunk;
+
+    if (arena == NULL)
+        return false;
+    scratch = malloc(sizeof *scratch);
+    e = malloc(sizeof *e);
+    if (scratch == NULL || e == NULL) {
+        free(scratch);
+        free(e);
+        return false;
+    }
+    len = lz_compress(page, scratch->zbuf, ZSWAP_MAX_SIZE, scratch->lz_table);
+
+    lock_acquire(&zswap_lock);
+    if (len == 0) {
+        reject_cnt++;
+        goto fail;
+    }
+    chunks = DIV_ROUND_UP(len, ZSWAP_CHUNK);
+    while ((chunk = bitmap_scan_and_flip(arena_used, 0, chunks, false)) == BITMAP_ERROR) {
+        if (list_empty(&zswap_lru))
+            goto fail;
+        zswap_writeback(list_entry(list_front(&zswap_lru), struct zswap_entry, lru_elem),
+                        scratch->wbuf);
+    }
+    e->slot = slot;
+    e->chunk = chunk;
+    e->len = len;
+    e->writing = false;
+    e->freed = false;
+    memcpy(arena + chunk * ZSWAP_CHUNK, scratch->zbuf, len);
+    struct hash_elem *old UNUSED = hash_insert(&zswap_index, &e->elem);
+    ASSERT(old == NULL);
+    list_push_back(&zswap_lru, &e->lru_elem);
+    stored_cnt++;
+    lock_release(&zswap_lock);
+    free(scratch);
+    return true;
+
+fail:
+    lock_release(&zswap_lock);
+    free(scratch);
+    free(e);
+    return false;
+}
+
+/*
+ * Decompresses the contents of SLOT into PAGE if the arena has them.
+ * The entry stays until the slot is freed: pages forked from the same
+ * one may still need it. An entry being written back still has its
+ * arena space, so it is served from there rather than from a disk
+ * write that may not have finished.
+ */
+bool zswap_load(size_t slot, void *page)
+{
+    struct zswap_entry *e;
+
+    if (arena == NULL)
+        return false;
+    lock_acquire(&zswap_lock);
+    e = zswap_find(slot);
+    if (e != NULL) {
+        if (!lz_decompress(arena + e->chunk * ZSWAP_CHUNK, e->len, page))
+            PANIC("zswap: slot %zu is corrupt", slot);
+        loaded_cnt++;
+    }
+    lock_release(&zswap_lock);
+    return e != NULL;
+}
+
+/*
+ * True if SLOT's contents are in the arena rather than on disk.
+ * Contents only ever move from the arena to disk, never back, so a
+ * false answer stays true for as long as the slot is allocated.
+ */
+bool zswap_contains(size_t slot)
+{
+    bool found;
+
+    if (arena == NULL)
+        return false;
+    lock_acquire(&zswap_lock);
+    found = zswap_find(slot) != NULL;
+    lock_release(&zswap_lock);
+    return found;
+}
+
+/*
+ * Drops SLOT's contents, if held, now that the slot is free. Returns
+ * false if they are being written back to the slot: it must then stay
+ * allocated until the write is done, when zswap_writeback() gives it
+ * back with swap_unreserve().
+ */
+bool zswap_invalidate(size_t slot)
+{
+    struct zswap_entry *e;
+    bool done = true;
+
+    if (arena == NULL)
+        return true;
+    lock_acquire(&zswap_lock);
+    e = zswap_find(slot);
+    if (e != NULL && e->writing) {
+        e->freed = true;
+        done = false;
+    }
+    else if (e != NULL)
+        zswap_remove(e);
+    lock_release(&zswap_lock);
+    return done;
+}
+
+/* Prints compressed swap statistics. */
+void zswap_print_stats(void)
+{
+    printf("Zswap: %lld pages stored, %lld loaded, %lld written back, %lld rejected\n",
+           stored_cnt, loaded_cnt, writeback_cnt, reject_cnt);
+}
+
+/*
+ * Returns the entry for SLOT, or NULL. Must be called with zswap_lock
+ * held.
+ */
+static struct zswap_entry *zswap_find(size_t slot)
+{
+    struct zswap_entry key;
+    struct hash_elem *e;
+
+    key.slot = slot;
+    e = hash_find(&zswap_index, &key.elem);
+    return e != NULL ? hash_entry(e, struct zswap_entry, elem) : NULL;
+}
+
+/*
+ * Frees entry E and its arena space. Must be called with zswap_lock
+ * held.
+ */
+static void zswap_remove(struct zswap_entry *e)
+{
+    hash_delete(&zswap_index, &e->elem);
+    if (!e->writing)
+        list_remove(&e->lru_elem);
+    bitmap_set_multiple(arena_used, e->chunk, DIV_ROUND_UP(e->len, ZSWAP_CHUNK), false);
+    free(e);
+}
+
+/*
+ * Moves E's page to its slot on disk, decompressing it into WBUF.
+ * Must be called with zswap_lock held, which it drops for the write.
+ * Meanwhile E is off the LRU list but keeps its index entry and arena
+ * space, so a swap-in of the slot still finds it, and the slot stays
+ * allocated even if freed, until E is removed once the write is done.
+ */
+static void zswap_writeback(struct zswap_entry *e, uint8_t *wbuf)
+{
+    size_t slot = e->slot;
+    bool freed;
+
+    if (!lz_decompress(arena + e->chunk * ZSWAP_CHUNK, e->len, wbuf))
+        PANIC("zswap: slot %zu is corrupt", slot);
+    e->writing = true;
+    list_remove(&e->lru_elem);
+    lock_release(&zswap_lock);
+
+    swap_write_slot(slot, wbuf);
+
+    lock_acquire(&zswap_lock);
+    freed = e->freed;
+    zswap_remove(e);
+    writeback_cnt++;
+    if (freed) {
+        /* swap_unreserve() takes the swap table lock, which is taken
+           before this one. */
+        lock_release(&zswap_lock);
+        swap_unreserve(slot);
+        lock_acquire(&zswap_lock);
+    }
+}
+
+/* Hash of the 4 bytes at P, for the compressor's match table. */
+static inline unsigned lz_hash(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof v);
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Writes the part of a length beyond 15 as a run of bytes. */
+static uint8_t *lz_put_len(uint8_t *op, size_t len)
+{
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = len;
+    return op;
+}
+
+/*
+ * Compresses the page at SRC into DST, an LZ4-style stream of
+ * sequences: a token byte holding the literal count and the match
+ * length, minus LZ_MIN_MATCH, in a nibble each (15 meaning more bytes
+ * follow), the literals, and a 16-bit little-endian match offset. The
+ * last sequence has literals only. Returns the compressed size, or 0
+ * if it would not fit in CAP bytes. TABLE, of 1 << LZ_HASH_BITS
+ * entries, is the match finder's scratch space.
+ */
+static size_t lz_compress(const uint8_t *src, uint8_t *dst, size_t cap,
+                          uint16_t *table)
+{
+    const uint8_t *ip = src, *anchor = src, *end = src + PGSIZE;
+    uint8_t *op = dst, *oend = dst + cap;
+    size_t lit;
+
+    memset(table, 0, sizeof *table << LZ_HASH_BITS);
+    while (ip + LZ_MIN_MATCH <= end) {
+        unsigned h = lz_hash(ip);
+        const uint8_t *ref = src + table[h];
+        table[h] = ip - src;
+        if (ref >= ip || memcmp(ref, ip, LZ_MIN_MATCH) != 0) {
+            ip++;
+            continue;
+        }
+
+        size_t mlen = LZ_MIN_MATCH;
+        while (ip + mlen < end && ref[mlen] == ip[mlen])
+            mlen++;
+        lit = ip - anchor;
+        if ((size_t) (oend - op) < 1 + lit / 255 + 1 + lit + 2 + mlen / 255 + 1)
+            return 0;
+
+        uint8_t *token = op++;
+        *token = (lit < 15 ? lit : 15) << 4
+                 | (mlen - LZ_MIN_MATCH < 15 ? mlen - LZ_MIN_MATCH : 15);
+        if (lit >= 15)
+            op = lz_put_len(op, lit - 15);
+        memcpy(op, anchor, lit);
+        op += lit;
+        *op++ = (ip - ref) & 0xff;
+        *op++ = (ip - ref) >> 8;
+        if (mlen - LZ_MIN_MATCH >= 15)
+            op = lz_put_len(op, mlen - LZ_MIN_MATCH - 15);
+        ip += mlen;
+        anchor = ip;
+    }
+
+    lit = end - anchor;
+    if ((size_t) (oend - op) < 1 + lit / 255 + 1 + lit)
+        return 0;
+    *op++ = (lit < 15 ? lit : 15) << 4;
+    if (lit >= 15)
+        op = lz_put_len(op, lit - 15);
+    memcpy(op, anchor, lit);
+    op += lit;
+    return op - dst;
+}
+
+/*
+ * Decompresses the LEN bytes at SRC, from lz_compress(), into the page
+ * at DST. Returns false if they do not make up exactly one page.
+ */
+static bool lz_decompress(const uint8_t *src, size_t len, uint8_t *dst)
+{
+    const uint8_t *ip = src, *iend = src + len;
+    uint8_t *op = dst, *oend = dst + PGSIZE;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        size_t lit = token >> 4, mlen = token & 15, off;
+
+        if (lit == 15) {
+            do {
+                if (ip >= iend)
+                    return false;
+                lit += *ip;
+            } while (*ip++ == 255);
+        }
+        if (lit > (size_t) (iend - ip) || lit > (size_t) (oend - op))
+            return false;
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return false;
+        off = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (mlen == 15) {
+            do {
+                if (ip >= iend)
+                    return false;
+                mlen += *ip;
+            } while (*ip++ == 255);
+        }
+        mlen += LZ_MIN_MATCH;
+        if (off == 0 || off > (size_t) (op - dst) || mlen > (size_t) (oend - op))
+            return false;
+        /* Byte by byte: the match may overlap what it produces. */
+        for (const uint8_t *ref = op - off; mlen > 0; mlen--)
+            *op++ = *ref++;
+    }
+    return op == oend;
+}
+
+/* Compressed page index hash function: by slot */
+static unsigned zswap_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+    return hash_int(hash_entry(e, struct zswap_entry, elem)->slot);
+}
+
+/* Compressed page index ordering: by slot */
+static bool zswap_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+    return hash_entry(a, struct zswap_entry, elem)->slot
+           < hash_entry(b, struct zswap_entry, elem)->slot;
+}
@@ -0,0 +1,21 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Compressed RAM tier in front of the swap device.  Evicted pages are
+   compressed into an arena of kernel pages under the swap slot they
+   were given; a slot's data only goes to the disk when the arena fills
+   up, least recently stored first. */
+
+/* Pages of kernel memory holding compressed pages. */
+#define ZSWAP_ARENA_PAGES 64
+
+void zswap_init (void);
+bool zswap_store (size_t slot, const void *page);
+bool zswap_load (size_t slot, void *page);
+bool zswap_contains (size_t slot);
+bool zswap_invalidate (size_t slot);
+void zswap_print_stats (void);
+
+#endif